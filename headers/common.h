@@ -5,6 +5,7 @@
 
 #define MAX_EVENTS  8
 #define NO_CHANGE   -1
+#define RECV_AGAIN  -3          /* non-blocking read found nothing to read */
 
 /**
  * Reference: 
@@ -26,67 +26,117 @@
 
 #define DEFAULT_TTL         0x00
 
-struct pkt_buf_entry {
-    struct mip_sdu *sdu;
-    struct mip_pdu *pdu;
-};
-
+/**
+ * Broadcasts a MIP packet on every local interface. The frames are queued on
+ * the link of this host and sent together by link_flush().
+ * @param ifs       Local interfaces of this host.
+ * @param src       The MIP address of this host.
+ * @param sdu_type  The SDU type of the packet.
+ * @param sdu       The MIP SDU to send.
+ * @param sdu_len   Length of the SDU.
+ * @return          -1 if error, size of each frame otherwise.
+ * */
 int mip_broadcast(const struct network_interfaces *ifs, const uint8_t src, const uint8_t sdu_type, 
     void* sdu, const size_t sdu_len);
 
 /**
  * Function that sends a MIP SDU to the socket given by socket.
  * @param socket        The socket to write to.
- * @param sdu           The SDU to send.
+ * @param src           The MIP address the SDU came from.
+ * @param ttl           The time-to-live of the SDU.
+ * @param payload       The payload of the SDU.
+ * @param len           Length of the payload.
  * @return              The number of bytes written, -1 if error.
  * */
-int mip_app_send(int socket, mip_sdu *sdu);
+int mip_app_send(int socket, uint8_t src, uint8_t ttl, char *payload, size_t len);
 
 /**
- * Receives a packet from the socket.
+ * Receives a serialized SDU (destination, ttl, payload) from the socket.
  * @param socket        The socket to read from.
- * @param dest_sdu      The SDU to store the read packet in.
+ * @param buf           Buffer of MAX_MSG_SIZE bytes to store the SDU in.
  * @return              -1 if error, -2 if the client appliaction has 
- *                      disconnected, 0 otherwise.
+ *                      disconnected, RECV_AGAIN if there is nothing to read,
+ *                      0 if the message was too short to be an SDU,
+ *                      number of bytes read otherwise.
  * */
-int mip_app_recv(int socket, mip_sdu *dest_sdu);
+int mip_app_recv(int socket, char *buf);
 
-int mip_routing_recv(int socket, char* buf);
+/**
+ * Reads a message from the routing daemon and checks its header.
+ * @param socket        The socket to read from.
+ * @param buf           Buffer of MAX_RT_PKT_SIZE bytes to store the message in.
+ * @param msg           Where to store the message.
+ * @return              -1 if error, -2 if the routing daemon has disconnected,
+ *                      RECV_AGAIN if there is nothing to read, 1 if the
+ *                      message is malformed, 0 otherwise.
+ * */
+int mip_routing_recv(int socket, char* buf, struct ctrl_msg *msg);
 
 /**
  * Function to send a MIP packet to the MIP address given by dest.
- * @param arp_table The entry point to the ARP table of this host.
+ * @param arp_table The ARP table of this host.
  * @param ifs       Local interfaces of this host.
  * @param src  The MIP address of this host.
  * @param sdu       The MIP SDU to send.
  * @param debug     Flag to indicate if the function should print debug info.
  * @return          -1 if error, 
- *                  0 if success,
- *                  1 if this function fires off an ARP request. This means 
- *                  the implementation of this protocol should store the SDU
- *                  in a buffer and send when an ARP response is returned.
+ *                  0 if the frame was queued on the link, to be sent by
+ *                  link_flush(),
+ *                  1 if the MAC address of the destination is unknown. An
+ *                  ARP request is sent unless one is already outstanding.
+ *                  This means the implementation of this protocol should
+ *                  store the SDU in a buffer and send it from the resolved
+ *                  callback of the ARP table.
  * */
-int mip_link_send(arp_entry** arp_table, ifs *ifs, mip_pdu *pdu,
+int mip_link_send(arp_table *arp_table, ifs *ifs, mip_pdu *pdu,
     char *sdu, size_t len, int debug);
 
+/**
+ * Forwards a frame received by mip_link_recv() from the buffer it was
+ * received in. The MAC addresses, the PDU and the ttl of the SDU are
+ * rewritten in place, and the link sends the frame from there if it can,
+ * without a copy.
+ * @param arp_table The ARP table of this host.
+ * @param ifs       Local interfaces of this host.
+ * @param pdu       The PDU of the frame, with dest set to the next hop and
+ *                  the ttl lowered.
+ * @param sdu       The SDU as returned by mip_link_recv(), before its next
+ *                  call. Only the bytes that call checked the frame holds
+ *                  are sent.
+ * @param debug     Flag to indicate if the function should print debug info.
+ * @return          -1 if error,
+ *                  0 if the frame was queued on the link, to be sent by
+ *                  link_flush(),
+ *                  1 if the MAC address of the next hop is unknown. The
+ *                  frame is left as it was, to be copied and sent with
+ *                  mip_link_send().
+ * */
+int mip_link_forward(arp_table *arp_table, ifs *ifs, mip_pdu *pdu, char *sdu, int debug);
+
 /**
  * Reads from the link layer socket of this host. Will reject packets that 
  * is not broadcast or targeted for the MIP address of this host. The function
  * will handle ARP packets according to the MIP RFC.
- * @param arp_table The entry point to the ARP table of this host.
+ * @param arp_table The ARP table of this host.
  * @param ifs       Local interfaces of this host.
  * @param pdu       The PDU to store the received packet in.
- * @param sdu       A buffer for the to store the received packet in.
+ * @param sdu       Where to store a pointer to the received SDU. It points
+ *                  into the link's receive batch or ring, and is valid until
+ *                  the next call. A frame to forward may be sent from there
+ *                  with mip_link_forward().
+ * @param arp_addr  Where to store the resolved address of an ARP response.
  * @param debug     Flag to indicate if the function should print debug info.
  * @return          -1 if error
  *                  0 if the SDU is to be forwared to the application layer.
  *                  1 if the SDU is meant to be forwarded after doing a routing lookup
  *                  2 if the SDU is to be forwarded to the routing application.
  *                  3 if the SDU is of type ARP response.
- *                  4 if the SDU is of type ARP request.
+ *                  4 if the SDU is of type ARP request, or the frame was too
+ *                  short to hold its MIP header and SDU.
+ *                  RECV_AGAIN if there is nothing to read.
  * */
-int mip_link_recv(arp_entry **arp_table, ifs *ifs, mip_pdu *pdu, 
-    char *sdu, uint8_t *arp_addr, int debug);
+int mip_link_recv(arp_table *arp_table, ifs *ifs, mip_pdu *pdu, 
+    char **sdu, uint8_t *arp_addr, int debug);
 
 /**
  * Constructs a MIP PDU header from the given arguments.
@@ -143,5 +193,18 @@ void mip_serialize_sdu(char* dest, mip_sdu *src);
  * */
 void mip_deserialize_sdu(char* src, mip_sdu *dest, size_t src_len);
 
-int mip_send_routing_lookup_request(int socket, uint8_t src, uint8_t dest, int debug);
+/**
+ * Function to ask the routing daemon for the next hop of several destinations
+ * in one request. The response carries the same ID, so any number of requests
+ * can be in flight.
+ * @param out       Where the routing daemon is sent messages.
+ * @param src       MIP address of this host.
+ * @param id        ID of the request.
+ * @param dests     The destinations to look up.
+ * @param count     Number of destinations, at most MAX_LOOKUP_ENTRIES.
+ * @param debug     Set if debug output is enabled.
+ * @return          -1 if error, 0 otherwise.
+ * */
+int mip_send_routing_lookup_request(const struct ctrl_out *out, uint8_t src, uint16_t id,
+    const uint8_t *dests, int count, int debug);
 #endif
\ No newline at end of file
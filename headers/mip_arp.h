@@ -7,61 +7,146 @@
 #define ARP_REQ         0x00
 #define ARP_RES         0x01
 #define LOCAL           {0x00, 0x00, 0x00, 0x00, 0x00, 0x00}
-#define MAX_TABLE_SIZE  16
+#define ARP_RETRY_MS    200         /* first retransmit of a request */
+#define ARP_MAX_RETRIES 3           /* waits of 200, 400, 800 and 1600 ms, then give up */
+
+/* reachability of an entry */
+#define ARP_NONE        0           /* slot not in use */
+#define ARP_PERMANENT   1           /* address of this host, never ages */
+#define ARP_REACHABLE   2           /* confirmed within reachable_ms */
+#define ARP_STALE       3           /* usable, not confirmed for a while */
+#define ARP_PROBE       4           /* usable, being confirmed by unicast probes */
+#define ARP_FAILED      5           /* evicted, the probes were not answered */
+
+/* default lifetimes, stored in the table where they can be changed */
+#define ARP_REACHABLE_MS    30000
+#define ARP_STALE_MS        60000
+#define ARP_PROBE_MS        1000
+#define ARP_MAX_PROBES      3
+
+/**
+ * Creates an empty ARP table for the host with MIP address mip_address.
+ * Resolution and aging run on the timers of the host.
+ * @param mip_address   MIP address of this host.
+ * @param ifs           The interfaces to send requests and probes on.
+ * @param timers        The timer base of the host.
+ * @return              NULL if error, the new table otherwise.
+ * */
+arp_table *arp_table_create(uint8_t mip_address, ifs *ifs, timer_base *timers);
 
 /**
- * Finds the ARP entry with MIP address mip_address, in the table associated with head, 
- * then memcpy this into dest.
+ * Finds the ARP entry of the neighbour with MIP address mip_address.
  *
- * @param entries       Entry point to the linked list of ARP entries
- * @param dest          The destination of where to return the found ARP entry
+ * @param table         The ARP table.
  * @param mip_address   MIP address to look up
- * @return              0 if the entry was found, 1 if not
+ * @return              The entry, NULL if it is not in the table or was
+ *                      evicted. Stale entries are returned, they are probed
+ *                      when used.
 */
-int get_arp_entry_by_mip_address(arp_entry **entries, struct arp_entry *dest, 
-uint8_t mip_address);
+struct arp_entry *get_arp_entry_by_mip_address(arp_table *table, uint8_t mip_address);
+
+/**
+ * Finds the local address entry of an interface of this host.
+ * 
+ * @param table         The ARP table.
+ * @param ifi           Interface index to look up
+ * @return              The entry, NULL if the interface is not in the table.
+ * */
+struct arp_entry *get_arp_entry_by_sll_ifindex(arp_table *table, int ifi);
 
 /**
- * Finds the ARP entry with MIP address mip_address, in the table associated with head, 
- * then memcpy this into dest.
+ * Adds the address of this host on a local interface to the ARP table.
  * 
- * @param entries       Entry point to the linked list of ARP entries
- * @param dest          The destination of where to return the found ARP entry
- * @param mip_address   Interface index to look up
- * @return              0 if the entry was found, 1 if not
+ * @param table         The ARP table.
+ * @param mac_addr      The MAC address of the interface.
+ * @param ifi           The interface index.
+ * @return              The entry that was made, or NULL when error
  * */
-int get_arp_entry_by_sll_ifindex(arp_entry **entries, struct arp_entry *dest, int ifi);
+struct arp_entry *add_local_entry(arp_table *table, uint8_t mac_addr[], int ifi);
 
 /**
- * Adds an ARP entry to the linked list given by head. 
+ * Adds an ARP entry for a neighbour, replacing the one stored for the same
+ * MIP address, and ends its resolution with the resolved callback of the
+ * table. The entry is reachable for
+ * reachable_ms. There is a slot for every MIP address.
  * 
- * @param entries       Entry point to the linked list of ARP entries
+ * @param table         The ARP table.
  * @param mip_address   The MIP address of the entry
  * @param mac_addr      The MAC address of the entry
- * @param interface     The local interface the MIP should be associated with
- *                      Should be set to 0 if the entry is associated with the 
- *                      local MIP address and one of the local network interfaces
- * @param sll_ifindex   The local interface index of how to reach the MIP host.
- *                      Should be set to -1 if the interface is local
- * @return              The entry that was made, or NULL when error
+ * @param interface     MAC address of the local interface the neighbour is
+ *                      reached on
+ * @param ifi           The local interface index of how to reach the MIP host.
+ * @return              The entry that was made, NULL if its timer could not
+ *                      be added.
  * */
-struct arp_entry* add_entry(arp_entry **entries, uint8_t mip_address, 
+struct arp_entry *add_entry(arp_table *table, uint8_t mip_address, 
     uint8_t mac_addr[], uint8_t interface[], int ifi);
 
 /**
- * Removes an ARP entry from the linked list given by head.
+ * Removes the ARP entry of a neighbour.
  * 
- * @param entries   entry to the linked list
- * @param entry     the entry to remove
- * @return          -1 if head is NULL or entry is not in the ll, 0 if success
+ * @param table         The ARP table.
+ * @param mip_address   MIP address of the entry to remove
+ * @return              -1 if the entry is not in the table, 0 if success
+ * */
+int remove_entry(arp_table *table, uint8_t mip_address);
+
+/**
+ * Frees the ARP table from memory.
+ * @param table     The ARP table to free
+ * */
+void free_arp_table(arp_table *table);
+
+/**
+ * Starts resolving the MAC address of a neighbour. Only the first call for an
+ * address sends a request, the rest wait for it to be answered. The request
+ * is sent again after ARP_RETRY_MS, twice as long each time, and after
+ * ARP_MAX_RETRIES retransmits the failure callback of the table is called.
+ * When an entry for the address is added, the resolved callback is called.
+ * @param table         The ARP table.
+ * @param mip_address   The MIP address to resolve.
+ * @return              -1 if error, 1 if a request was sent, 0 if one is
+ *                      already outstanding.
+ * */
+int arp_resolve(arp_table *table, uint8_t mip_address);
+
+/**
+ * Notes that a frame came from a neighbour. If the MAC address and interface
+ * match its entry, the entry is confirmed, and a stale entry is reachable
+ * again.
+ * @param table         The ARP table.
+ * @param mip_address   MIP source address of the frame.
+ * @param mac_addr      MAC source address of the frame.
+ * @param ifi           Index of the interface the frame arrived on.
+ * @return              -1 if error, 1 if an entry was confirmed, 0 otherwise.
+ * */
+int arp_confirm(arp_table *table, uint8_t mip_address, uint8_t mac_addr[], int ifi);
+
+/**
+ * Learns the MAC address of a neighbour from a frame it sent us directly, so
+ * that the first packet to it needs no ARP request. A matching entry is
+ * confirmed, and a missing or stale one is made or replaced, which ends an
+ * outstanding resolution. A reachable entry with another MAC address is
+ * kept until it goes stale.
+ * @param table         The ARP table.
+ * @param mip_address   MIP source address of the frame.
+ * @param mac_addr      MAC source address of the frame.
+ * @param interface     MAC address of the interface the frame arrived on.
+ * @param ifi           Index of the interface the frame arrived on.
+ * @return              -1 if error, 1 if an entry was made or replaced, 0
+ *                      otherwise.
  * */
-int remove_entry(arp_entry **entries, arp_entry *entry);
+int arp_learn(arp_table *table, uint8_t mip_address, uint8_t mac_addr[], 
+    uint8_t interface[], int ifi);
 
 /**
- * Frees the ARP table from memory given by head.
- * @param entries   The entry to the ARP table to free
+ * Notes that a frame is sent using an entry. A stale entry starts being
+ * probed, so that it is confirmed or evicted instead of used for stale_ms.
+ * @param table         The ARP table.
+ * @param e             The entry.
+ * @return              -1 if error, 0 otherwise.
  * */
-void free_arp_table(arp_entry **entries);
+int arp_use(arp_table *table, struct arp_entry *e);
 
 /**
  * Sends an ARP request for the MIP address req_addr. The receiving of the 
@@ -76,13 +161,13 @@ int send_arp_request(ifs *ifs, uint8_t req_addr, uint8_t src);
 /**
  * Sends an ARP response.
  * @param ifs           The local interfaces of this host.
- * @param head          The entry to the ARP table of this host.
+ * @param table         The ARP table of this host.
  * @param mip_arp_sdu       The ARP SDU packet to send.
  * @param frame_header  The frame header for the link layer.
  * @param dest_mip_addr The MIP address of the destination address.
  * @return              -1 if error, 0 otherwise.
  * */
-int send_arp_response(ifs *ifs, arp_entry **entries, 
+int send_arp_response(ifs *ifs, arp_table *table, 
     mip_arp_sdu mip_arp_sdu, frame_header frame_header, uint8_t dest_mip_addr);
 #endif
 
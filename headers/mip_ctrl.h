@@ -0,0 +1,124 @@
+#ifndef MIP_CTRL_H
+#define MIP_CTRL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Every message between the MIP daemon and the routing daemon, and every
+ * routing packet between hosts, starts with the same fixed header:
+ *
+ *   0   addr        host the message is for or from, read by the MIP daemon
+ *   1   ttl
+ *   2   version     CTRL_VERSION
+ *   3   opcode
+ *   4   length      of the whole message, header included, big endian
+ *   6   sequence    big endian, what it counts depends on the opcode
+ *
+ * The body follows at CTRL_HDR_SIZE. Its size is always taken from the
+ * length, never from a count in the body.
+ */
+
+#define CTRL_VERSION            0x01
+#define CTRL_HDR_SIZE           0x08
+
+#define CTRL_HELLO              0x01        /* broadcast, says which host is adjacent */
+#define CTRL_UPDATE             0x02        /* distance vectors, sequence numbers the deltas */
+#define CTRL_REQUEST            0x03        /* route lookup, sequence is the request ID */
+#define CTRL_RESPONSE           0x04        /* lookup answer, sequence is the request ID */
+#define CTRL_FIB                0x05        /* forwarding table delta */
+#define CTRL_LSA                0x06        /* link-state advert, sequence is the advert's */
+#define CTRL_PROBE              0x07        /* fast liveness probe */
+#define CTRL_OPCODES            0x10        /* size of the dispatch tables, room for more */
+
+/**
+ * A message whose header has been checked.
+ * @param addr      The address byte of the header.
+ * @param opcode    Its opcode, below CTRL_OPCODES.
+ * @param len       Length of the whole message.
+ * @param seq       Its sequence number.
+ * @param body      The bytes after the header.
+ * @param body_len  Number of bytes in body.
+ * */
+struct ctrl_msg {
+    uint8_t                 addr;
+    uint8_t                 opcode;
+    uint16_t                len;
+    uint16_t                seq;
+    const uint8_t           *body;
+    size_t                  body_len;
+};
+
+/**
+ * Handles one opcode of the control protocol.
+ * @param ctx       The state of the process, as given to ctrl_dispatch().
+ * @param msg       The message.
+ * @return          -1 if error, 0 otherwise.
+ * */
+typedef int (*ctrl_handler)(void *ctx, const struct ctrl_msg *msg);
+
+/**
+ * Where a process sends its control messages: to the socket of the process
+ * on the other end, or straight to its handlers when both run in one.
+ * @param fd        The socket to write to, used if handlers is NULL.
+ * @param handlers  The handlers of the other end, CTRL_OPCODES of them.
+ * @param ctx       Passed to the handlers.
+ * */
+struct ctrl_out {
+    int                     fd;
+    const ctrl_handler      *handlers;
+    void                    *ctx;
+};
+
+/**
+ * Writes the header of a message.
+ * @param buf       The message, at least CTRL_HDR_SIZE bytes.
+ * @param addr      The host the message is for or from.
+ * @param opcode    The opcode.
+ * @param len       Length of the whole message.
+ * @param seq       The sequence number.
+ * */
+void ctrl_header(char *buf, uint8_t addr, uint8_t opcode, uint16_t len, uint16_t seq);
+
+/**
+ * Checks the header of a message and points out its body. A message is
+ * rejected if it is shorter than its header says, longer, of another
+ * version, of an unknown opcode, or too short or oddly sized for its opcode,
+ * so a truncated read never reaches a handler.
+ * @param buf       The message as read.
+ * @param n         Number of bytes read.
+ * @param msg       Where to store the message.
+ * @return          0 if the message is well formed, -1 otherwise.
+ * */
+int ctrl_parse(const char *buf, size_t n, struct ctrl_msg *msg);
+
+/**
+ * Calls the handler of the opcode of a message. An opcode without one is
+ * ignored, as the MIP daemon does with the messages only the routing daemon
+ * handles.
+ * @param table     The handlers, CTRL_OPCODES of them, indexed by opcode.
+ * @param ctx       Passed to the handler.
+ * @param msg       The message, checked by ctrl_parse().
+ * @return          -1 if the handler failed, 0 otherwise.
+ * */
+int ctrl_dispatch(const ctrl_handler *table, void *ctx, const struct ctrl_msg *msg);
+
+/**
+ * Sends a message. Handed to the handlers of the other end, it is checked
+ * and handled before this returns, and the handler may send messages back.
+ * A malformed message is dropped, as the other end would drop it.
+ * @param out       Where to send it.
+ * @param buf       The message, header included.
+ * @param len       Length of the message.
+ * @return          -1 if the write or the handler failed, 0 otherwise.
+ * */
+int ctrl_send(const struct ctrl_out *out, const char *buf, size_t len);
+
+/**
+ * Names an opcode, for debug output.
+ * @param opcode    The opcode.
+ * @return          The name, "UNKNOWN" if there is no such opcode.
+ * */
+const char *ctrl_name(uint8_t opcode);
+
+#endif
@@ -1,11 +1,77 @@
-#ifndef MIP_DAEMON_H
-#define MIP_DAEMON_H
-
-#include "structs.h"
-#include "queue.h"
-#include <stdint.h>
-
-queue_entry* get_entry_by_mip_addr(struct queue *q, uint8_t addr);
-void free_pkt_buffer(queue *pkt_buf);
-
-#endif
\ No newline at end of file
+#ifndef MIP_DAEMON_H
+#define MIP_DAEMON_H
+
+#include "structs.h"
+#include "mip.h"
+#include "mip_routing.h"
+#include "mip_fib.h"
+#include "mip_shm.h"
+#include "mip_pool.h"
+#include "mip_pending.h"
+#include "mip_event.h"
+#include "mip_timer.h"
+#include <stdint.h>
+
+#define STATS_INTERVAL_MS       10000       /* counters are printed this often with -d */
+
+/**
+ * State of the MIP daemon, shared by the event handlers.
+ * @param upper_fd      Listening unix socket for the upper layer.
+ * @param lower_fd      Raw socket for the link layer, -1 on a virtual wire.
+ * @param app_fd        Connected application, -1 if none.
+ * @param routing       Where messages to the routing daemon go: the socket it
+ *                      connected on, -1 if none, or the handlers of r.
+ * @param r             The routing daemon when it runs inside this one, on
+ *                      its loop and timers. NULL if it runs as a process.
+ * @param debug         Set if debug output is enabled.
+ * @param mip_address   MIP address of this host.
+ * @param buf           Scratch buffer for a single message.
+ * @param ifs           The network interfaces of this host.
+ * @param arp_table     The ARP cache of this host.
+ * @param pool          Packet buffers for every packet the daemon holds on to.
+ * @param pending       Packets waiting on a route or on ARP.
+ * @param fib           Forwarding table pushed by the routing daemon.
+ * @param routes        Route table the routing daemon exports in shared
+ *                      memory, read instead of fib. NULL if it exports none.
+ * @param lookup_seq    ID of the last lookup request sent to the routing
+ *                      daemon. IDs skip 0.
+ * @param lookup_count  Number of destinations in lookup_batch.
+ * @param lookup_batch  Destinations that missed the forwarding table since the
+ *                      last wakeup, looked up in a single request.
+ * @param lookup_id     ID of the request in flight per destination, 0 if
+ *                      none, so a stale response is told apart.
+ * @param timers        Timers of the daemon, on a single timerfd in the loop.
+ * @param stats_timer   Prints the counters of the daemon in debug mode.
+ * @param loop          The event loop.
+ * */
+typedef struct mip_daemon {
+    int                         upper_fd;
+    int                         lower_fd;
+    int                         app_fd;
+    struct ctrl_out             routing;
+    struct routing_daemon       *r;
+    int                         debug;
+    uint8_t                     mip_address;
+    char                        buf[MAX_MSG_SIZE];
+    struct network_interfaces   *ifs;
+    struct arp_table            *arp_table;
+    struct pkt_pool             *pool;
+    struct pending_table        *pending;
+    struct mip_fib              fib;
+    struct route_shm            *routes;
+    uint16_t                    lookup_seq;
+    int                         lookup_count;
+    uint8_t                     lookup_batch[MAX_LOOKUP_ENTRIES];
+    uint16_t                    lookup_id[FIB_MAX_ENTRIES];
+    struct timer_base           timers;
+    struct mip_timer            stats_timer;
+    struct event_loop           loop;
+} mip_daemon;
+
+/**
+ * Closes every socket of the daemon and frees it from memory.
+ * @param d         The daemon to free.
+ * */
+void free_mip_daemon(mip_daemon *d);
+
+#endif
@@ -3,10 +3,13 @@
 
 #include "structs.h"
 #include "mip_routing.h"
+#include "mip_pending.h"
 
 /**
- * Prints the given SDU in a nicely formatted way.
+ * Prints the given ping SDU in a nicely formatted way. Routing messages are
+ * printed with mip_print_ctrl_msg().
  * @param sdu       The SDU to print.
+ * @param type      The SDU type, only MIP_PING is printed.
  * */
 void mip_print_sdu(mip_sdu *sdu, int type);
 
@@ -25,13 +28,13 @@ void mip_print_frame(frame_header *frame);
 /**
  * Prints debug information that prints information for each communication 
  * instance.
- * @param head      An entry to the ARP table.
+ * @param arp_table The ARP table.
  * @param src_mac   Source MAC address.
  * @param dst_mac   Destination MAC address.
  * @param src_mip   Source MIP address.
  * @param dst_mip   Destination MIP address.
  * */
-void mip_debug(arp_entry **arp_table, 
+void mip_debug(arp_table *arp_table, 
     uint8_t *src_mac, uint8_t *dst_mac, 
     uint8_t src_mip, uint8_t dst_mip);
 
@@ -49,10 +52,10 @@ void print_mac_address(uint8_t addr[], size_t len);
 void print_sockaddr_ll(struct sockaddr_ll *sockaddr);
 
 /**
- * Prints the ARP table associated with head
- * @param head      the entry to the ARP table
+ * Prints the local and neighbour entries of the ARP table
+ * @param table     the ARP table
  * */
-void mip_print_arp_content(arp_entry **entries);
+void mip_print_arp_content(arp_table *table);
 
 /**
  * Prints a single ARP entry
@@ -66,8 +69,23 @@ void mip_print_arp_entry(arp_entry *entry);
  * */
 void mip_print_arp_packet(mip_arp_sdu sdu);
 
-void mip_print_routing_sdu(struct mip_sdu *sdu);
-void mip_print_routing_table(struct queue *routing_table);
-void mip_print_packet_queue(struct queue *q);
+/**
+ * Prints a message of the routing control protocol, field by field.
+ * @param msg       The message, checked by ctrl_parse().
+ * */
+void mip_print_ctrl_msg(const struct ctrl_msg *msg);
+void mip_print_routing_table(routing_table *routing_table);
+
+/**
+ * Prints the depth and drop counters of every slot in use in the pending table.
+ * @param pt        The pending table to print.
+ * */
+void mip_print_pending_table(struct pending_table *pt);
+
+/**
+ * Prints the ping SDU held in a packet buffer.
+ * @param buf       The packet buffer.
+ * */
+void mip_print_pkt_buf(struct pkt_buf *buf);
 
 #endif
\ No newline at end of file
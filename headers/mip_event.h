@@ -0,0 +1,117 @@
+#ifndef MIP_EVENT_H
+#define MIP_EVENT_H
+
+#include "common.h"
+
+#include <stddef.h>
+#include <sys/epoll.h>
+
+#define EVENT_MAX_HANDLERS      16
+#define EVENT_BUDGET            32          /* messages per fd per wakeup */
+
+#define EVENT_LEVEL             0
+#define EVENT_EDGE              1
+
+/**
+ * Function called when a file descriptor is readable. Is called repeatedly,
+ * up to the budget of the loop, until it reports that the fd is drained.
+ * @param fd        The readable file descriptor.
+ * @param arg       The argument given when the handler was added.
+ * @return          -1 if error, 0 if the fd is drained (EAGAIN or nothing
+ *                  more to do), 1 if a message was handled and more may follow.
+ * */
+typedef int (*event_handler_fn)(int fd, void *arg);
+
+/**
+ * Structure for a file descriptor registered in the event loop.
+ * @param fd        The file descriptor.
+ * @param edge      Set if the fd is edge-triggered and must be drained.
+ * @param backlog   Set if the budget ran out before the fd was drained.
+ * @param handle    Function to call when the fd is readable.
+ * @param arg       Argument to pass to handle.
+ * */
+struct event_handler {
+    int                 fd;
+    int                 edge;
+    int                 backlog;
+    event_handler_fn    handle;
+    void                *arg;
+};
+
+/**
+ * Counters for the event loop. Used to measure syscalls per message.
+ * @param waits     Number of epoll_wait() calls.
+ * @param events    Number of ready events returned by epoll_wait().
+ * @param calls     Number of handler calls, including the final one that
+ *                  found the fd drained. A handler that reads in batches may
+ *                  tell without a read.
+ * @param handled   Number of handler calls that handled a message.
+ * @param backlogs  Number of times a fd ran out of budget.
+ * */
+struct event_stats {
+    size_t  waits;
+    size_t  events;
+    size_t  calls;
+    size_t  handled;
+    size_t  backlogs;
+};
+
+/**
+ * Structure for the event dispatch layer shared by the daemons.
+ * @param epoll_fd  The epoll instance.
+ * @param budget    Max handler calls per fd per wakeup.
+ * @param handlers  The registered handlers. A slot is free if fd is -1.
+ * @param stats     Counters for the loop.
+ * */
+typedef struct event_loop {
+    int                     epoll_fd;
+    int                     budget;
+    struct event_handler    handlers[EVENT_MAX_HANDLERS];
+    struct event_stats      stats;
+} event_loop;
+
+/**
+ * Creates the epoll instance of the loop.
+ * @param loop      The loop to initialize.
+ * @param budget    Max handler calls per fd per wakeup.
+ * @return          -1 if error, 0 otherwise.
+ * */
+int event_loop_init(event_loop *loop, int budget);
+
+/**
+ * Registers a file descriptor in the loop.
+ * @param loop      The event loop.
+ * @param fd        The file descriptor to add.
+ * @param edge      EVENT_EDGE if the handler always drains the fd, so it can
+ *                  be edge-triggered. EVENT_LEVEL otherwise.
+ * @param handle    Function to call when the fd is readable.
+ * @param arg       Argument to pass to handle.
+ * @return          -1 if error, 0 otherwise.
+ * */
+int event_add(event_loop *loop, int fd, int edge, event_handler_fn handle, void *arg);
+
+/**
+ * Removes a file descriptor from the loop. Does not close it.
+ * @param loop      The event loop.
+ * @param fd        The file descriptor to remove.
+ * @return          -1 if error, 0 otherwise.
+ * */
+int event_remove(event_loop *loop, int fd);
+
+/**
+ * Waits for events and dispatches every ready fd, round robin, until each fd
+ * is drained or has used up its budget. A fd with budget left over is
+ * revisited on the next call without blocking.
+ * @param loop      The event loop.
+ * @param timeout   Timeout for epoll_wait() in milliseconds, -1 to block.
+ * @return          -1 if error, number of handled messages otherwise.
+ * */
+int event_loop_run_once(event_loop *loop, int timeout);
+
+/**
+ * Closes the epoll instance of the loop.
+ * @param loop      The event loop.
+ * */
+void event_loop_close(event_loop *loop);
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef MIP_FIB_H
+#define MIP_FIB_H
+
+#include "mip_rtable.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FIB_MAX_ENTRIES         0x0100      /* one slot per MIP address */
+#define FIB_MAX_PATHS           RTABLE_MAX_PATHS    /* equal-cost next hops per entry */
+
+/**
+ * Structure for representing a forwarding table entry in the MIP daemon.
+ * @param next_hop      Next nodes of the equal-cost paths, in ascending order.
+ * @param paths         Number of next nodes.
+ * @param hops          Number of hops in path.
+ * @param valid         Set if the routing daemon has pushed a route for this slot.
+ * */
+struct mip_fib_entry {
+    uint8_t     next_hop[FIB_MAX_PATHS];
+    uint8_t     paths;
+    uint8_t     hops;
+    uint8_t     valid;
+};
+
+/**
+ * Forwarding table pushed from the routing daemon. Indexed directly by
+ * destination MIP address, so a lookup is a single array access.
+ * @param entries       One entry for each MIP address.
+ * @param size          Number of valid entries.
+ * */
+typedef struct mip_fib {
+    struct mip_fib_entry    entries[FIB_MAX_ENTRIES];
+    size_t                  size;
+} mip_fib;
+
+/**
+ * Invalidates every entry of the given forwarding table.
+ * @param fib       The forwarding table to initialize.
+ * */
+void mip_fib_init(mip_fib *fib);
+
+/**
+ * Hashes the fields that tell the flows through a host apart, so every packet
+ * of a flow takes the same path and keeps its order. The MIP address of the
+ * host is mixed in, so the hosts along a path do not all pick the same
+ * neighbour for the same flows.
+ * @param src       MIP address the packet came from.
+ * @param dest      MIP address the packet is for.
+ * @param sdu_type  SDU type of the packet.
+ * @param self      MIP address of this host.
+ * @return          The hash.
+ * */
+uint32_t mip_flow_hash(uint8_t src, uint8_t dest, uint8_t sdu_type, uint8_t self);
+
+/**
+ * Looks up the next hop towards dest. Of equal-cost next hops, the flow hash
+ * picks one.
+ * @param fib       The forwarding table of this host.
+ * @param dest      The destination MIP address.
+ * @param hash      Flow hash of the packet, from mip_flow_hash().
+ * @param next_hop  Where to store the next hop address.
+ * @return          0 if a route was found, 1 if not.
+ * */
+int mip_fib_lookup(mip_fib *fib, uint8_t dest, uint32_t hash, uint8_t *next_hop);
+
+/**
+ * Installs or withdraws a single route. A route with INFINITY hops or no
+ * next hops is a withdrawal.
+ * @param fib       The forwarding table of this host.
+ * @param dest      The destination MIP address.
+ * @param next_hops The equal-cost next hop addresses.
+ * @param count     Number of next hops. Only the first FIB_MAX_PATHS are kept.
+ * @param hops      Hop count.
+ * @return          1 if the entry changed, 0 otherwise.
+ * */
+int mip_fib_update(mip_fib *fib, uint8_t dest, const uint8_t *next_hops, int count,
+    uint8_t hops);
+
+/**
+ * Applies the entries of a FIB delta message written by the routing daemon.
+ * A malformed delta is dropped whole, none of its entries are applied.
+ * @param fib       The forwarding table of this host.
+ * @param entries   The entries, each the destination, its hop count, the
+ *                  number of next hops and the next hops.
+ * @param len       Number of bytes in entries.
+ * @return          Number of entries that changed, -1 if the message is malformed.
+ * */
+int mip_fib_apply_delta(mip_fib *fib, const uint8_t *entries, size_t len);
+
+#endif
@@ -0,0 +1,229 @@
+#ifndef MIP_LINK_H
+#define MIP_LINK_H
+
+#include "structs.h"
+#include "mip.h"
+
+#include <stddef.h>
+#include <sys/socket.h>
+
+#define LINK_BATCH              32          /* frames per recvmmsg()/sendmmsg() */
+#define LINK_RX_RING            0x01        /* receive from a TPACKET_V3 ring */
+#define LINK_TX_RING            0x02        /* send through a PACKET_TX_RING */
+#define LINK_QDISC_BYPASS       0x04        /* send without the qdisc layer */
+
+#define LINK_RING_BLOCK_SIZE    (1 << 16)
+#define LINK_RING_BLOCKS        16
+#define LINK_RING_FRAME_SIZE    (1 << 11)
+#define LINK_RING_RETIRE_MS     4           /* hand a partial block over after */
+
+#define LINK_TX_BLOCK_SIZE      (1 << 16)
+#define LINK_TX_BLOCKS          8
+#define LINK_TX_FRAME_SIZE      (1 << 11)
+#define LINK_TX_FRAMES          (LINK_TX_BLOCK_SIZE / LINK_TX_FRAME_SIZE * LINK_TX_BLOCKS)
+
+#define LINK_HEADER_SIZE        (sizeof(struct frame_header) + sizeof(struct mip_pdu))
+
+/**
+ * A MIP frame laid out as on the wire, so a whole frame is read or written
+ * with a single iovec.
+ * @param hdr       The ethernet header.
+ * @param pdu       The MIP header.
+ * @param sdu       The MIP payload.
+ * */
+typedef struct link_frame {
+    struct frame_header     hdr;
+    struct mip_pdu          pdu;
+    char                    sdu[MAX_MSG_SIZE];
+} __attribute__((packed)) link_frame;
+
+/**
+ * Counters for the link layer batches.
+ * @param rx_batches    Number of recvmmsg() calls that returned frames, or
+ *                      number of ring blocks read.
+ * @param rx_frames     Number of received frames.
+ * @param tx_batches    Number of sendmmsg() calls, or number of transmit
+ *                      ring kicks.
+ * @param tx_frames     Number of sent frames.
+ * @param tx_in_place   Number of received frames sent from where they were
+ *                      received, without being copied.
+ * @param tx_dropped    Number of queued frames dropped because sending failed.
+ * @param tx_lost       Number of frames lost on purpose by a backend that
+ *                      emulates a lossy link.
+ * */
+struct link_stats {
+    size_t  rx_batches;
+    size_t  rx_frames;
+    size_t  tx_batches;
+    size_t  tx_frames;
+    size_t  tx_in_place;
+    size_t  tx_dropped;
+    size_t  tx_lost;
+};
+
+typedef struct mip_link mip_link;
+
+/**
+ * Operations of a link backend. The raw socket backend is set up with
+ * link_create(), other backends call link_new() with their own operations.
+ * @param name      Name of the backend, for debug output.
+ * @param discover  Fills in the interfaces of the host.
+ * @param next      Hands out the next received frame, see link_next_frame().
+ * @param reserve   Reserves the next outgoing frame, see link_reserve_frame().
+ * @param commit    Queues the reserved frame, see link_commit_frame().
+ * @param forward   Queues a received frame without copying it, see
+ *                  link_forward_frame(). NULL if the backend copies it.
+ * @param flush     Sends queued frames, see link_flush().
+ * @param close     Frees the state of the backend.
+ * */
+struct link_ops {
+    const char              *name;
+    int                     (*discover)(mip_link *link, struct network_interfaces *ifs);
+    int                     (*next)(mip_link *link, struct link_frame **frame, struct sockaddr_ll **addr);
+    struct link_frame       *(*reserve)(mip_link *link, const struct sockaddr_ll *to);
+    void                    (*commit)(mip_link *link, size_t sdu_len);
+    int                     (*forward)(mip_link *link, const struct sockaddr_ll *to,
+                                struct link_frame *frame, size_t sdu_len);
+    int                     (*flush)(mip_link *link);
+    void                    (*close)(mip_link *link);
+};
+
+/**
+ * Batched link layer. Frames are received LINK_BATCH at a time, and outgoing
+ * frames are queued until link_flush() is called.
+ * @param ops       Operations of the backend.
+ * @param state     State of the backend.
+ * @param fd        Readable when frames arrive.
+ * @param timer_fd  Timer of the backend, readable when queued frames are due
+ *                  to be sent. -1 if the backend has none.
+ * @param stats     Counters for the link.
+ * */
+struct mip_link {
+    const struct link_ops   *ops;
+    void                    *state;
+    int                     fd;
+    int                     timer_fd;
+    struct link_stats       stats;
+};
+
+/**
+ * Allocates a link on the given backend.
+ * @param ops       Operations of the backend.
+ * @param state     State of the backend, freed by ops->close.
+ * @param fd        Readable when frames arrive.
+ * @param timer_fd  Timer of the backend, -1 if none.
+ * @return          NULL if error, the new link otherwise.
+ * */
+mip_link *link_new(const struct link_ops *ops, void *state, int fd, int timer_fd);
+
+/**
+ * Allocates a batched link on the given raw socket. With LINK_RX_RING, a
+ * TPACKET_V3 block ring is mapped on the socket and frames are read from it
+ * in place instead of with recvmmsg(). With LINK_TX_RING, frames are written
+ * into the slots of a transmit ring on a second socket, and sent with one
+ * send() per batch instead of with sendmmsg(). LINK_QDISC_BYPASS applies to
+ * whichever socket sends.
+ * @param raw_socket    The AF_PACKET socket.
+ * @param flags         0, or any of LINK_RX_RING, LINK_TX_RING and
+ *                      LINK_QDISC_BYPASS.
+ * @return              NULL if error, the new link otherwise.
+ * */
+mip_link *link_create(int raw_socket, int flags);
+
+/**
+ * Fills in the interfaces of the host the link sends and receives on.
+ * @param link      The link.
+ * @param ifs       A structure for storing interfaces.
+ * @return          -1 if error, 0 otherwise.
+ * */
+int link_discover(mip_link *link, struct network_interfaces *ifs);
+
+/**
+ * Hands out the next received frame. A new batch is read with recvmmsg(), or
+ * the next ring block is taken, when the previous one is used up. The frame is
+ * valid until the next call, and is only written to by a caller that hands
+ * it to link_forward_frame().
+ * @param link      The link.
+ * @param frame     Where to store a pointer to the frame.
+ * @param addr      Where to store a pointer to the address the frame came from.
+ * @return          -1 if error, RECV_AGAIN if there is nothing to read,
+ *                  length of the frame otherwise.
+ * */
+int link_next_frame(mip_link *link, struct link_frame **frame, struct sockaddr_ll **addr);
+
+/**
+ * Reserves the next outgoing frame, so it can be written in place. The
+ * ethertype is already set if the frame is a transmit ring slot. Must be
+ * followed by link_commit_frame() before the next call.
+ * @param link      The link.
+ * @param to        The interface and MAC address to send to.
+ * @return          NULL if error, the frame to write otherwise.
+ * */
+struct link_frame *link_reserve_frame(mip_link *link, const struct sockaddr_ll *to);
+
+/**
+ * Queues the frame returned by link_reserve_frame() for sending.
+ * @param link      The link.
+ * @param sdu_len   Length of the payload written to the frame.
+ * */
+void link_commit_frame(mip_link *link, size_t sdu_len);
+
+/**
+ * Copies a frame into the transmit batch. The batch is flushed first if it
+ * is full.
+ * @param link      The link.
+ * @param to        The interface and MAC address to send to.
+ * @param hdr       The ethernet header.
+ * @param pdu       The MIP header.
+ * @param sdu       The MIP payload.
+ * @param sdu_len   Length of the payload.
+ * @return          -1 if error, 0 otherwise.
+ * */
+int link_queue_frame(mip_link *link, const struct sockaddr_ll *to,
+    const struct frame_header *hdr, const struct mip_pdu *pdu,
+    const void *sdu, size_t sdu_len);
+
+/**
+ * Queues the frame last handed out by link_next_frame() for sending, once its
+ * headers have been rewritten in place. A backend that can sends it from the
+ * receive batch or ring, and sends it before that is read over, others copy
+ * it as link_queue_frame() does.
+ * @param link      The link.
+ * @param to        The interface and MAC address to send to.
+ * @param frame     The received frame.
+ * @param sdu_len   Length of the payload.
+ * @return          -1 if error, 0 otherwise.
+ * */
+int link_forward_frame(mip_link *link, const struct sockaddr_ll *to,
+    struct link_frame *frame, size_t sdu_len);
+
+/**
+ * Sends every queued frame with as few sendmmsg() or send() calls as possible.
+ * A backend that shapes traffic only sends the frames that are due.
+ * @param link      The link.
+ * @return          -1 if error, number of sent frames otherwise.
+ * */
+int link_flush(mip_link *link);
+
+/**
+ * Reads the timer of the link and sends every queued frame that is due.
+ * @param link      The link.
+ * @return          -1 if error, number of sent frames otherwise.
+ * */
+int link_timer(mip_link *link);
+
+/**
+ * Gets the counters of the link.
+ * @param link      The link.
+ * @return          The counters.
+ * */
+const struct link_stats *link_get_stats(mip_link *link);
+
+/**
+ * Frees the link from memory. Queued frames are not sent, and the raw socket
+ * given to link_create() is not closed.
+ * @param link      The link to free.
+ * */
+void free_link(mip_link *link);
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef MIP_LSDB_H
+#define MIP_LSDB_H
+
+#include "mip_rtable.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LSDB_MAX_LINKS          RTABLE_MAX_NEIGHBOURS   /* links per advert */
+#define LSDB_SET_WORDS          (RTABLE_SLOTS / 64)     /* words in a set of hosts */
+
+#define LSDB_OLDER              -1          /* the advert is older than ours */
+#define LSDB_SAME               0           /* we have the advert already */
+#define LSDB_NEWER              1           /* the advert replaced ours */
+
+/**
+ * The last link-state advert of a host: the neighbours it says HELLO with.
+ * @param seq       Sequence number the host gave it, newer adverts have
+ *                  larger ones.
+ * @param present   Set once an advert of the host was heard.
+ * @param count     Number of links.
+ * @param links     MIP address of each neighbour.
+ * */
+struct lsa {
+    uint16_t                seq;
+    uint8_t                 present;
+    uint8_t                 count;
+    uint8_t                 links[LSDB_MAX_LINKS];
+};
+
+/**
+ * Link-state database and the shortest path tree computed from it. A link
+ * is only used if both ends advertise it. Every link costs a hop, and the
+ * tree is kept with Dijkstra on a binary heap: a link that comes up only
+ * relaxes the paths it shortens, and a link that goes down only makes the
+ * tree be computed again if a shortest path used it. Every first hop of an
+ * equal-cost shortest path is kept.
+ * @param mip_address   MIP address of this host, the root of the tree.
+ * @param lsa           The last advert per MIP address, ours included.
+ * @param dist          Hops from this host per MIP address, INFINITY if
+ *                      unreachable.
+ * @param first_hops    Bitmap of the first hops of every shortest path.
+ * @param full_runs     Number of times the whole tree was computed.
+ * @param incremental   Number of times the tree was only relaxed.
+ * */
+typedef struct lsdb {
+    uint8_t                 mip_address;
+    struct lsa              lsa[RTABLE_SLOTS];
+    uint8_t                 dist[RTABLE_SLOTS];
+    uint64_t                first_hops[RTABLE_SLOTS][LSDB_SET_WORDS];
+    size_t                  full_runs;
+    size_t                  incremental;
+} lsdb;
+
+/**
+ * Sets up a database that only holds our own, empty, advert.
+ * @param db            The database.
+ * @param mip_address   MIP address of this host.
+ * */
+void lsdb_init(lsdb *db, uint8_t mip_address);
+
+/**
+ * Adds a neighbour to our own advert, and gives it the next sequence number.
+ * @param db            The database.
+ * @param neighbour     The neighbour that came up.
+ * @return              1 if the advert changed, 0 if the link was in it or
+ *                      the advert is full.
+ * */
+int lsdb_link_up(lsdb *db, uint8_t neighbour);
+
+/**
+ * Removes a neighbour from our own advert, and gives it the next sequence
+ * number.
+ * @param db            The database.
+ * @param neighbour     The neighbour that went down.
+ * @return              1 if the advert changed, 0 if the link was not in it.
+ * */
+int lsdb_link_down(lsdb *db, uint8_t neighbour);
+
+/**
+ * Gives our own advert the next sequence number, so it replaces the copy
+ * every host has again, one that missed a flood included.
+ * @param db            The database.
+ * */
+void lsdb_refresh(lsdb *db);
+
+/**
+ * Checks if a neighbour is in our own advert.
+ * @param db            The database.
+ * @param neighbour     The neighbour.
+ * @return              1 if it is, 0 otherwise.
+ * */
+int lsdb_adjacent(const lsdb *db, uint8_t neighbour);
+
+/**
+ * Merges a received advert. Our own advert coming back with a sequence
+ * number at least as large as ours, left behind from before a restart, makes
+ * ours jump past it.
+ * @param db            The database.
+ * @param origin        The host the advert is of.
+ * @param seq           Its sequence number.
+ * @param links         Its links.
+ * @param count         Number of links.
+ * @return              LSDB_NEWER if it replaced the one we had, LSDB_SAME if
+ *                      we had it, LSDB_OLDER if ours is newer and should be
+ *                      sent back.
+ * */
+int lsdb_merge(lsdb *db, uint8_t origin, uint16_t seq, const uint8_t *links, int count);
+
+/**
+ * Installs the shortest paths in the route cache of a routing table, the
+ * lowest addressed first hop as best route, marking the destinations that
+ * changed as dirty.
+ * @param db            The database.
+ * @param rt            The routing table.
+ * @return              Number of destinations whose route changed.
+ * */
+int lsdb_install(const lsdb *db, routing_table *rt);
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef MIP_PENDING_H
+#define MIP_PENDING_H
+
+#include "structs.h"
+#include "mip_pool.h"
+#include "mip_timer.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>        /* ssize_t */
+
+#define PENDING_SLOTS           0x0100      /* one slot per MIP address */
+#define PENDING_MAX_DEPTH       16          /* packets buffered per slot */
+#define PENDING_ROUTE_MS        5000        /* wait for a route lookup before dropping */
+
+/**
+ * FIFO of packet buffers waiting on the same address. Buffers are linked
+ * through their next field, so queueing a packet does not allocate.
+ * @param head      First packet in.
+ * @param tail      Last packet in.
+ * @param depth     Number of packets in the list.
+ * @param timer     Drops the packets of a route slot whose lookup was never
+ *                  answered. Not used for ARP slots, ARP gives up by itself.
+ * */
+struct pending_list {
+    struct pkt_buf          *head;
+    struct pkt_buf          *tail;
+    size_t                  depth;
+    struct mip_timer        timer;
+};
+
+/**
+ * Packets waiting in the daemon, indexed by MIP address.
+ * @param pool          The pool the buffers are given back to.
+ * @param timers        The timer base the route slots expire on.
+ * @param route         Packets waiting on a route, by final destination.
+ * @param arp           Packets waiting on ARP, by next hop.
+ * @param drops         Dropped packets, by final destination.
+ * @param queued        Packets currently buffered.
+ * @param dropped_full  Packets dropped because their slot was full.
+ * @param dropped_route Packets dropped because no route was found.
+ * @param dropped_arp   Packets dropped because ARP gave up on their next hop.
+ * @param expired       Packets dropped because their route lookup was not
+ *                      answered in PENDING_ROUTE_MS.
+ * */
+typedef struct pending_table {
+    struct pkt_pool         *pool;
+    struct timer_base       *timers;
+    struct pending_list     route[PENDING_SLOTS];
+    struct pending_list     arp[PENDING_SLOTS];
+    size_t                  drops[PENDING_SLOTS];
+    size_t                  queued;
+    size_t                  dropped_full;
+    size_t                  dropped_route;
+    size_t                  dropped_arp;
+    size_t                  expired;
+} pending_table;
+
+/**
+ * Allocates an empty pending table.
+ * @param pool          The pool that dropped buffers are given back to.
+ * @param timers        The timer base the route slots expire on.
+ * @return              NULL if error, the new table otherwise.
+ * */
+pending_table *pending_create(struct pkt_pool *pool, timer_base *timers);
+
+/**
+ * Buffers a packet until a route to its final destination (byte 0 of the
+ * SDU) is known. The slot is emptied if no route is known PENDING_ROUTE_MS
+ * after its first packet, so that the next packet asks again.
+ * @param pt            The pending table of this host.
+ * @param e             The packet to buffer.
+ * @return              The depth of the slot after the push,
+ *                      0 if the slot was full and the packet was dropped,
+ *                      -1 if error.
+ * */
+ssize_t pending_push_route(pending_table *pt, struct pkt_buf *e);
+
+/**
+ * Buffers a packet until the MAC address of its next hop (pdu.dest) is known.
+ * @param pt            The pending table of this host.
+ * @param e             The packet to buffer.
+ * @return              The depth of the slot after the push,
+ *                      0 if the slot was full and the packet was dropped.
+ * */
+size_t pending_push_arp(pending_table *pt, struct pkt_buf *e);
+
+/**
+ * Detaches every packet waiting on a route to dest.
+ * @param pt            The pending table of this host.
+ * @param dest          The destination MIP address.
+ * @return              The packets in arrival order, NULL if there are none.
+ * */
+struct pkt_buf *pending_take_route(pending_table *pt, uint8_t dest);
+
+/**
+ * Detaches every packet waiting on ARP for next_hop.
+ * @param pt            The pending table of this host.
+ * @param next_hop      The MIP address of the next hop.
+ * @return              The packets in arrival order, NULL if there are none.
+ * */
+struct pkt_buf *pending_take_arp(pending_table *pt, uint8_t next_hop);
+
+/**
+ * Checks if any packet is waiting on ARP for next_hop.
+ * @param pt            The pending table of this host.
+ * @param next_hop      The MIP address of the next hop.
+ * @return              Number of packets waiting.
+ * */
+size_t pending_arp_depth(pending_table *pt, uint8_t next_hop);
+
+/**
+ * Gives a detached list of packets back to the pool, and counts them as
+ * dropped for no route.
+ * @param pt            The pending table of this host.
+ * @param list          The packets to drop.
+ * @return              Number of packets dropped.
+ * */
+size_t pending_drop_list(pending_table *pt, struct pkt_buf *list);
+
+/**
+ * Gives every packet waiting on ARP for next_hop back to the pool, and counts
+ * them as dropped for no ARP entry.
+ * @param pt            The pending table of this host.
+ * @param next_hop      The MIP address of the next hop that did not answer.
+ * @return              Number of packets dropped.
+ * */
+size_t pending_drop_arp(pending_table *pt, uint8_t next_hop);
+
+/**
+ * Gives every packet in the pending table back to the pool, stops its timers
+ * and frees the table from memory.
+ * @param pt            The table to free.
+ * */
+void free_pending_table(pending_table *pt);
+
+#endif
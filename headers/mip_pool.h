@@ -0,0 +1,108 @@
+#ifndef MIP_POOL_H
+#define MIP_POOL_H
+
+#include "mip_link.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define POOL_BUFS               1024
+#define POOL_ALIGN              64          /* cache line */
+#define POOL_HUGEPAGE_SIZE      (1 << 21)
+
+#define POOL_HUGEPAGES          0x01        /* back the pool with huge pages */
+
+#define POOL_OWNER_FREE         0
+#define POOL_OWNER_RX           1           /* being filled from the link or app */
+#define POOL_OWNER_PENDING      2           /* waiting on a route or on ARP */
+#define POOL_OWNER_TX           3           /* being handed to the link */
+
+/**
+ * A packet buffer. Holds the frame header, PDU and SDU contiguously, in the
+ * layout they have on the wire, so sending a buffer is a single copy into the
+ * link.
+ * @param next      Next buffer on the freelist or in a pending list.
+ * @param owner     POOL_OWNER_* of the stage that holds the buffer.
+ * @param frame     The frame.
+ * */
+typedef struct pkt_buf {
+    struct pkt_buf          *next;
+    uint8_t                 owner;
+    struct link_frame       frame;
+} __attribute__((aligned(POOL_ALIGN))) pkt_buf;
+
+/**
+ * Counters for the pool.
+ * @param gets          Number of buffers handed out.
+ * @param puts          Number of buffers given back.
+ * @param exhausted     Number of times a buffer was asked for while none
+ *                      were free.
+ * @param bad_puts      Number of buffers given back twice.
+ * @param in_use        Number of buffers currently handed out.
+ * @param high_water    Highest in_use so far.
+ * */
+struct pool_stats {
+    size_t  gets;
+    size_t  puts;
+    size_t  exhausted;
+    size_t  bad_puts;
+    size_t  in_use;
+    size_t  high_water;
+};
+
+/**
+ * Fixed set of packet buffers, allocated once.
+ * @param bufs      The buffers.
+ * @param count     Number of buffers.
+ * @param map_len   Length of the mapping holding bufs.
+ * @param hugepages Set if the mapping is backed by huge pages.
+ * @param free      Freelist of buffers.
+ * @param stats     Counters for the pool.
+ * */
+typedef struct pkt_pool {
+    struct pkt_buf          *bufs;
+    size_t                  count;
+    size_t                  map_len;
+    int                     hugepages;
+    struct pkt_buf          *free;
+    struct pool_stats       stats;
+} pkt_pool;
+
+/**
+ * Maps count buffers and puts them all on the freelist. With POOL_HUGEPAGES,
+ * huge pages are tried first, and normal pages are used if none are available.
+ * @param count     Number of buffers.
+ * @param flags     0, or POOL_HUGEPAGES.
+ * @return          NULL if error, the new pool otherwise.
+ * */
+pkt_pool *pool_create(size_t count, int flags);
+
+/**
+ * Takes a buffer off the freelist.
+ * @param pool      The pool.
+ * @param owner     POOL_OWNER_* of the stage taking the buffer.
+ * @return          NULL if the pool is exhausted, the buffer otherwise.
+ * */
+pkt_buf *pool_get(pkt_pool *pool, uint8_t owner);
+
+/**
+ * Hands a buffer over to another stage of the daemon.
+ * @param buf       The buffer.
+ * @param owner     POOL_OWNER_* of the stage taking over.
+ * */
+void pool_handoff(pkt_buf *buf, uint8_t owner);
+
+/**
+ * Gives a buffer back to the pool.
+ * @param pool      The pool.
+ * @param buf       The buffer to give back.
+ * */
+void pool_put(pkt_pool *pool, pkt_buf *buf);
+
+/**
+ * Unmaps every buffer of the pool and frees the pool from memory.
+ * @param pool      The pool to free.
+ * */
+void free_pool(pkt_pool *pool);
+
+#endif
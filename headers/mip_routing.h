@@ -1,8 +1,14 @@
 #ifndef MIP_ROUTING_H
 #define MIP_ROUTING_H
 
-#include "queue.h"
 #include "structs.h"
+#include "mip_fib.h"
+#include "mip_ctrl.h"
+#include "mip_rtable.h"
+#include "mip_lsdb.h"
+#include "mip_shm.h"
+#include "mip_event.h"
+#include "mip_timer.h"
 
 #include <stdint.h>
 #include <stdlib.h>
@@ -10,126 +16,330 @@
 
 extern int DEBUG;
 
-#define MAX_NTWRK_SIZE          15
-#define INFINITY                255
 
-#define HELLO                   "HEL"
-#define UPDATE                  "UPD"
-#define REQUESTPKT              "REQ"
-#define RESPONSEPKT             "RES"
+/* sizes of the messages, mip_ctrl.h header included */
+#define HEL_SIZE                0x0C        /* src, interval, mult */
+#define UPD_SIZE                0x0A        /* src, flags, plus 3 times length */
+#define REQ_SIZE                0x08        /* plus length */
+#define RES_SIZE                0x08        /* plus 3 times length */
+#define FIB_SIZE                0x09        /* src, plus the entries */
+#define FIB_ENTRY_SIZE          0x03        /* plus a byte per next hop */
+#define LSA_SIZE                0x0A        /* src, origin, plus length */
+#define PRB_SIZE                0x0C        /* src, interval, mult */
 
-#define HEL_SIZE                0x06
-#define UPD_SIZE                0x07        /* plus 3 times length */
-#define REQ_SIZE                0x06
-#define RES_SIZE                0x06
+#define HELLO_INTERVAL_MS       1000        /* default, between two HELLOs */
+#define DETECT_MULT             3           /* default, missed HELLOs or probes before a neighbour is down */
+#define PROBE_INTERVAL_MS       10          /* default, between two probes on a fast link */
+#define MAX_NEIGHBOURS          0x0100      /* one dead timer per MIP address */
+#define RESYNC_INTERVAL_MS      30000       /* full UPDATE to every neighbour, or a fresh advert */
 
-#define HELLO_TIMEOUT           1
+#define UPD_FULL                0x01        /* carries every known destination */
+#define UPD_RESYNC              0x02        /* asks the receiver for a full UPDATE */
 
-#define LOOKUP_PKT_SIZE         7
-#define MAX_RT_PKT_SIZE         UPD_SIZE + 3 * MAX_NTWRK_SIZE + 2
+#define PROBE_LOCAL             0x01        /* the link was selected for fast probes here */
+#define PROBE_REMOTE            0x02        /* the neighbour probes us, and is probed back */
 
-enum states {
-    STATE_HELLO,
-    STATE_UPDATE,
-    STATE_WAIT,
-    STATE_EXIT,
+#define MAX_RT_ENTRIES          ((MAX_MSG_SIZE - 1 - UPD_SIZE) / 3)     /* per message, fits the 9 bit sdu_len */
+#define MAX_RT_PKT_SIZE         (UPD_SIZE + 3 * MAX_RT_ENTRIES)
+#define MAX_LOOKUP_ENTRIES      MAX_RT_ENTRIES      /* destinations per REQ and RES */
+
+
+/**
+ * Structure for remembering which best paths have been pushed to the daemon's
+ * forwarding table, so only changed destinations are sent.
+ * @param paths         Last pushed equal-cost next hops per destination.
+ * @param path_count    Number of them.
+ * @param hops          Last pushed hop count per destination. INFINITY if
+ *                      no route has been pushed.
+ * */
+struct mip_fib_state {
+    uint8_t                 paths[FIB_MAX_ENTRIES][FIB_MAX_PATHS];
+    uint8_t                 path_count[FIB_MAX_ENTRIES];
+    uint8_t                 hops[FIB_MAX_ENTRIES];
+};
+
+/**
+ * UPDATE state kept per neighbour. Only the destinations whose best path
+ * changed are advertised, in deltas numbered one after another, so a
+ * neighbour that misses one knows it and asks for the full table.
+ * @param seq           Sequence number of the last UPDATE heard from it.
+ * @param synced        Set once a full UPDATE was heard and no delta was
+ *                      missed since.
+ * @param asked         Set if a full UPDATE was asked for and has not arrived.
+ * @param send_full     Set if it is owed a full UPDATE.
+ * @param send_resync   Set if it is to be asked for a full UPDATE.
+ * */
+struct upd_peer {
+    uint16_t                seq;
+    uint8_t                 synced;
+    uint8_t                 asked;
+    uint8_t                 send_full;
+    uint8_t                 send_resync;
 };
 
 /**
- * Structure for representing a routing table entry.
- * @param dest          The destination node.
- * @param next_hop      Next node in path.
- * @param hops          Number of hops in path.
- * @param hello_count   For timeout. 
+ * State of the routing daemon, shared by the event handlers. It runs as a
+ * process of its own, or inside the MIP daemon, on its loop and timers.
+ * @param out               Where messages to the MIP daemon go: the socket
+ *                          connected to it, or its handlers when the routing
+ *                          daemon runs inside it.
+ * @param timers            The timer base of the process.
+ * @param hello_timer       Schedules a HELLO every hello_interval.
+ * @param dead_timer        Per neighbour, expires when it has been silent for
+ *                          as many of its intervals as its detect multiplier.
+ * @param probe_timer       Schedules the probes every probe_interval, while
+ *                          any link is probed.
+ * @param resync_timer      Owes every neighbour a full UPDATE every
+ *                          RESYNC_INTERVAL_MS, or refreshes our link-state
+ *                          advert.
+ * @param mip_address       MIP address of this host.
+ * @param link_state        Set to route with link-state adverts instead of
+ *                          distance vectors. Set by the caller before
+ *                          routing_init().
+ * @param hello_interval    Milliseconds between two HELLOs, told to the
+ *                          neighbours in each. Set by the caller before
+ *                          routing_init(), 0 for HELLO_INTERVAL_MS.
+ * @param detect_mult       Intervals without a HELLO or probe before the
+ *                          neighbours take us for down. Set by the caller
+ *                          before routing_init(), 0 for DETECT_MULT.
+ * @param probe_interval    Milliseconds between two probes. Set by the caller
+ *                          before routing_init(), 0 for PROBE_INTERVAL_MS.
+ * @param hello_pending     Set if a HELLO is to be sent after this wakeup.
+ * @param update_pending    Set if a delta UPDATE is to be sent after this wakeup.
+ * @param peer_pending      Set if a neighbour is owed a full UPDATE, every
+ *                          advert we have, or a resync request after this
+ *                          wakeup.
+ * @param lsa_pending       Set if our own advert is to be flooded after this
+ *                          wakeup.
+ * @param probe_pending     Set if the probes are to be sent after this wakeup.
+ * @param upd_seq           Sequence number of the last delta UPDATE sent.
+ * @param peer              UPDATE state per neighbour.
+ * @param probe             PROBE_LOCAL and PROBE_REMOTE per neighbour. The
+ *                          caller sets PROBE_LOCAL for the links to probe
+ *                          before routing_init().
+ * @param probe_detect      Per neighbour, the silence in milliseconds its
+ *                          probes ask to be taken for down after, 0 if it
+ *                          does not probe.
+ * @param routing_table     The routing table of this host. With link_state,
+ *                          only its cache of best routes is used.
+ * @param lsdb              The link-state database, with link_state.
+ * @param buf               Scratch buffer for a single message, of
+ *                          MAX_RT_PKT_SIZE bytes.
+ * @param fib_state         The best paths pushed to the daemon so far.
+ * @param routes            The route table exported in shared memory, NULL if
+ *                          there is none. Set by the caller before
+ *                          routing_init().
+ * @param loop              The event loop, unused inside the MIP daemon.
+ * */
+typedef struct routing_daemon {
+    struct ctrl_out         out;
+    struct timer_base       *timers;
+    struct mip_timer        hello_timer;
+    struct mip_timer        dead_timer[MAX_NEIGHBOURS];
+    struct mip_timer        resync_timer;
+    struct mip_timer        probe_timer;
+    uint8_t                 mip_address;
+    int                     link_state;
+    uint16_t                hello_interval;
+    uint8_t                 detect_mult;
+    uint16_t                probe_interval;
+    int                     hello_pending;
+    int                     update_pending;
+    int                     peer_pending;
+    int                     lsa_pending;
+    int                     probe_pending;
+    uint16_t                upd_seq;
+    struct upd_peer         peer[MAX_NEIGHBOURS];
+    uint8_t                 probe[MAX_NEIGHBOURS];
+    uint32_t                probe_detect[MAX_NEIGHBOURS];
+    struct routing_table    routing_table;
+    struct lsdb             lsdb;
+    char                    *buf;
+    struct mip_fib_state    fib_state;
+    struct route_shm        *routes;
+    struct event_loop       loop;
+} routing_daemon;
+
+/**
+ * Sets up the routing table and scratch buffer of a routing daemon, with a
+ * route to itself, schedules the first HELLO and starts the HELLO and resync
+ * timers. Where messages to the MIP daemon go is set up by the caller.
+ * @param r                 The routing daemon.
+ * @param mip_address       MIP address of this host.
+ * @param timers            The timer base to run the HELLO and dead timers on.
+ * @return                  -1 if error, 0 otherwise.
+ * */
+int routing_init(routing_daemon *r, uint8_t mip_address, timer_base *timers);
+
+/**
+ * Handles a message received from the MIP daemon, on the handler of its
+ * opcode. HELLO and
+ * UPDATE packets are merged into the routing table, a HELLO or probe restarts
+ * the dead timer of its sender, and a lookup request is answered. A probing
+ * neighbour is probed back. A neighbour that
+ * just came up is owed a full UPDATE, and one whose deltas have a gap is
+ * asked for one. With link_state, HELLOs change our own advert instead, a
+ * neighbour that just came up is owed every advert we have, and a newer
+ * advert is flooded on to the other neighbours.
+ * @param r                 The routing daemon.
+ * @param msg               The message, checked by ctrl_parse().
+ * @return                  -1 if error, 0 otherwise.
+ * */
+int routing_handle_msg(routing_daemon *r, const struct ctrl_msg *msg);
+
+/* the handlers of routing_handle_msg() per opcode, for a MIP daemon that runs */
+/* the routing daemon inside it and sends it messages with ctrl_send() */
+extern const ctrl_handler routing_handlers[CTRL_OPCODES];
+
+/**
+ * Sends the HELLO, probe and UPDATE packets scheduled by the handlers. Each is sent
+ * once per call, no matter how many events scheduled it. Full UPDATEs go out
+ * before the delta, so a neighbour synced by one takes the delta as the next
+ * in sequence.
+ * @param r                 The routing daemon.
+ * @return                  -1 if error, 0 otherwise.
  * */
-struct mip_routing_table_entry {
-    uint8_t                 dest;
-    uint8_t                 next_hop;
-    uint8_t                 hops;
-    uint8_t                 hello_count;
-} mip_routing_table_entry;
+int routing_send_scheduled(routing_daemon *r);
 
 /**
- * Function for sending a routing lookup response.
+ * Function for answering a batch of routing lookups with a single response,
+ * carrying the request ID back so the daemon can match it to its request.
  * 
- * @param socket            Socket to send over.
+ * @param out               Where to send it.
  * @param routing_table     The routing table of this host.
  * @param src               The source address of this host.
- * @param req               The requested address.
+ * @param id                The request ID.
+ * @param dests             The requested addresses.
+ * @param count             Number of requested addresses, at most
+ *                          MAX_LOOKUP_ENTRIES.
  * @return                  -1 if error, 0 otherwise.
  * */
-int send_routing_res(int socket, queue *routing_table, uint8_t src, uint8_t req);
+int send_routing_res(const struct ctrl_out *out, routing_table *routing_table, uint8_t src,
+    uint16_t id, const uint8_t *dests, int count);
 
 /**
- * Function for updating a routing table entry.
+ * Function that takes a full or delta UPDATE and merges it with this hosts routing
+ * table. A route the sender has over this host is taken as unreachable over the sender.
  * @param routing_table     The routing table of this host.
- * @param src               The target node.
- * @param dest              The next hop address.
- * @param hops              Hop count.
- * @param hello_count       The HELLO count to synchronize new entries with.
- * 
- * @return                  1 if the routing table was updated, 
- *                          0 if not, -1 if error.
+ * @param msg               The UPDATE.
+ * @return                  1 if a best route changed, 0 otherwise.
  * */
-int update_entry(queue *routing_table, uint8_t src, uint8_t dest, uint8_t hops, uint8_t hello_count);
+int update_table(routing_table *routing_table, const struct ctrl_msg *msg);
 
 /**
- * Function that takes a routing table and merges it with this hosts routing table.
- * @param routing_table     The routing table of this host.
- * @param sdu               The SDU containing the received routing table.
- * @param mip_address       This hosts MIP address.
- * @param hello_count       The HELLO count to synchronize new entries with.
- * @return                  1 if the routing table was updated, 
- *                          0 if not, -1 if error.
- * 
+ * Function for sending a hello packet. It tells the neighbours how often we
+ * say HELLO, and after how many missed ones to take us for down.
+ * @param out       Where to send it.
+ * @param src       The MIP address of this host.
+ * @param interval  Milliseconds between two HELLOs.
+ * @param mult      Detect multiplier.
+ * @return          -1 if error, 0 otherwise.
  * */
-int update_table(queue * routing_table, struct mip_sdu *sdu, uint8_t mip_address, uint8_t hello_count);
+int send_hello(const struct ctrl_out *out, uint8_t src, uint16_t interval, uint8_t mult);
 
 /**
- * Function for sending a hello packet.
- * @param socket    FD to write to.
+ * Function that unicast a fast probe to a neighbour. Like a HELLO, it tells
+ * how often the next ones follow and after how many missed ones to take us
+ * for down.
+ * @param out       Where to send it.
  * @param src       The MIP address of this host.
+ * @param to        The neighbour to send to.
+ * @param interval  Milliseconds between two probes.
+ * @param mult      Detect multiplier.
  * @return          -1 if error, 0 otherwise.
  * */
-int send_hello(int socket, uint8_t src);
+int send_probe(const struct ctrl_out *out, uint8_t src, uint8_t to, uint16_t interval,
+    uint8_t mult);
 
 /**
- * Function that unicast routing tables to all adjacent hosts except for given host.
- * @param socket            FD to write to.
+ * Function that unicast an UPDATE to one or all adjacent hosts. A delta carries
+ * the destinations whose best path changed since the last delta, and is given
+ * the next sequence number. It is not sent if nothing changed. A full UPDATE
+ * carries every known destination, and a resync request none. Each neighbour
+ * is told the routes that go over it are unreachable. An UPDATE of more than
+ * MAX_RT_ENTRIES destinations is split in packets that are merged on their
+ * own, each packet of a delta taking the next sequence number.
+ * @param out               Where to send it.
  * @param routing_table     The routing table of this host.
- * @param last_upd_src      The address of the host that triggered this update.
  * @param src               The MIP address of this host.
+ * @param seq               Sequence number of the last delta, advanced by a
+ *                          delta that is sent.
+ * @param flags             0 for a delta, UPD_FULL or UPD_RESYNC.
+ * @param to                The neighbour to send to, MAX_MIP_ADDR for every
+ *                          adjacent host.
  * @return                  -1 if error, 0 otherwise.
  * */
-int send_update(int socket, struct queue *routing_table, uint8_t last_upd_src, uint8_t src);
+int send_update(const struct ctrl_out *out, routing_table *routing_table, uint8_t src, uint16_t *seq,
+    uint8_t flags, uint8_t to);
 
 /**
- * Function that receives a routing SDU from underlyding daemon.
- * @param socket    FD to write to.
- * @param packet    The buffer to write to.
+ * Function that unicast the link-state advert of a host to a neighbour.
+ * @param out               Where to send it.
+ * @param lsdb              The link-state database of this host.
+ * @param origin            The host whose advert is sent.
+ * @param src               The MIP address of this host.
+ * @param to                The neighbour to send to.
+ * @return                  -1 if error, 0 otherwise.
  * */
-int recv_from_daemon(int socket, mip_sdu *packet);
+int send_lsa(const struct ctrl_out *out, lsdb *lsdb, uint8_t origin, uint8_t src, uint8_t to);
 
 /**
- * Function that checks for timeouts in routing table.
- * @param routing_table     The routing table of this host.
- * @param hello_count       The HELLO count to detect timeouts with.
- * @return                  A host that time out. NULL if no host timed out.
+ * Function that initializes the pushed FIB state to all unreachable.
+ * @param state             The state to initialize.
  * */
-struct mip_routing_table_entry *check_for_timeouts(queue *routing_table, uint8_t hello_count);
+void init_fib_state(struct mip_fib_state *state);
 
 /**
- * Function that updates hello counts of adjacent nodes.
+ * Function that pushes the destinations whose best path or equal-cost next
+ * hops changed since the last push to the daemon's forwarding table. Each
+ * entry is the destination, its hop count, the number of next hops and the
+ * next hops. With a shared memory route table, the changes are published in
+ * it in a single write, and only go over the socket until the daemon has
+ * attached to it.
+ * @param out               Where to send it.
  * @param routing_table     The routing table of this host.
+ * @param state             The best paths pushed so far.
+ * @param shm               The shared memory route table, NULL if none.
  * @param src               The MIP address of this host.
- * @param hello_count       The HELLO count to synchronize new entries with.
+ * @return                  Number of pushed entries, -1 if error.
+ * */
+int push_fib_updates(const struct ctrl_out *out, routing_table *routing_table,
+    struct mip_fib_state *state, route_shm *shm, uint8_t src);
+
+/**
+ * Function that receives a message from the underlying daemon and checks its
+ * header.
+ * @param socket    FD to read from.
+ * @param buf       Buffer of MAX_RT_PKT_SIZE bytes to read into.
+ * @param msg       Where to store the message.
+ * @return          -1 if error or the daemon disconnected, RECV_AGAIN if there
+ *                  is nothing to read, 1 if the message is malformed, 0
+ *                  otherwise.
+ * */
+int recv_from_daemon(int socket, char *buf, struct ctrl_msg *msg);
+
+/**
+ * Reads a positive number of at most max from an option argument.
+ * @param arg       The argument.
+ * @param max       The largest number allowed.
+ * @return          The number, -1 if it is not one.
+ * */
+long routing_parse_option(const char *arg, long max);
+
+/**
+ * Selects the links to the neighbours in a comma separated list for fast
+ * probes.
+ * @param list      The list, split in place.
+ * @param probe     Per neighbour, set to PROBE_LOCAL if it is listed.
+ * @return          -1 if the list is malformed, 0 otherwise.
  * */
-void update_hello_count(queue *routing_table, uint8_t src, uint8_t hello_count);
+int routing_parse_probes(char *list, uint8_t *probe);
 
 /**
- * Function that frees the given routing table from heap memory.
- * @param routing_table     The table to free.
+ * Closes every fd of the routing daemon, stops its timers and frees it from
+ * memory.
+ * @param r         The routing daemon to free.
  * */
-void free_routing_table(queue *routing_table);
+void free_routing_daemon(routing_daemon *r);
 
 #endif
\ No newline at end of file
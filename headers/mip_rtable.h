@@ -0,0 +1,159 @@
+#ifndef MIP_RTABLE_H
+#define MIP_RTABLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define INFINITY                255
+
+#define RTABLE_SLOTS            0x0100      /* one slot per MIP address */
+#define RTABLE_MAX_NEIGHBOURS   32          /* candidate columns per destination */
+#define RTABLE_NONE             0xFF        /* no column */
+#define RTABLE_MAX_PATHS        8           /* equal-cost next hops per destination */
+
+/**
+ * Distance vector routing table, indexed directly by destination MIP address.
+ * Every neighbour that advertised a route gets a column, and each destination
+ * keeps the cost over every column next to each other, so choosing between
+ * them touches a single row. The best route of each destination is cached and
+ * kept up to date as costs change, so a lookup is a single array access and
+ * an update only looks at the destination it is for. Next to the best route,
+ * every neighbour the destination is as few hops away over is kept, so
+ * traffic can be spread over paths of equal cost.
+ * @param mip_address   MIP address of this host, always reachable in 0 hops.
+ * @param columns       Number of columns in use, free ones included.
+ * @param neighbour     MIP address per column, MAX_MIP_ADDR if the column is
+ *                      free.
+ * @param column        Column per neighbour MIP address, RTABLE_NONE if the
+ *                      address has none.
+ * @param cost          Hops to each destination over each column, INFINITY if
+ *                      the neighbour has no route.
+ * @param best          Column of the cached best route per destination,
+ *                      RTABLE_NONE for this host and unreachable destinations.
+ * @param next_hop      Next hop of the cached best route per destination.
+ * @param hops          Hops of the cached best route per destination,
+ *                      INFINITY if unreachable.
+ * @param paths         Equal-cost next hops per destination, in ascending
+ *                      order, at most RTABLE_MAX_PATHS.
+ * @param path_count    Number of equal-cost next hops per destination, 0 if
+ *                      unreachable.
+ * @param known         Set for each destination any neighbour has advertised,
+ *                      advertised on as unreachable once every route is gone.
+ * @param size          Number of known destinations.
+ * @param dirty         Bitmap of destinations whose best route or equal-cost
+ *                      next hops changed since rtable_take_dirty() last
+ *                      cleared them.
+ * @param changed       Bitmap of destinations whose best route changed since
+ *                      rtable_take_changed() last cleared them, so pushing
+ *                      the forwarding table and advertising the changes keep
+ *                      track of them apart.
+ * */
+typedef struct routing_table {
+    uint8_t                 mip_address;
+    uint8_t                 columns;
+    uint8_t                 neighbour[RTABLE_MAX_NEIGHBOURS];
+    uint8_t                 column[RTABLE_SLOTS];
+    uint8_t                 cost[RTABLE_SLOTS][RTABLE_MAX_NEIGHBOURS];
+    uint8_t                 best[RTABLE_SLOTS];
+    uint8_t                 next_hop[RTABLE_SLOTS];
+    uint8_t                 hops[RTABLE_SLOTS];
+    uint8_t                 paths[RTABLE_SLOTS][RTABLE_MAX_PATHS];
+    uint8_t                 path_count[RTABLE_SLOTS];
+    uint8_t                 known[RTABLE_SLOTS];
+    size_t                  size;
+    uint64_t                dirty[RTABLE_SLOTS / 64];
+    uint64_t                changed[RTABLE_SLOTS / 64];
+} routing_table;
+
+/**
+ * Sets up an empty routing table that only knows the route to this host.
+ * @param rt            The routing table.
+ * @param mip_address   MIP address of this host.
+ * */
+void rtable_init(routing_table *rt, uint8_t mip_address);
+
+/**
+ * Sets the cost of reaching dest over a neighbour, and updates the cached
+ * best route of dest. A neighbour without a column is given one.
+ * @param rt            The routing table.
+ * @param neighbour     The neighbour that advertised the route.
+ * @param dest          The destination.
+ * @param hops          Hops to dest over the neighbour, INFINITY if it can not
+ *                      reach it.
+ * @return              1 if the best route of dest changed, 0 if not or if
+ *                      every column is taken.
+ * */
+int rtable_update(routing_table *rt, uint8_t neighbour, uint8_t dest, uint8_t hops);
+
+/**
+ * Sets the cached routes of dest directly, for a routing engine that computes
+ * the routes itself and uses the table only as their cache. The first next
+ * hop becomes the best route.
+ * @param rt            The routing table.
+ * @param dest          The destination.
+ * @param next_hops     The equal-cost next hops, in ascending order.
+ * @param count         Number of next hops, 0 if dest is unreachable. Only
+ *                      the first RTABLE_MAX_PATHS are kept.
+ * @param hops          Hops to dest, INFINITY if it is unreachable.
+ * @return              1 if the best route changed, 0 otherwise.
+ * */
+int rtable_install(routing_table *rt, uint8_t dest, const uint8_t *next_hops, int count,
+    uint8_t hops);
+
+/**
+ * Forgets every route over a neighbour and frees its column, rerouting the
+ * destinations it was the best next hop for.
+ * @param rt            The routing table.
+ * @param neighbour     The neighbour that went down.
+ * @return              Number of destinations whose best route changed.
+ * */
+int rtable_neighbour_down(routing_table *rt, uint8_t neighbour);
+
+/**
+ * Checks if a neighbour is directly reachable, that is if it said HELLO and
+ * has not gone down since.
+ * @param rt            The routing table.
+ * @param neighbour     The neighbour.
+ * @return              1 if it is adjacent, 0 otherwise.
+ * */
+int rtable_adjacent(const routing_table *rt, uint8_t neighbour);
+
+/**
+ * Looks up the best route to dest.
+ * @param rt            The routing table.
+ * @param dest          The destination.
+ * @param next_hop      Where to store the next hop, MAX_MIP_ADDR if there is
+ *                      no route.
+ * @return              Hops to dest, INFINITY if it is unreachable.
+ * */
+uint8_t rtable_lookup(const routing_table *rt, uint8_t dest, uint8_t *next_hop);
+
+/**
+ * Looks up every next hop dest is as few hops away over as the best route.
+ * @param rt            The routing table.
+ * @param dest          The destination.
+ * @param next_hops     Where to store a pointer to the next hops, in ascending
+ *                      order.
+ * @return              Number of next hops, 0 if dest is unreachable.
+ * */
+int rtable_paths(const routing_table *rt, uint8_t dest, const uint8_t **next_hops);
+
+/**
+ * Finds the next destination whose best route changed, and clears its mark.
+ * @param rt            The routing table.
+ * @param from          The destination to start looking from.
+ * @return              The destination, -1 if no destination from `from` on
+ *                      changed.
+ * */
+int rtable_take_dirty(routing_table *rt, int from);
+
+/**
+ * Like rtable_take_dirty(), for the changes to advertise to the neighbours.
+ * @param rt            The routing table.
+ * @param from          The destination to start looking from.
+ * @return              The destination, -1 if no destination from `from` on
+ *                      changed.
+ * */
+int rtable_take_changed(routing_table *rt, int from);
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef MIP_SHM_H
+#define MIP_SHM_H
+
+#include "mip_rtable.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHM_NAME_FMT            "/mip_routes.%d"    /* one segment per MIP address */
+#define SHM_NAME_LEN            32
+#define SHM_MAGIC               0x4D495052          /* "MIPR" */
+#define SHM_VERSION             1
+#define SHM_READ_RETRIES        64          /* reads that may overlap a write before giving up */
+
+/**
+ * The best route to a destination, as published by the routing daemon.
+ * @param hops          Hops to the destination, INFINITY if unreachable.
+ * @param paths         Number of equal-cost next hops, 0 if unreachable.
+ * @param next_hop      The equal-cost next hops in ascending order, the first
+ *                      is the best route.
+ * @param generation    Bumped each time the route changes, so a reader can
+ *                      tell if a route it read before is still current.
+ * */
+struct shm_route {
+    uint8_t                 hops;
+    uint8_t                 paths;
+    uint8_t                 next_hop[RTABLE_MAX_PATHS];
+    uint32_t                generation;
+};
+
+/**
+ * Route table the routing daemon exports in a shared memory segment, so
+ * every local process can look up a route without a syscall. The routes are
+ * written under a seqlock: the writer makes seq odd, writes, and makes it
+ * even again, and a reader retries if seq was odd or moved while it copied.
+ * Writes never wait on readers.
+ * @param magic         SHM_MAGIC, set once the segment is set up.
+ * @param version       SHM_VERSION.
+ * @param attached      Set by the MIP daemon once it reads its routes from
+ *                      the segment, so the routing daemon stops pushing them
+ *                      over the socket.
+ * @param seq           The seqlock.
+ * @param routes        The route per destination MIP address.
+ * */
+typedef struct route_shm {
+    uint32_t                magic;
+    uint16_t                version;
+    uint8_t                 attached;
+    uint32_t                seq;
+    struct shm_route        routes[RTABLE_SLOTS];
+} route_shm;
+
+/**
+ * Creates the segment of a MIP address, replacing a left over one, with every
+ * destination unreachable.
+ * @param mip_address   MIP address of this host.
+ * @return              The mapped segment, NULL if error.
+ * */
+route_shm *route_shm_create(uint8_t mip_address);
+
+/**
+ * Maps the segment of a MIP address, as created by the routing daemon.
+ * @param mip_address   MIP address of the host.
+ * @param writable      Set to map it writable, as the MIP daemon does to set
+ *                      attached. Readers map it read-only.
+ * @return              The mapped segment, NULL if there is none, or it is of
+ *                      another version.
+ * */
+route_shm *route_shm_open(uint8_t mip_address, int writable);
+
+/**
+ * Unmaps a segment.
+ * @param shm           The segment, may be NULL.
+ * */
+void route_shm_close(route_shm *shm);
+
+/**
+ * Removes the segment of a MIP address. Processes that have it mapped keep
+ * reading the routes last written.
+ * @param mip_address   MIP address of this host.
+ * */
+void route_shm_unlink(uint8_t mip_address);
+
+/**
+ * Starts a write. Readers retry until route_shm_write_end().
+ * @param shm           The segment.
+ * */
+void route_shm_write_begin(route_shm *shm);
+
+/**
+ * Sets the route to a destination between route_shm_write_begin() and
+ * route_shm_write_end(), and bumps its generation.
+ * @param shm           The segment.
+ * @param dest          The destination.
+ * @param next_hops     The equal-cost next hops, in ascending order.
+ * @param count         Number of next hops, 0 if dest is unreachable.
+ * @param hops          Hops to dest, INFINITY if it is unreachable.
+ * */
+void route_shm_set(route_shm *shm, uint8_t dest, const uint8_t *next_hops, int count,
+    uint8_t hops);
+
+/**
+ * Ends a write, publishing every route set since route_shm_write_begin().
+ * @param shm           The segment.
+ * */
+void route_shm_write_end(route_shm *shm);
+
+/**
+ * Reads a consistent copy of the route to a destination.
+ * @param shm           The segment.
+ * @param dest          The destination.
+ * @param route         Where to store the route.
+ * @return              0 if read, -1 if every try overlapped a write, as it
+ *                      does if the writer died halfway.
+ * */
+int route_shm_lookup(const route_shm *shm, uint8_t dest, struct shm_route *route);
+
+#endif
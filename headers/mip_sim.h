@@ -0,0 +1,198 @@
+#ifndef MIP_SIM_H
+#define MIP_SIM_H
+
+#include "structs.h"
+#include "mip.h"
+#include "mip_fib.h"
+#include "mip_link.h"
+#include "mip_routing.h"
+#include "mip_timer.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SIM_MAX_NODES           254         /* MIP addresses 1 to 254 */
+#define SIM_DEFAULT_DELAY_US    1000
+#define SIM_DEFAULT_SECONDS     60
+#define SIM_DEFAULT_PACKETS     10000
+#define SIM_DEFAULT_SEED        1
+#define SIM_PACKET_GAP_US       10          /* between two injected packets */
+#define SIM_DRAIN_US            1000000     /* for the last injected packets to arrive */
+#define SIM_LINE_SIZE           256
+
+#define SIM_EV_BOOT             0           /* a node starts its routing daemon */
+#define SIM_EV_FRAME            1           /* a frame arrives at a node */
+#define SIM_EV_INJECT           2           /* an application sends a packet */
+#define SIM_EV_TIMERS           3           /* the earliest timer of a node is due */
+#define SIM_EV_CUT              4           /* a link goes down */
+
+/**
+ * An event on the simulated clock.
+ * @param time      When the event happens, in microseconds.
+ * @param seq       Order the event was scheduled in, breaks ties in time.
+ * @param type      SIM_EV_*.
+ * @param node      MIP address of the node the event happens at.
+ * @param ifindex   Interface a frame arrives on. For SIM_EV_INJECT, the
+ *                  destination of the packet. For SIM_EV_CUT, the node on the
+ *                  other end of the link.
+ * @param len       Length of the frame.
+ * @param next      Next event on the freelist.
+ * @param frame     The frame.
+ * */
+struct sim_event {
+    uint64_t                time;
+    uint64_t                seq;
+    int                     type;
+    int                     node;
+    int                     ifindex;
+    size_t                  len;
+    struct sim_event        *next;
+    struct link_frame       frame;
+};
+
+/**
+ * A simulated host, running the MIP daemon logic and a routing daemon.
+ * @param sim           The simulation the node is part of.
+ * @param present       Set if the node is part of the topology.
+ * @param crashed       Set once the node has hit an error the daemon exits on.
+ * @param mip_address   MIP address of the node.
+ * @param degree        Number of interfaces.
+ * @param peers         MIP address of the node on the other end of each
+ *                      interface.
+ * @param peer_if       Interface index on the other end of each interface.
+ * @param delay_us      Delay of each interface.
+ * @param down          Set for each interface whose link was cut.
+ * @param probe         Set for each interface whose link is probed fast.
+ * @param fd            Daemon end of the socket pair to the routing daemon.
+ * @param ifs           The interfaces, on the simulated link.
+ * @param arp_table     The ARP cache.
+ * @param timers        Timers of the daemon, driven by the simulated clock.
+ * @param timer_at      When the SIM_EV_TIMERS event of the node is scheduled,
+ *                      TIMER_NEVER if none is.
+ * @param fib           Forwarding table pushed by the routing daemon.
+ * @param r             The routing daemon.
+ * @param buf           Scratch buffer for a routing message.
+ * @param rx_ready      Set if rx holds a frame not yet read.
+ * @param rx_len        Length of the frame in rx.
+ * @param rx_addr       Link layer address of the frame in rx.
+ * @param rx            The frame that arrived.
+ * @param tx_if         Interface of the frame reserved in tx.
+ * @param tx            The frame being sent.
+ * */
+struct sim_node {
+    struct mip_sim              *sim;
+    int                         present;
+    int                         crashed;
+    uint8_t                     mip_address;
+    int                         degree;
+    uint8_t                     peers[MAX_IFS];
+    int                         peer_if[MAX_IFS];
+    uint32_t                    delay_us[MAX_IFS];
+    uint8_t                     down[MAX_IFS];
+    uint8_t                     probe[MAX_IFS];
+    int                         fd;
+    struct network_interfaces   ifs;
+    struct arp_table            *arp_table;
+    struct timer_base           timers;
+    uint64_t                    timer_at;
+    struct mip_fib              fib;
+    struct routing_daemon       *r;
+    char                        buf[MAX_MSG_SIZE];
+    int                         rx_ready;
+    size_t                      rx_len;
+    struct sockaddr_ll          rx_addr;
+    struct link_frame           rx;
+    int                         tx_if;
+    struct link_frame           tx;
+};
+
+/**
+ * Counters for a simulation run.
+ * @param events            Number of handled events.
+ * @param hello             Number of HELLO frames sent.
+ * @param update            Number of UPDATE frames sent.
+ * @param lsa               Number of link-state advert frames sent.
+ * @param probe             Number of fast probe frames sent.
+ * @param update_noarp      Number of UPDATE packets dropped by the daemon
+ *                          since the MAC address of the neighbour was unknown.
+ * @param arp               Number of ARP frames sent.
+ * @param arp_failed        Number of neighbours ARP gave up on.
+ * @param control_bytes     Bytes of HELLO, UPDATE, LSA, probe and ARP frames
+ *                          sent.
+ * @param crashed           Number of nodes that hit an error the daemon exits on.
+ * @param fib_msgs          Number of forwarding table deltas pushed to a daemon.
+ * @param fib_changes       Number of forwarding table entries that changed.
+ * @param data_sent         Number of injected packets.
+ * @param data_frames       Number of data frames sent, one per hop.
+ * @param data_delivered    Number of injected packets that arrived.
+ * @param data_noroute      Number of packets dropped with no route.
+ * @param data_noarp        Number of packets dropped with no ARP entry.
+ * @param data_ttl          Number of packets dropped when their ttl ran out.
+ * @param data_down         Number of packets dropped at a node that exited.
+ * @param latency_us        Sum of the latency of every delivered packet.
+ * */
+struct sim_counters {
+    size_t                  events;
+    size_t                  hello;
+    size_t                  update;
+    size_t                  lsa;
+    size_t                  probe;
+    size_t                  update_noarp;
+    size_t                  arp;
+    size_t                  arp_failed;
+    size_t                  control_bytes;
+    size_t                  crashed;
+    size_t                  fib_msgs;
+    size_t                  fib_changes;
+    size_t                  data_sent;
+    size_t                  data_frames;
+    size_t                  data_delivered;
+    size_t                  data_noroute;
+    size_t                  data_noarp;
+    size_t                  data_ttl;
+    size_t                  data_down;
+    uint64_t                latency_us;
+};
+
+/**
+ * A simulation of many nodes in one process, on a simulated clock.
+ * @param now           The simulated clock, in microseconds.
+ * @param seq           Number of events scheduled so far.
+ * @param seed          State of the random generator.
+ * @param node_count    Number of nodes in the topology.
+ * @param link_count    Number of links in the topology.
+ * @param link_state    Set to route with link-state adverts instead of
+ *                      distance vectors.
+ * @param hello_interval  Milliseconds between two HELLOs, 0 for the
+ *                      default.
+ * @param detect_mult   Missed HELLOs or probes before a neighbour is down, 0
+ *                      for the default.
+ * @param nodes         The nodes, indexed by MIP address.
+ * @param heap          Pending events, a binary min-heap on time and seq.
+ * @param heap_len      Number of pending events.
+ * @param heap_cap      Capacity of heap.
+ * @param free_events   Freelist of events.
+ * @param last_change   When a forwarding table last changed.
+ * @param last_cut      When a link was last cut, 0 if none was.
+ * @param counters      Counters for the run.
+ * */
+typedef struct mip_sim {
+    uint64_t                now;
+    uint64_t                seq;
+    unsigned int            seed;
+    int                     node_count;
+    int                     link_count;
+    int                     link_state;
+    uint16_t                hello_interval;
+    uint8_t                 detect_mult;
+    struct sim_node         *nodes;
+    struct sim_event        **heap;
+    size_t                  heap_len;
+    size_t                  heap_cap;
+    struct sim_event        *free_events;
+    uint64_t                last_change;
+    uint64_t                last_cut;
+    struct sim_counters     counters;
+} mip_sim;
+
+#endif
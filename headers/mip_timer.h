@@ -0,0 +1,147 @@
+#ifndef MIP_TIMER_H
+#define MIP_TIMER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TIMER_NEVER             UINT64_MAX
+#define TIMER_WHEEL_BITS        6
+#define TIMER_WHEEL_SIZE        (1 << TIMER_WHEEL_BITS)     /* slots per level */
+#define TIMER_WHEEL_MASK        (TIMER_WHEEL_SIZE - 1)
+#define TIMER_WHEEL_LEVELS      4           /* 1 ms slots up to 4.6 hours ahead */
+
+/* the structure of type a timer is embedded in as member */
+#define timer_container(t, type, member) \
+    ((type*) ((char*) (t) - offsetof(type, member)))
+
+struct mip_timer;
+
+/**
+ * Called when a timer expires. The timer is no longer pending, and may be
+ * added again from the callback.
+ * @param t         The timer.
+ * @param arg       The argument the timer was set up with.
+ * @return          -1 if error, 0 otherwise.
+ * */
+typedef int (*timer_fn)(struct mip_timer *t, void *arg);
+
+/**
+ * A timer, embedded in whatever it times. Adding and cancelling it does not
+ * allocate, and takes constant time.
+ * @param expires   When the timer expires, in milliseconds.
+ * @param next      Next timer in the same slot of the wheel.
+ * @param pprev     The pointer to this timer in its slot, NULL if the timer
+ *                  is not pending.
+ * @param slot      Level * TIMER_WHEEL_SIZE + slot the timer is in.
+ * @param fn        Called when the timer expires.
+ * @param arg       Passed to fn.
+ * */
+struct mip_timer {
+    uint64_t                expires;
+    struct mip_timer        *next;
+    struct mip_timer        **pprev;
+    uint16_t                slot;
+    timer_fn                fn;
+    void                    *arg;
+};
+
+/**
+ * Timers of a process, kept in a hierarchical timer wheel and driven by a
+ * single CLOCK_MONOTONIC timerfd. Level 0 has a slot per millisecond, and
+ * each level above has slots TIMER_WHEEL_SIZE times as long. A timer is
+ * hashed into the level its delay falls in, and moved down a level each time
+ * the clock enters its slot, so adding and cancelling a timer is O(1) no
+ * matter how many are pending. The timerfd is only rearmed when the next
+ * expiry changes, so pending timers cost no syscalls.
+ * @param fd        The timerfd, readable when the earliest timer is due. -1
+ *                  if the owner drives the clock itself, as the simulator does.
+ * @param now       The clock, in milliseconds. Timers are added relative to it.
+ * @param clk       The next millisecond the wheel has to go through.
+ * @param armed     Expiry the timerfd is armed for, TIMER_NEVER if disarmed.
+ * @param count     Number of pending timers.
+ * @param occupied  Bitmap of the slots that hold timers, per level.
+ * @param wheel     Pending timers, per level and slot.
+ * */
+typedef struct timer_base {
+    int                     fd;
+    uint64_t                now;
+    uint64_t                clk;
+    uint64_t                armed;
+    size_t                  count;
+    uint64_t                occupied[TIMER_WHEEL_LEVELS];
+    struct mip_timer        *wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];
+} timer_base;
+
+/**
+ * Reads CLOCK_MONOTONIC.
+ * @return          The time in milliseconds.
+ * */
+uint64_t timer_clock_ms(void);
+
+/**
+ * Sets up an empty timer base.
+ * @param b         The timer base.
+ * @param with_fd   Set to create the timerfd and follow CLOCK_MONOTONIC, 0
+ *                  if the caller sets b->now and calls timer_run() itself.
+ * @return          -1 if error, 0 otherwise.
+ * */
+int timer_base_init(timer_base *b, int with_fd);
+
+/**
+ * Closes the timerfd. Pending timers are forgotten.
+ * @param b         The timer base.
+ * */
+void timer_base_close(timer_base *b);
+
+/**
+ * Sets up a timer that is not pending.
+ * @param t         The timer.
+ * @param fn        Called when the timer expires.
+ * @param arg       Passed to fn.
+ * */
+void timer_init(struct mip_timer *t, timer_fn fn, void *arg);
+
+/**
+ * Makes a timer expire delay_ms from now. A pending timer is moved.
+ * @param b         The timer base.
+ * @param t         The timer.
+ * @param delay_ms  Milliseconds until the timer expires.
+ * @return          -1 if error, 0 otherwise.
+ * */
+int timer_add(timer_base *b, struct mip_timer *t, uint64_t delay_ms);
+
+/**
+ * Stops a timer. Nothing happens if it is not pending.
+ * @param b         The timer base.
+ * @param t         The timer.
+ * */
+void timer_cancel(timer_base *b, struct mip_timer *t);
+
+/**
+ * Checks if a timer is pending.
+ * @param t         The timer.
+ * @return          1 if the timer is pending, 0 otherwise.
+ * */
+int timer_pending(const struct mip_timer *t);
+
+/**
+ * Fires every timer that has expired by now, in order, and rearms the
+ * timerfd for the next one. With a timerfd, its expirations are read first.
+ * @param b         The timer base.
+ * @param now       The clock in milliseconds. Ignored with a timerfd, which
+ *                  reads CLOCK_MONOTONIC instead.
+ * @return          -1 if a callback or the timerfd failed, 0 otherwise.
+ * */
+int timer_run(timer_base *b, uint64_t now);
+
+/**
+ * Finds when the wheel next has work to do: the earliest expiry of a timer
+ * in level 0, or when the clock enters the next slot of a higher level that
+ * holds timers, whichever comes first.
+ * @param b         The timer base.
+ * @return          The time in milliseconds, TIMER_NEVER if no timer is
+ *                  pending.
+ * */
+uint64_t timer_next(const timer_base *b);
+
+#endif
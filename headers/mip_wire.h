@@ -0,0 +1,32 @@
+#ifndef MIP_WIRE_H
+#define MIP_WIRE_H
+
+#include "mip_link.h"
+
+#include <stdint.h>
+
+#define WIRE_QUEUE              256         /* frames held back by the shaper */
+#define WIRE_PATH_FORMAT        "%s/wire-%d"
+#define WIRE_MAC_PREFIX         0x02        /* locally administered, unicast */
+
+/**
+ * Link backend made of AF_UNIX datagram sockets, for running hosts as
+ * ordinary processes without root or mininet. Each host binds one socket at
+ * <dir>/wire-<mip_address>, and has one interface per peer, named by the
+ * peer's MIP address. A frame sent on an interface is a datagram to the
+ * socket of the peer. The MAC address of the interface from host a to host b
+ * is 02:00:00:00:a:b.
+ *
+ * The wire is described by "<dir>:<peer>[,<peer>...][:<delay_us>:<loss>:<kbit>]",
+ * e.g. "/tmp/wire:20,30" or "/tmp/wire:20,30:2000:5:1000". Outgoing frames
+ * are held back delay_us microseconds plus the time they take at kbit kbit/s
+ * on their interface, and loss percent of them are dropped. 0 turns a
+ * parameter off. Only frames sent by this host are shaped, so a symmetric
+ * link is described the same way on both ends.
+ * @param spec          The wire.
+ * @param mip_address   MIP address of this host.
+ * @return              NULL if error, the new link otherwise.
+ * */
+mip_link *wire_create(const char *spec, uint8_t mip_address);
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef STRUCTS_H
 #define STRUCTS_H
 
+#include "mip_timer.h"
+
 #include <stddef.h>             /* size_t */
 #include <stdint.h>             /* uint8_t */
 #include <sys/types.h>
@@ -60,29 +62,125 @@ typedef struct mip_arp_sdu {
  * Structure for storing MIP ARP entries.
  * 
  * @param mip_address   MIP address of the node.
+ * @param state         ARP_* reachability state, ARP_NONE if the entry is
+ *                      not in use.
+ * @param confirmed     Set if traffic from the node arrived since the entry
+ *                      was last made reachable.
+ * @param probes        Unicast probes sent since the entry went stale.
  * @param dest_mac_addr MAC address of the node.
  * @param interface     MAC address of the network interface we reach the node on.  
  *                      Is NULL if the MIP address is of a local address.
+ * @param ifindex       Index of the network interface we reach the node on.
+ * @param timer         Moves the entry on to its next state.
  * */
 typedef struct arp_entry {
-    uint8_t mip_address;
-    uint8_t dest_mac_addr[MAC_ADDR_LEN];
-    uint8_t interface[MAC_ADDR_LEN];
-    int     ifindex;
+    uint8_t             mip_address;
+    uint8_t             state;
+    uint8_t             confirmed;
+    uint8_t             probes;
+    uint8_t             dest_mac_addr[MAC_ADDR_LEN];
+    uint8_t             interface[MAC_ADDR_LEN];
+    int                 ifindex;
+    struct mip_timer    timer;
 } arp_entry;
 
+#define ARP_TABLE_SIZE      256         /* one slot per MIP address */
+#define ARP_IFINDEX_SIZE    256         /* interface indexes looked up directly */
+
+/**
+ * Resolution in progress for a MIP address with no ARP entry.
+ * @param retries       Requests sent after the first one.
+ * @param timer         Retransmits the request, pending while a request is
+ *                      outstanding.
+ * */
+struct arp_resolve {
+    uint8_t             retries;
+    struct mip_timer    timer;
+};
+
+struct network_interfaces;
+
+/**
+ * Called when the MAC address of a neighbour was, or could not be, resolved.
+ * @param arg           The argument set up in the ARP table.
+ * @param mip_address   The neighbour.
+ * @return              -1 if error, 0 otherwise.
+ * */
+typedef int (*arp_notify_fn)(void *arg, uint8_t mip_address);
+
+/**
+ * The ARP cache. Neighbours are stored in the slot of their MIP address, so
+ * a lookup is a single index. The addresses of this host are stored once per
+ * interface, apart from the neighbours. Every entry and resolution carries
+ * its own timer on the timer base of the host.
+ * 
+ * @param mip_address   MIP address of this host.
+ * @param local_count   Number of local interfaces in local.
+ * @param by_ifindex    Slot in local + 1 of each interface index below
+ *                      ARP_IFINDEX_SIZE, 0 if none.
+ * @param ifs           The interfaces requests and probes are sent on.
+ * @param timers        The timer base of the host.
+ * @param resolved      Called when an outstanding resolution ends with an
+ *                      entry, NULL if none.
+ * @param resolved_arg  Passed to resolved.
+ * @param failure       Called when a resolution is given up on, NULL if none.
+ * @param failure_arg   Passed to failure.
+ * @param reachable_ms  How long an entry is trusted after it was confirmed.
+ * @param stale_ms      How long a stale entry is kept before it is probed.
+ * @param probe_ms      Time between two unicast probes.
+ * @param max_probes    Unanswered probes before the entry is evicted.
+ * @param unresolved    Number of addresses with a request outstanding.
+ * @param requests      Number of requests sent, retransmits included.
+ * @param probes        Number of unicast probes sent.
+ * @param failures      Number of addresses given up on.
+ * @param learned       Number of entries made or replaced from frames that
+ *                      were not ARP responses.
+ * @param evictions     Number of entries evicted after unanswered probes.
+ * @param local         This host's MIP address on each local interface.
+ * @param entries       Neighbours, indexed by MIP address.
+ * @param resolve       Resolution state of each MIP address.
+ * */
+typedef struct arp_table {
+    uint8_t                     mip_address;
+    int                         local_count;
+    uint8_t                     by_ifindex[ARP_IFINDEX_SIZE];
+    struct network_interfaces   *ifs;
+    struct timer_base           *timers;
+    arp_notify_fn               resolved;
+    void                        *resolved_arg;
+    arp_notify_fn               failure;
+    void                        *failure_arg;
+    uint32_t                    reachable_ms;
+    uint32_t                    stale_ms;
+    uint32_t                    probe_ms;
+    uint8_t                     max_probes;
+    int                         unresolved;
+    size_t                      requests;
+    size_t                      probes;
+    size_t                      failures;
+    size_t                      learned;
+    size_t                      evictions;
+    struct arp_entry            local[MAX_IFS];
+    struct arp_entry            entries[ARP_TABLE_SIZE];
+    struct arp_resolve          resolve[ARP_TABLE_SIZE];
+} arp_table;
+
+struct mip_link;
+
 /**
  * Structure for storing local network interfaces.
  * @param addr          An array of interfaces.
  * @param src_mip_addr  The source MIP address.
- * @param raw_socket    A raw socket for lower layers.
+ * @param raw_socket    The socket the link layer receives on.
  * @param ifs_size      Number of interfaces in addr.
+ * @param link          Batched frame I/O on the link layer backend.
 */
 typedef struct network_interfaces {
     struct sockaddr_ll  addr[MAX_IFS];
     uint8_t             src_mip_addr;
     int                 raw_socket;
     ssize_t             ifs_size;
+    struct mip_link     *link;
 } ifs;
 
 #endif
\ No newline at end of file
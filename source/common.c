@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -58,7 +59,8 @@ int prepare_unix_socket(char *socket_name)
 
     unlink(socket_name); /* just for insurance */
 
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &true, sizeof true) == -1)
+    /* newer kernels do not support SO_REUSEPORT on unix sockets, which is harmless */
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &true, sizeof true) == -1 && errno != EOPNOTSUPP)
     {
         perror("setsockopt");
         close(server_fd);
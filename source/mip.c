@@ -4,11 +4,15 @@
 #include "../headers/mip_arp.h"
 #include "../headers/mip_debug.h"
 #include "../headers/utils.h"
+#include "../headers/common.h"
+#include "../headers/mip_link.h"
 
 #include <string.h>             /* memcpy */
 #include <stdio.h>              /* perror */
 #include <stdlib.h>
+#include <stddef.h>             /* offsetof */
 #include <unistd.h>
+#include <errno.h>
 
 #include <sys/types.h>          /* getifaddrs, freeifaddrs */
 #include <ifaddrs.h>            /* getifaddrs, freeifaddrs */
@@ -18,18 +22,27 @@
 #include <sys/un.h>
 #include <sys/socket.h>
 
+/**
+ * Number of bytes a frame must carry after its headers to hold its SDU. The
+ * sdu_len of a ping counts only the payload, behind its dest and ttl bytes,
+ * and an ARP SDU is always read whole.
+ * */
+static size_t mip_sdu_size(const mip_pdu *pdu)
+{
+    if (pdu -> sdu_type == MIP_PING)    return (size_t) pdu -> sdu_len + 2;
+    if (pdu -> sdu_type == MIP_ARP)     return sizeof(struct mip_arp_sdu);
+    return pdu -> sdu_len;
+}
+
 int mip_broadcast(const struct network_interfaces *ifs, const uint8_t src, const uint8_t sdu_type, 
     void* sdu, const size_t sdu_len)
 {
-    int                 wc, i, iovlen = 3;
-    struct msghdr       *msg;
-    struct iovec        msgvec[iovlen];
+    int                 i;
     struct mip_pdu      mip_pdu = {0};
     struct frame_header frame_header = {0};
     struct sockaddr_ll  so_name = {0};
     uint8_t broadcast_addr[] = BROADCAST_ADDR;
         
-    memcpy(frame_header.src, ifs -> addr[0].sll_addr, MAC_ADDR_LEN);
     memcpy(frame_header.dest, broadcast_addr, MAC_ADDR_LEN);
     frame_header.eth_proto[0] = 0x88;
     frame_header.eth_proto[1] = 0xB5;
@@ -40,38 +53,21 @@ int mip_broadcast(const struct network_interfaces *ifs, const uint8_t src, const
     mip_pdu.sdu_len         = sdu_len;
     mip_pdu.sdu_type        = sdu_type;
 
-    msgvec[0].iov_base      = &frame_header;
-    msgvec[0].iov_len       = sizeof(struct frame_header);
-    msgvec[1].iov_base      = &mip_pdu;
-    msgvec[1].iov_len       = sizeof(struct mip_pdu);
-    msgvec[2].iov_base      = sdu;
-    msgvec[2].iov_len       = sdu_len;
-
-    msg = allocate_memory(sizeof(struct msghdr));
-    if (msg == NULL)
-        return -1;
-
-    msg -> msg_namelen  = sizeof(struct sockaddr_ll);
-    msg -> msg_iovlen   = iovlen;
-    msg -> msg_iov      = msgvec;
-
+    /* one frame per interface, all sent in the same batch */
     for (i = 0; i < ifs -> ifs_size; i++)
     {
         memcpy(&so_name, &(ifs -> addr[i]), sizeof(struct sockaddr_ll));    /* our interfaces */
+        memcpy(frame_header.src, ifs -> addr[i].sll_addr, MAC_ADDR_LEN);    /* neighbours learn the MAC of this one */
         memcpy(&(so_name.sll_addr), broadcast_addr, MAC_ADDR_LEN);          /* broadcast */
-        msg -> msg_name     = &so_name;
 
-        wc = sendmsg(ifs -> raw_socket, msg, 0);
-        if (wc <= 0)
+        if (link_queue_frame(ifs -> link, &so_name, &frame_header, &mip_pdu, sdu, sdu_len) == -1)
         {
             fprintf(stderr, "%s\n", __FUNCTION__);
-            perror("sendmsg");
-            return wc;
+            return -1;
         }
     }
 
-    free(msg);
-    return wc;
+    return LINK_HEADER_SIZE + sdu_len;
 }
 
 int mip_connect_unix_socket(char *socket_name, char entity)
@@ -109,14 +105,14 @@ int mip_connect_unix_socket(char *socket_name, char entity)
     return sockfd;
 }
 
-int mip_app_recv(int socket, mip_sdu *dest_sdu)
+int mip_app_recv(int socket, char *buf)
 {
     int rc;
-    char buf[MAX_MSG_SIZE];
 
-    rc = read(socket, buf, MAX_MSG_SIZE);
+    rc = recv(socket, buf, MAX_MSG_SIZE, MSG_DONTWAIT);
 	if (rc == -1)
     {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return RECV_AGAIN;
         fprintf(stderr, "%s() ", __FUNCTION__);
         perror("read");
         return -1;
@@ -128,26 +124,32 @@ int mip_app_recv(int socket, mip_sdu *dest_sdu)
         return -2; // should be some signal code
     }
 
-    dest_sdu -> payload = allocate_memory(rc);
-    if (dest_sdu == NULL)
+    /* must at least hold the destination and ttl */
+    if (rc < 2)
     {
-        free(dest_sdu);
-        return -1;
+        fprintf(stderr, "<daemon>: %s() dropping SDU of %d bytes\n", __FUNCTION__, rc);
+        return 0;
     }
-    mip_deserialize_sdu(buf, dest_sdu, rc);
 
     return rc;
 }
 
-int mip_app_send(int socket, mip_sdu *sdu)
+int mip_app_send(int socket, uint8_t src, uint8_t ttl, char *payload, size_t len)
 {
     int wc;
-    size_t bufsize = strlen(sdu->payload) + 2;
-    char buf[bufsize];
-
-    mip_serialize_sdu(buf, sdu);
-
-    wc = write(socket, buf, bufsize);
+    uint8_t header[2] = {src, ttl};
+    struct iovec iov[2];
+    struct msghdr msg = {0};
+
+    /* written as one record, without first copying the payload */
+    iov[0].iov_base = header;
+    iov[0].iov_len  = sizeof(header);
+    iov[1].iov_base = payload;
+    iov[1].iov_len  = len;
+    msg.msg_iov     = iov;
+    msg.msg_iovlen  = 2;
+
+    wc = sendmsg(socket, &msg, 0);
     if (wc <= 0)
     {
         fprintf(stderr, "%s() ", __FUNCTION__);
@@ -158,17 +160,15 @@ int mip_app_send(int socket, mip_sdu *sdu)
     return wc;
 }
 
-int mip_routing_recv(int socket, char* buf)
+int mip_routing_recv(int socket, char* buf, struct ctrl_msg *msg)
 {
     int rc;
-    char type[4];
-    type[3] = '\0';
 
-    rc = read(socket, buf, MAX_RT_PKT_SIZE);
-    memcpy(type, buf + 2, 3);
+    rc = recv(socket, buf, MAX_RT_PKT_SIZE, MSG_DONTWAIT);
 
     if (rc == -1)
     {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return RECV_AGAIN;
         fprintf(stderr, "%s() ", __FUNCTION__);
         perror("read");
         return -1;
@@ -180,120 +180,124 @@ int mip_routing_recv(int socket, char* buf)
         return -2;
     }
 
-    /* else the packet is to be forwarded as a broadcast. Only returning the buffer */
-    else if (!strncmp(type, HELLO, 3)) return 1;
-
-    /* else the packet is to be forwarded as a broadcast. Only returning the buffer */
-    else if (!strncmp(type, UPDATE, 3)) return 2;
-
-    /* only read packet if it is a lookup packet */
-    else if (!strncmp(type, RESPONSEPKT, 3)) return 3;
+    /* a message cut short, or of another version, is not handled */
+    if (ctrl_parse(buf, rc, msg) == -1)
+    {
+        fprintf(stderr, "<daemon>: dropped malformed routing message of %d bytes\n", rc);
+        return 1;
+    }
 
-    fprintf(stderr, "[WARNING]: undefined behaviour in %s at line %d\n", __FUNCTION__, __LINE__);
     return 0;
 }
 
-int mip_link_send(arp_entry **arp_table, ifs *ifs, mip_pdu *pdu,
+int mip_link_send(arp_table *arp_table, ifs *ifs, mip_pdu *pdu,
     char *sdu, size_t len, int debug)
 {
-    int                 wc, iovlen = 3;
-    struct arp_entry    arp_entry;
-    struct msghdr       *msg;
-    struct iovec        msgvec[iovlen];
+    struct arp_entry    *arp_entry;
     struct sockaddr_ll  so_name = {0};
     frame_header        frame_header = {0};
     
     /* if mac address is unknown */
-    if (get_arp_entry_by_mip_address(arp_table, &arp_entry, pdu->dest) == 1)
+    arp_entry = get_arp_entry_by_mip_address(arp_table, pdu->dest);
+    if (arp_entry == NULL)
     {
-        if (send_arp_request(ifs, pdu->dest, pdu->src) == -1)
+        if (arp_resolve(arp_table, pdu->dest) == -1)
             return -1;
 
         /* we must wait until mac address of destination is known */
         return 1;
     }
 
-    get_arp_entry_by_mip_address(arp_table, &arp_entry, pdu->dest);
-    memcpy(frame_header.dest, &arp_entry.dest_mac_addr, MAC_ADDR_LEN);
-    memcpy(frame_header.src, &arp_entry.interface, MAC_ADDR_LEN);
+    /* a stale entry is still used, while a probe confirms it */
+    if (arp_use(arp_table, arp_entry) == -1)
+        return -1;
+
+    memcpy(frame_header.dest, arp_entry->dest_mac_addr, MAC_ADDR_LEN);
+    memcpy(frame_header.src, arp_entry->interface, MAC_ADDR_LEN);
     frame_header.eth_proto[0] = 0x88; /* bit shift MIP_P_ETH instead? */
     frame_header.eth_proto[1] = 0xB5; /* bit shift MIP_P_ETH instead? */
 
-    // point to frame header
-    msgvec[0].iov_base = &frame_header;
-    msgvec[0].iov_len = sizeof(frame_header);
+    get_interface_on_ifindex(ifs, &so_name, arp_entry->ifindex);
 
-    // point to pdu header
-    msgvec[1].iov_base = pdu;
-    msgvec[1].iov_len = sizeof(mip_pdu);
+    /* the frame is sent when the link is flushed */
+    if (link_queue_frame(ifs -> link, &so_name, &frame_header, pdu, sdu, len) == -1)
+    {
+        fprintf(stderr, "%s\n", __FUNCTION__);
+        return -1;
+    }
 
-    // point to pdu payload
-    msgvec[2].iov_base = sdu;
-    msgvec[2].iov_len = len;
+    if (debug) 
+    {
+        mip_debug(arp_table, frame_header.src, frame_header.dest,
+            pdu->src, pdu->dest);
+    }  
 
-    msg = allocate_memory(sizeof(struct msghdr));
-    if (msg == NULL)
+    return 0;
+}
+
+int mip_link_forward(arp_table *arp_table, ifs *ifs, mip_pdu *pdu, char *sdu, int debug)
+{
+    struct arp_entry    *arp_entry;
+    struct sockaddr_ll  so_name = {0};
+    struct link_frame   *frame;
+
+    /* the slow path asks for an unknown MAC address, and holds the packet meanwhile */
+    arp_entry = get_arp_entry_by_mip_address(arp_table, pdu->dest);
+    if (arp_entry == NULL) return 1;
+
+    if (arp_use(arp_table, arp_entry) == -1)
         return -1;
 
-    get_interface_on_ifindex(ifs, &so_name, arp_entry.ifindex);
+    /* only the headers change, the payload is left where it was received */
+    frame = (struct link_frame*) (sdu - offsetof(struct link_frame, sdu));
+    memcpy(frame->hdr.dest, arp_entry->dest_mac_addr, MAC_ADDR_LEN);
+    memcpy(frame->hdr.src, arp_entry->interface, MAC_ADDR_LEN);
+    memcpy(&frame->pdu, pdu, sizeof(struct mip_pdu));
+    sdu[1] = pdu->ttl;
 
-    msg->msg_name     = &so_name;
-    msg->msg_namelen  = sizeof(struct sockaddr_ll);
-    msg->msg_iovlen   = iovlen;
-    msg->msg_iov      = msgvec;
+    get_interface_on_ifindex(ifs, &so_name, arp_entry->ifindex);
 
-    wc = sendmsg(ifs -> raw_socket, msg, 0);
-    if (wc == -1)
+    /* mip_link_recv() dropped the frame unless it holds this many bytes, so */
+    /* nothing past its end or left over from an earlier frame is sent */
+    if (link_forward_frame(ifs -> link, &so_name, frame, mip_sdu_size(pdu)) == -1)
     {
         fprintf(stderr, "%s\n", __FUNCTION__);
-        perror("sendmsg");
-        free(msg);
         return -1;
     }
 
-    if (debug) 
+    if (debug)
     {
-        mip_debug(arp_table, frame_header.src, frame_header.dest,
-            pdu->src, pdu->dest);
-    }  
+        mip_debug(arp_table, frame->hdr.src, frame->hdr.dest, pdu->src, pdu->dest);
+    }
 
-    free(msg);
     return 0;
 }
 
-int mip_link_recv(arp_entry **arp_table, ifs *ifs, mip_pdu *pdu, 
-    char *buf, uint8_t *arp_addr, int debug)
+int mip_link_recv(arp_table *arp_table, ifs *ifs, mip_pdu *pdu, 
+    char **sdu_ptr, uint8_t *arp_addr, int debug)
 {
-    int                 rc, wc, iovlen = 3;
-    struct sockaddr_ll  so_name, sock_if;
-    struct msghdr       msg;
-    struct iovec        msgvec[iovlen];
+    int                 rc, wc;
+    char                *buf;
+    struct sockaddr_ll  *so_name, sock_if;
+    struct link_frame   *frame;
     struct frame_header frame_header;
-    struct arp_entry    entry_ptr;
+    struct arp_entry    *entry_ptr;
     struct mip_arp_sdu  mip_arp_sdu;
     struct mip_sdu      sdu;
 
-    msgvec[0].iov_base  = &frame_header; 
-    msgvec[0].iov_len   = sizeof(frame_header);
-    msgvec[1].iov_base  = pdu;
-    msgvec[1].iov_len   = sizeof(mip_pdu);
-    msgvec[2].iov_base  = buf;
-    msgvec[2].iov_len   = MAX_MSG_SIZE;
-
-    msg.msg_name        = &so_name;
-	msg.msg_namelen     = sizeof(struct sockaddr_ll);
-	msg.msg_iovlen      = iovlen;
-	msg.msg_iov         = msgvec;
-    msg.msg_control     = 0;
-    msg.msg_controllen  = 0;
-    msg.msg_flags       = 0;
-
-    rc = recvmsg(ifs -> raw_socket, &msg, 0);
-    if (rc <= 0)
+    /* frames are read from the raw socket a batch at a time */
+    rc = link_next_frame(ifs -> link, &frame, &so_name);
+    if (rc == -1 || rc == RECV_AGAIN) return rc;
+    if (rc < (int) LINK_HEADER_SIZE || mip_sdu_size(&frame -> pdu) > rc - LINK_HEADER_SIZE)
     {
-        perror("recvmsg");
-        return -1;
+        fprintf(stderr, "<daemon>: %s() dropping runt frame of %d bytes\n", __FUNCTION__, rc);
+        return 4;
     }
+
+    /* the SDU is parsed where it was received, only the headers are copied */
+    memcpy(&frame_header, &frame -> hdr, sizeof(struct frame_header));
+    memcpy(pdu, &frame -> pdu, sizeof(struct mip_pdu));
+    buf = *sdu_ptr = frame -> sdu;
     
     /* prints for both mip and arp communication */
     if (debug) 
@@ -302,10 +306,23 @@ int mip_link_recv(arp_entry **arp_table, ifs *ifs, mip_pdu *pdu,
             pdu->src, pdu->dest);
     }  
 
+    get_interface_on_ifindex(ifs, &sock_if, so_name->sll_ifindex); /* get receiving interface */
+
+    /* ARP and routing frames are never forwarded, so they come from the neighbour */
+    /* that sent them and teach us its MAC address, HELLOs in particular */
+    if (pdu -> sdu_type == MIP_ARP || pdu -> sdu_type == MIP_ROUTING)
+        rc = arp_learn(arp_table, pdu -> src, frame_header.src, 
+            sock_if.sll_addr, so_name -> sll_ifindex);
+
+    /* a forwarded frame only shows an entry is still right if it came from it */
+    else
+        rc = arp_confirm(arp_table, pdu -> src, frame_header.src, so_name -> sll_ifindex);
+
+    if (rc == -1) return -1;
+
     if (pdu -> sdu_type == MIP_ARP)
     {
         memcpy((char*) &mip_arp_sdu, buf, sizeof(struct mip_arp_sdu)); /* deserialize arp packet */
-        get_interface_on_ifindex(ifs, &sock_if, so_name.sll_ifindex); /* get receiving interface */
 
         /* if the arp message is a response */
         if (mip_arp_sdu.type == ARP_RES)
@@ -315,11 +332,10 @@ int mip_link_recv(arp_entry **arp_table, ifs *ifs, mip_pdu *pdu,
                 printf("<daemon>: got ARP response from %d:\n", pdu->src);
                 mip_print_arp_packet(mip_arp_sdu);
             }
+            /* a response for the same address replaces the entry, it is never duplicated */
             if (add_entry(arp_table, mip_arp_sdu.address, frame_header.src, 
-                sock_if.sll_addr, so_name.sll_ifindex) == NULL)
-            {
+                sock_if.sll_addr, so_name->sll_ifindex) == NULL)
                 return -1;
-            }
 
             *arp_addr = mip_arp_sdu.address;
             return 3;
@@ -333,22 +349,15 @@ int mip_link_recv(arp_entry **arp_table, ifs *ifs, mip_pdu *pdu,
                 printf("<daemon>: got ARP request:\n");
                 mip_print_arp_packet(mip_arp_sdu);
             }
-            /* add source mip and mac to our arp table */
-            /* if we don't find a matching mac address, frame_header.src will not be overwritten */
-            if (get_arp_entry_by_mip_address(arp_table, &entry_ptr, pdu -> src))
-                if (add_entry(arp_table, pdu -> src, frame_header.src, 
-                    sock_if.sll_addr , so_name.sll_ifindex) == NULL)
-                {
-                    return -1;
-                }
-
+            /* the source was learned above, the response goes straight back to it */
             /* replace broadcast address with the source nodes address */
             memcpy(frame_header.dest, frame_header.src, MAC_ADDR_LEN);
 
-            /* if we have stored the requested mip address, store its mac in frame_header.src */
-            if (!get_arp_entry_by_mip_address(arp_table, &entry_ptr, mip_arp_sdu.address))
+            /* only the owner answers, with the MAC address of the interface the request came in on */
+            entry_ptr = get_arp_entry_by_sll_ifindex(arp_table, so_name->sll_ifindex);
+            if (mip_arp_sdu.address == arp_table -> mip_address && entry_ptr != NULL)
             {
-                memcpy(frame_header.src, &entry_ptr.dest_mac_addr, MAC_ADDR_LEN);
+                memcpy(frame_header.src, entry_ptr -> dest_mac_addr, MAC_ADDR_LEN);
                 wc = send_arp_response(ifs, arp_table, mip_arp_sdu, frame_header, pdu -> src);
                 if (wc == -1) return -1;
             }
@@ -369,7 +378,7 @@ int mip_link_recv(arp_entry **arp_table, ifs *ifs, mip_pdu *pdu,
             printf("<daemon>: got ping message from link layer\n");
         }
         mip_deserialize_sdu(buf, &sdu, 2);
-        if (sdu.dest == arp_table[0]->mip_address)
+        if (sdu.dest == arp_table -> mip_address)
         {
             
             if (debug) 
@@ -450,31 +459,20 @@ int get_interface_on_ifindex(ifs *ifs, struct sockaddr_ll *dest, int ifi)
     return 1;
 }
 
-int mip_send_routing_lookup_request(int socket, uint8_t src, uint8_t dest, int debug)
+int mip_send_routing_lookup_request(const struct ctrl_out *out, uint8_t src, uint16_t id,
+    const uint8_t *dests, int count, int debug)
 {
-    int wc;
+    char buf[REQ_SIZE + MAX_LOOKUP_ENTRIES] = {0};
+    if (count > MAX_LOOKUP_ENTRIES) count = MAX_LOOKUP_ENTRIES;
 
-    char buf[REQ_SIZE] = {0};
-    buf[0] = src;
-    buf[1] = 0;
-    buf[2] = 'R';
-    buf[3] = 'E';
-    buf[4] = 'Q';
-    buf[5] = dest;
+    ctrl_header(buf, src, CTRL_REQUEST, REQ_SIZE + count, id);
+    memcpy(buf + REQ_SIZE, dests, count);
 
     if (debug) 
     {
-        printf("<daemon>: sending routing lookup request:\n");
-    }
-    wc = write(socket, buf, REQ_SIZE);
-    if (wc == -1)
-    {
-        fprintf(stderr, "%s() ", __FUNCTION__);
-        perror("write");
-        return -1;
+        printf("<daemon>: sending routing lookup request %d for %d destinations\n", id, count);
     }
-
-    return 0;
+    return ctrl_send(out, buf, REQ_SIZE + count);
 }
 
 void mip_serialize_sdu(char* dest, mip_sdu *src) 
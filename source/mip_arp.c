@@ -1,5 +1,6 @@
 #include "../headers/mip.h"
 #include "../headers/mip_arp.h"
+#include "../headers/mip_link.h"
 #include "../headers/mip_debug.h"
 #include "../headers/utils.h"
 #include "../headers/queue.h"
@@ -15,114 +16,305 @@
 #include <linux/if_packet.h>    /* sockaddr_ll */
 #include <net/ethernet.h>       /* sockaddr_ll */
 
-arp_entry* add_entry(arp_entry **entries, uint8_t mip_address, 
-    uint8_t mac_addr[], uint8_t interface[], int ifi)
+static int resolve_expired(struct mip_timer *t, void *arg);
+static int entry_expired(struct mip_timer *t, void *arg);
+
+arp_table *arp_table_create(uint8_t mip_address, ifs *ifs, timer_base *timers)
 {
-    arp_entry *new_entry;
-    uint8_t local[] = LOCAL;
+    arp_table *table;
     int i;
 
-    new_entry = allocate_memory(sizeof(struct arp_entry));
-    if (new_entry == NULL)
+    table = allocate_memory(sizeof(struct arp_table));
+    if (table == NULL)
         return NULL;
 
-    new_entry -> mip_address = mip_address;
-    memcpy(new_entry -> dest_mac_addr, mac_addr, MAC_ADDR_LEN);
+    table -> mip_address = mip_address;
+    table -> ifs = ifs;
+    table -> timers = timers;
+    table -> reachable_ms = ARP_REACHABLE_MS;
+    table -> stale_ms = ARP_STALE_MS;
+    table -> probe_ms = ARP_PROBE_MS;
+    table -> max_probes = ARP_MAX_PROBES;
+
+    for (i = 0; i < ARP_TABLE_SIZE; i++)
+    {
+        timer_init(&table -> entries[i].timer, entry_expired, table);
+        timer_init(&table -> resolve[i].timer, resolve_expired, table);
+    }
 
-    /* copying only if the mac address is not local */
-    if (interface != local)
-        memcpy(new_entry -> interface, interface, MAC_ADDR_LEN);
+    return table;
+}
 
-    new_entry -> ifindex = ifi;
+arp_entry *add_local_entry(arp_table *table, uint8_t mac_addr[], int ifi)
+{
+    arp_entry *e;
 
-    for (i = 0; i < MAX_TABLE_SIZE; i++)
+    if (table -> local_count == MAX_IFS)
     {
-        if (entries[i] == NULL)
-        {
-            entries[i] = new_entry;
-            return new_entry;
-        }
+        fprintf(stderr, "<daemon>: more than %d local interfaces\n", MAX_IFS);
+        return NULL;
     }
 
-    fprintf(stderr, "arp table is full");
-    return NULL;
+    e = &table -> local[table -> local_count];
+    e -> mip_address = table -> mip_address;
+    e -> state = ARP_PERMANENT;
+    memcpy(e -> dest_mac_addr, mac_addr, MAC_ADDR_LEN);
+    e -> ifindex = ifi;
+
+    /* interfaces with a larger index are found by a scan of the local entries */
+    if (in_range(ifi, 0, ARP_IFINDEX_SIZE))
+        table -> by_ifindex[ifi] = table -> local_count + 1;
+
+    table -> local_count++;
+    return e;
 }
 
-int get_arp_entry_by_mip_address(arp_entry **entries, struct arp_entry *dest, uint8_t mip_address)
+/* makes an entry reachable for another reachable_ms */
+static int entry_reachable(arp_table *table, arp_entry *e)
 {
-    int i;
-    for (i = 0; i < MAX_TABLE_SIZE && entries[i]; i++)
+    e -> state = ARP_REACHABLE;
+    e -> confirmed = 0;
+    e -> probes = 0;
+    return timer_add(table -> timers, &e -> timer, table -> reachable_ms);
+}
+
+arp_entry *add_entry(arp_table *table, uint8_t mip_address, 
+    uint8_t mac_addr[], uint8_t interface[], int ifi)
+{
+    arp_entry *e = &table -> entries[mip_address];
+    struct arp_resolve *r = &table -> resolve[mip_address];
+
+    e -> mip_address = mip_address;
+    memcpy(e -> dest_mac_addr, mac_addr, MAC_ADDR_LEN);
+    memcpy(e -> interface, interface, MAC_ADDR_LEN);
+    e -> ifindex = ifi;
+
+    if (entry_reachable(table, e) == -1)
+        return NULL;
+
+    /* the packets waiting on the resolution can be sent now */
+    if (timer_pending(&r -> timer))
     {
-        if (entries[i] -> mip_address == mip_address)
-        {
-            memcpy(dest, entries[i], sizeof(struct arp_entry));
-            return 0;
-        }
+        timer_cancel(table -> timers, &r -> timer);
+        table -> unresolved--;
+        if (table -> resolved && table -> resolved(table -> resolved_arg, mip_address) == -1)
+            return NULL;
     }
 
-    return 1;
+    return e;
 }
 
-int get_arp_entry_by_sll_ifindex(arp_entry **entries, struct arp_entry *dest, int ifi)
+/* entries that are evicted or were never resolved are not used */
+static int entry_usable(const arp_entry *e)
+{
+    return e -> state == ARP_REACHABLE || e -> state == ARP_STALE 
+        || e -> state == ARP_PROBE;
+}
+
+arp_entry *get_arp_entry_by_mip_address(arp_table *table, uint8_t mip_address)
+{
+    arp_entry *e = &table -> entries[mip_address];
+    return entry_usable(e) ? e : NULL;
+}
+
+arp_entry *get_arp_entry_by_sll_ifindex(arp_table *table, int ifi)
 {
     int i;
-    for (i = 0; i < MAX_TABLE_SIZE && entries[i]; i++)
+
+    if (in_range(ifi, 0, ARP_IFINDEX_SIZE))
+    {
+        i = table -> by_ifindex[ifi];
+        return i ? &table -> local[i - 1] : NULL;
+    }
+
+    for (i = 0; i < table -> local_count; i++)
     {       
-        if (entries[i] -> ifindex == ifi)
-        {
-            memcpy(dest, entries[i], sizeof(arp_entry));
-            return 0;
-        }
+        if (table -> local[i].ifindex == ifi) return &table -> local[i];
     }
     
-    return 1;
+    return NULL;
 }
             
-int remove_entry(arp_entry **entries, arp_entry *entry)
+int remove_entry(arp_table *table, uint8_t mip_address)
+{
+    arp_entry *e = &table -> entries[mip_address];
+
+    if (!entry_usable(e))
+    {
+        fprintf(stderr, "<daemon>: entry is not in table...");
+        return -1;
+    }
+
+    timer_cancel(table -> timers, &e -> timer);
+    e -> state = ARP_NONE;
+    return 0;
+}
+
+void free_arp_table(arp_table *table)
 {
     int i;
-    arp_entry *e = NULL;
-    for (i = 0; i < MAX_TABLE_SIZE && entries[i]; i++)
+
+    /* the timers live in the table, the timer base must not keep them */
+    for (i = 0; i < ARP_TABLE_SIZE; i++)
     {
-        if (entries[i] == NULL) return 1;
-
-        if (entries[i] == entry)
-        {
-            e = entries[i];
-
-            /* swapping latter entries forward */
-            while (entries[i] != NULL)
-            {
-                entries[i] = entries[i + 1];
-                i++;
-            }
-            break;
-        }
+        timer_cancel(table -> timers, &table -> entries[i].timer);
+        timer_cancel(table -> timers, &table -> resolve[i].timer);
     }
 
-    if (e == NULL)
+    free(table);
+}
+
+int arp_resolve(arp_table *table, uint8_t mip_address)
+{
+    struct arp_resolve *r = &table -> resolve[mip_address];
+
+    /* every packet to this address waits on the same request */
+    if (timer_pending(&r -> timer)) return 0;
+
+    if (send_arp_request(table -> ifs, mip_address, table -> mip_address) == -1)
+        return -1;
+
+    r -> retries = 0;
+    if (timer_add(table -> timers, &r -> timer, ARP_RETRY_MS) == -1)
+        return -1;
+
+    table -> unresolved++;
+    table -> requests++;
+    return 1;
+}
+
+static int resolve_expired(struct mip_timer *t, void *arg)
+{
+    arp_table *table = arg;
+    struct arp_resolve *r = timer_container(t, struct arp_resolve, timer);
+    uint8_t mip_address = r - table -> resolve;
+
+    if (r -> retries == ARP_MAX_RETRIES)
     {
-        fprintf(stderr, "<daemon>: entry is not in table...");
+        table -> unresolved--;
+        table -> failures++;
+        return table -> failure ? table -> failure(table -> failure_arg, mip_address) : 0;
+    }
+
+    if (send_arp_request(table -> ifs, mip_address, table -> mip_address) == -1)
+        return -1;
+
+    r -> retries++;
+    table -> requests++;
+    return timer_add(table -> timers, t, (uint64_t) ARP_RETRY_MS << r -> retries);
+}
+
+/* asks the neighbour of a stale entry directly, at the MAC address we have */
+static int send_arp_probe(arp_table *table, arp_entry *e)
+{
+    struct mip_arp_sdu  mip_arp_sdu = {0};
+    struct mip_pdu      mip_pdu = {0};
+    struct sockaddr_ll  so_name = {0};
+    frame_header        frame_header = {0};
+
+    mip_arp_sdu.type = ARP_REQ;
+    mip_arp_sdu.address = e -> mip_address;
+
+    memcpy(frame_header.dest, e -> dest_mac_addr, MAC_ADDR_LEN);
+    memcpy(frame_header.src, e -> interface, MAC_ADDR_LEN);
+    frame_header.eth_proto[0] = 0x88;
+    frame_header.eth_proto[1] = 0xB5;
+
+    mip_pdu.dest = e -> mip_address;
+    mip_pdu.src = table -> mip_address;
+    mip_pdu.ttl = DEFAULT_TTL;
+    mip_pdu.sdu_len = sizeof(struct mip_arp_sdu);
+    mip_pdu.sdu_type = MIP_ARP;
+
+    get_interface_on_ifindex(table -> ifs, &so_name, e -> ifindex);
+
+    if (link_queue_frame(table -> ifs -> link, &so_name, &frame_header, &mip_pdu,
+        &mip_arp_sdu, sizeof(struct mip_arp_sdu)) == -1)
+    {
+        fprintf(stderr, "%s\n", __FUNCTION__);
         return -1;
     }
 
-    free(e);
+    e -> probes++;
+    table -> probes++;
+    return timer_add(table -> timers, &e -> timer, table -> probe_ms);
+}
+
+static int entry_expired(struct mip_timer *t, void *arg)
+{
+    arp_table *table = arg;
+    arp_entry *e = timer_container(t, struct arp_entry, timer);
+
+    switch (e -> state)
+    {
+        case ARP_REACHABLE:
+            /* traffic from the neighbour kept it reachable */
+            if (e -> confirmed) return entry_reachable(table, e);
+
+            e -> state = ARP_STALE;
+            return timer_add(table -> timers, t, table -> stale_ms);
+
+        case ARP_STALE:
+            e -> state = ARP_PROBE;
+            return send_arp_probe(table, e);
+
+        case ARP_PROBE:
+            if (e -> probes < table -> max_probes) return send_arp_probe(table, e);
+
+            e -> state = ARP_FAILED;
+            table -> evictions++;
+            return 0;
+    }
+
     return 0;
 }
 
-void free_arp_table(arp_entry **entries)
+int arp_confirm(arp_table *table, uint8_t mip_address, uint8_t mac_addr[], int ifi)
 {
-    int i;
-    for (i = 0; i < MAX_TABLE_SIZE; i++)
+    arp_entry *e = &table -> entries[mip_address];
+
+    if (!entry_usable(e) || e -> ifindex != ifi 
+        || memcmp(e -> dest_mac_addr, mac_addr, MAC_ADDR_LEN) != 0)
+        return 0;
+
+    /* a reachable entry is only marked, its timer is not moved for every frame */
+    if (e -> state == ARP_REACHABLE)
     {
-        if (entries[i] == NULL)
-        {
-            free(entries);
-            return;
-        } 
-        free(entries[i]);
+        e -> confirmed = 1;
+        return 1;
     }
-    
+
+    return entry_reachable(table, e) == -1 ? -1 : 1;
+}
+
+int arp_learn(arp_table *table, uint8_t mip_address, uint8_t mac_addr[], 
+    uint8_t interface[], int ifi)
+{
+    arp_entry *e = &table -> entries[mip_address];
+    int rc;
+
+    if (mip_address == table -> mip_address || mip_address == MAX_MIP_ADDR) return 0;
+
+    rc = arp_confirm(table, mip_address, mac_addr, ifi);
+    if (rc != 0) return rc == -1 ? -1 : 0;
+
+    /* a reachable entry is only replaced once it is no longer confirmed, so */
+    /* a neighbour on two links does not make it flap between them */
+    if (e -> state == ARP_REACHABLE) return 0;
+
+    if (add_entry(table, mip_address, mac_addr, interface, ifi) == NULL)
+        return -1;
+
+    table -> learned++;
+    return 1;
+}
+
+int arp_use(arp_table *table, arp_entry *e)
+{
+    if (e -> state != ARP_STALE) return 0;
+
+    e -> state = ARP_PROBE;
+    return send_arp_probe(table, e);
 }
 
 int send_arp_request(ifs *ifs, uint8_t req_addr, uint8_t src)
@@ -136,15 +328,12 @@ int send_arp_request(ifs *ifs, uint8_t req_addr, uint8_t src)
     return mip_broadcast(ifs, src, MIP_ARP, &mip_arp_sdu, sizeof(struct mip_arp_sdu));
 }
 
-int send_arp_response(ifs *ifs, arp_entry **entries, 
+int send_arp_response(ifs *ifs, arp_table *table, 
     mip_arp_sdu mip_arp_sdu, frame_header frame_header, uint8_t dest_mip_addr)
 {
-    size_t                      iovlen = 3;
-    struct msghdr               *msg;
-    struct iovec                msgvec[iovlen];
     struct mip_pdu              mip_pdu;
     struct sockaddr_ll          so_name = {0};
-    struct arp_entry            arp_entry;
+    struct arp_entry            *arp_entry;
 
     mip_arp_sdu.type = ARP_RES;
 
@@ -154,35 +343,16 @@ int send_arp_response(ifs *ifs, arp_entry **entries,
     mip_pdu.sdu_len = sizeof(struct mip_arp_sdu);
     mip_pdu.sdu_type = MIP_ARP;
 
-    msgvec[0].iov_base = &frame_header;
-    msgvec[0].iov_len = sizeof(struct frame_header);
-    msgvec[1].iov_base = &mip_pdu;
-    msgvec[1].iov_len = sizeof(struct mip_pdu);
-    msgvec[2].iov_base = &mip_arp_sdu;
-    msgvec[2].iov_len = sizeof(struct mip_arp_sdu);
-
-    msg = allocate_memory(sizeof(struct msghdr));
-    if (msg == NULL)
-        return -1;
-
-    get_arp_entry_by_mip_address(entries, &arp_entry, dest_mip_addr);
-    get_interface_on_ifindex(ifs, &so_name, arp_entry.ifindex);
+    arp_entry = get_arp_entry_by_mip_address(table, dest_mip_addr);
+    if (arp_entry == NULL) return 0;
+    get_interface_on_ifindex(ifs, &so_name, arp_entry -> ifindex);
     
-    msg -> msg_name     = &so_name;
-    msg -> msg_namelen  = sizeof(struct sockaddr_ll);
-    msg -> msg_iovlen   = iovlen;
-    msg -> msg_iov      = msgvec;
-
-    if (sendmsg(ifs -> raw_socket, msg, 0) <= 0)
+    if (link_queue_frame(ifs -> link, &so_name, &frame_header, &mip_pdu,
+        &mip_arp_sdu, sizeof(struct mip_arp_sdu)) == -1)
     {
         printf("%s\n", __FUNCTION__);
-        perror("sendmsg");
-        free(msg);
         return -1;
     }
 
-    free(msg);
     return 0;
 }
-
-
@@ -0,0 +1,98 @@
+#include "../headers/mip_ctrl.h"
+
+#include <stddef.h>           /* NULL */
+#include <stdio.h>            /* prints */
+#include <unistd.h>           /* write */
+
+/**
+ * What the body of an opcode may look like: at least min bytes, at most max,
+ * and a whole number of stride byte entries after the first min.
+ * */
+struct ctrl_layout {
+    const char              *name;
+    uint16_t                min;
+    uint16_t                max;
+    uint16_t                stride;
+};
+
+/* an opcode without a layout has a stride of 0, and is unknown */
+static const struct ctrl_layout ctrl_layouts[CTRL_OPCODES] = {
+    [CTRL_HELLO]                = { "HELLO",    4, 4, 1 },
+    [CTRL_UPDATE]               = { "UPDATE",   2, UINT16_MAX, 3 },
+    [CTRL_REQUEST]              = { "REQUEST",  1, UINT16_MAX, 1 },
+    [CTRL_RESPONSE]             = { "RESPONSE", 3, UINT16_MAX, 3 },
+    [CTRL_FIB]                  = { "FIB",      1, UINT16_MAX, 1 },
+    [CTRL_LSA]                  = { "LSA",      2, UINT16_MAX, 1 },
+    [CTRL_PROBE]                = { "PROBE",    4, 4, 1 },
+};
+
+void ctrl_header(char *buf, uint8_t addr, uint8_t opcode, uint16_t len, uint16_t seq)
+{
+    buf[0] = addr;
+    buf[1] = 0;
+    buf[2] = CTRL_VERSION;
+    buf[3] = opcode;
+    buf[4] = len >> 8;
+    buf[5] = len & 0xFF;
+    buf[6] = seq >> 8;
+    buf[7] = seq & 0xFF;
+}
+
+int ctrl_parse(const char *buf, size_t n, struct ctrl_msg *msg)
+{
+    const uint8_t *p = (const uint8_t*) buf;
+    const struct ctrl_layout *l;
+    size_t body;
+
+    if (n < CTRL_HDR_SIZE) return -1;
+
+    msg->addr       = p[0];
+    msg->opcode     = p[3];
+    msg->len        = p[4] << 8 | p[5];
+    msg->seq        = p[6] << 8 | p[7];
+    msg->body       = p + CTRL_HDR_SIZE;
+    msg->body_len   = body = (size_t) msg->len - CTRL_HDR_SIZE;
+
+    l = &ctrl_layouts[p[3] & (CTRL_OPCODES - 1)];
+    if (p[3] >= CTRL_OPCODES || l->stride == 0) return -1;
+
+    /* the other checks are folded into a single branch, a short length */
+    /* wraps body around and fails the bound on it */
+    if ((p[2] != CTRL_VERSION) | (msg->len != n) | (body < l->min) | (body > l->max)
+        | ((body - l->min) % l->stride != 0))
+        return -1;
+
+    return 0;
+}
+
+int ctrl_dispatch(const ctrl_handler *table, void *ctx, const struct ctrl_msg *msg)
+{
+    ctrl_handler fn = table[msg->opcode];
+
+    return fn == NULL ? 0 : fn(ctx, msg);
+}
+
+int ctrl_send(const struct ctrl_out *out, const char *buf, size_t len)
+{
+    struct ctrl_msg msg;
+
+    if (out->handlers == NULL)
+    {
+        if (write(out->fd, buf, len) == -1)
+        {
+            fprintf(stderr, "%s() ", __FUNCTION__);
+            perror("write");
+            return -1;
+        }
+        return 0;
+    }
+
+    if (ctrl_parse(buf, len, &msg) == -1) return 0;
+    return ctrl_dispatch(out->handlers, out->ctx, &msg);
+}
+
+const char *ctrl_name(uint8_t opcode)
+{
+    if (opcode >= CTRL_OPCODES || ctrl_layouts[opcode].name == NULL) return "UNKNOWN";
+    return ctrl_layouts[opcode].name;
+}
@@ -6,11 +6,18 @@
 #include "../headers/utils.h"
 #include "../headers/common.h"
 #include "../headers/queue.h"
+#include "../headers/mip_fib.h"
+#include "../headers/mip_pending.h"
+#include "../headers/mip_event.h"
+#include "../headers/mip_link.h"
+#include "../headers/mip_pool.h"
+#include "../headers/mip_wire.h"
 
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 
 #include <ifaddrs.h>
 #include <arpa/inet.h>
@@ -19,686 +26,1088 @@
 #include <sys/stat.h>
 #include <syslog.h>
 
-int main(int argc, char* argv[])
+static int handle_identifier(int fd, void *arg);
+static int handle_app(int fd, void *arg);
+static int handle_routing(int fd, void *arg);
+
+/**
+ * Sends a packet whose PDU destination is set to the next hop. If the MAC
+ * address of the next hop is unknown, the packet waits in the ARP slot of the
+ * next hop. Only the first packet in a slot fires off an ARP request.
+ * @param d         The daemon.
+ * @param e         The packet to send. Ownership is taken in all cases.
+ * @return          -1 if error, 0 if the packet was sent, 1 if it waits on ARP.
+ * */
+static int mip_send_or_wait(mip_daemon *d, struct pkt_buf *e)
 {
-    int HELP = 0;
-    int DEBUG = 0;
-    int socket_index = 1, addr_index = 2, c, rc, wc;
-    int upper_fd, lower_fd, epoll_fd, app_fd, routing_fd, tmp_fd;
-    char                        *unix_socket_name;
-    char                        entity_type_identifier;
-    char                        buf[MAX_MSG_SIZE];
-    uint8_t                     mip_address, addr_ptr;
-    uint8_t                     local[MAC_ADDR_LEN] = LOCAL;
-    struct mip_sdu              *sdu;
-    struct queue                *pkt_queue;
-    struct queue_entry          *qe;
-    struct pkt_buf_entry        *pkt_buf_entry;
-    struct mip_pdu              *pdu;
-    struct network_interfaces   *ifs;
-    struct arp_entry            **arp_table, *arp_entry;
-    struct epoll_event          events_struct = {0}, events[MAX_EVENTS] = {0};
+    int wc;
 
-    upper_fd = lower_fd = epoll_fd = app_fd = routing_fd = tmp_fd = -1;
+    /* an ARP request for this next hop is already out, wait behind it */
+    if (pending_arp_depth(d->pending, e->frame.pdu.dest))
+    {
+        pending_push_arp(d->pending, e);
+        return 1;
+    }
 
-    if (argc < 3 || argc > 5)
+    /* the buffer is already laid out as a frame, only the ttl of the SDU lags behind */
+    e->frame.sdu[1] = e->frame.pdu.ttl;
+    pool_handoff(e, POOL_OWNER_TX);
+
+    wc = mip_link_send(d->arp_table, d->ifs, &e->frame.pdu, e->frame.sdu,
+        e->frame.pdu.sdu_len + 2, d->debug);
+    if (wc == -1)
     {
-        printf("%s\n", "usage: ./mip_daemon [-h] [-d] <socket_upper> <mip_address>");
-        return EXIT_SUCCESS;
+        pool_put(d->pool, e);
+        return -1;
     }
 
-    while ((c = getopt(argc, argv, "hd")) != -1)
+    /* we sent arp request, caching packet until destination mac address is received */
+    if (wc == 1)
     {
-        switch (c)
+        pending_push_arp(d->pending, e);
+        return 1;
+    }
+
+    pool_put(d->pool, e);
+    return 0;
+}
+
+/**
+ * Sends every packet in a detached pending list to next_hop.
+ * @param d         The daemon.
+ * @param list      The packets to send.
+ * @param next_hop  The next hop to send to. Set to -1 to keep the next hop
+ *                  already stored in each PDU.
+ * @return          -1 if error, number of flushed packets otherwise.
+ * */
+static int mip_flush_pending(mip_daemon *d, struct pkt_buf *list, int next_hop)
+{
+    int n = 0;
+    struct pkt_buf *next;
+
+    while (list != NULL)
+    {
+        next = list->next;
+        if (next_hop != -1) list->frame.pdu.dest = next_hop;
+
+        if (mip_send_or_wait(d, list) == -1)
         {
-            case 'h':
-                HELP = 1;
-                break;
-            case 'd':
-                DEBUG = 1;
-                socket_index = 2;
-                addr_index = 3;
-                break;
-            default:
-                break;
+            pending_drop_list(d->pending, next);
+            return -1;
         }
+
+        list = next;
+        n++;
     }
 
-    if (HELP) {
-        printf("%s\n", "-h >> usage: ./mip_daemon [-h] [-d] <socket_upper> <mip_address>");
-        return EXIT_SUCCESS;
+    if (d->debug && n)
+    {
+        printf("<daemon>: flushed %d pending packets\n", n);
     }
 
-    /* get command line arguments */
-    unix_socket_name = argv[socket_index];
-    mip_address = atoi(argv[addr_index]);
+    return n;
+}
 
-    if (!in_range(mip_address, MIN_MIP_ADDR, MAX_MIP_ADDR))
+/**
+ * Hashes the flow a packet belongs to, for picking one of equal-cost next hops.
+ * */
+static uint32_t mip_pkt_flow(mip_daemon *d, struct pkt_buf *e)
+{
+    return mip_flow_hash(e->frame.pdu.src, e->frame.sdu[0], e->frame.pdu.sdu_type, d->mip_address);
+}
+
+/**
+ * Looks up the next hop of a flow, in the route table the routing daemon
+ * exports if there is one, and in the forwarding table it pushes otherwise.
+ * @param d         The daemon.
+ * @param dest      The destination.
+ * @param hash      Hash of the flow, see mip_flow_hash().
+ * @param next_hop  Where to store the next hop. Left as is on a miss.
+ * @return          0 if there is a route, 1 otherwise.
+ * */
+static int mip_route_lookup(mip_daemon *d, uint8_t dest, uint32_t hash, uint8_t *next_hop)
+{
+    struct shm_route route;
+
+    if (d->routes == NULL) return mip_fib_lookup(&d->fib, dest, hash, next_hop);
+
+    /* a segment stuck in a write is a miss, and the socket is asked instead */
+    if (route_shm_lookup(d->routes, dest, &route) == -1 || route.paths == 0) return 1;
+
+    *next_hop = route.next_hop[((uint64_t) hash * route.paths) >> 32];
+    return 0;
+}
+
+/**
+ * Checks if there is a routing daemon to ask, connected or running inside
+ * this one.
+ * */
+static int mip_routing_up(mip_daemon *d)
+{
+    return d->routing.fd != -1 || d->r != NULL;
+}
+
+/**
+ * Sends every destination batched since the last wakeup to the routing daemon
+ * in a single lookup request, under the next request ID.
+ * @param d         The daemon.
+ * @return          -1 if error, 0 otherwise.
+ * */
+static int mip_flush_lookups(mip_daemon *d)
+{
+    int i;
+
+    if (d->lookup_count == 0) return 0;
+
+    /* the packets wait until the routing daemon connects and pushes a route */
+    if (!mip_routing_up(d))
     {
-        printf("%s {%d...%d} (%d)\n", "mip address must be in range", MIN_MIP_ADDR, MAX_MIP_ADDR, mip_address);
-        return EXIT_SUCCESS;
+        d->lookup_count = 0;
+        return 0;
     }
 
-    /* create daemon */
-    if (daemon(NO_CHANGE, NO_CHANGE) == -1)
+    if (++d->lookup_seq == 0) d->lookup_seq = 1;
+    for (i = 0; i < d->lookup_count; i++)
     {
-        perror("daemon");
-        return EXIT_FAILURE;
+        d->lookup_id[d->lookup_batch[i]] = d->lookup_seq;
     }
 
-    /* set up listening on local socket comms */
-    upper_fd = prepare_unix_socket(unix_socket_name);
-    if (upper_fd == -1)
+    i = d->lookup_count;
+    d->lookup_count = 0;
+    return mip_send_routing_lookup_request(&d->routing, d->mip_address, d->lookup_seq,
+        d->lookup_batch, i, d->debug);
+}
+
+/**
+ * Sends a packet to the next hop found in the daemon's forwarding table,
+ * without asking the routing daemon. On a miss, the packet waits in the route
+ * slot of its destination, and only the first packet in the slot adds the
+ * destination to the next lookup request.
+ * @param d         The daemon.
+ * @param e         The packet to send. Ownership is taken in all cases.
+ * @return          -1 if error, 0 otherwise.
+ * */
+static int mip_forward(mip_daemon *d, struct pkt_buf *e)
+{
+    uint8_t next_hop;
+    uint8_t dest = e->frame.sdu[0];
+    ssize_t depth;
+
+    if (!mip_route_lookup(d, dest, mip_pkt_flow(d, e), &next_hop))
     {
-        return EXIT_FAILURE;
+        if (d->debug)
+        {
+            printf("<daemon>: forwarding table hit, sending to %d via %d\n", dest, next_hop);
+        }
+        e->frame.pdu.dest = next_hop;
+        return mip_send_or_wait(d, e) == -1 ? -1 : 0;
     }
-        
-    /* get lower layer socket */
-    lower_fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_MIP));
-    if (lower_fd == -1)
+
+    /* a lookup for this destination is already in flight, wait behind it */
+    depth = pending_push_route(d->pending, e);
+    if (depth == -1) return -1;
+    if (depth != 1 || !mip_routing_up(d)) return 0;
+
+    /* fall back to asking the routing daemon, along with every other miss */
+    d->lookup_batch[d->lookup_count++] = dest;
+    if (d->lookup_count == MAX_LOOKUP_ENTRIES) return mip_flush_lookups(d);
+    return 0;
+}
+
+/**
+ * Forwards a transit frame from the receive buffer it arrived in, when the
+ * forwarding table has a route, no packet waits ahead of it on ARP for the
+ * next hop, and the MAC address of the next hop is known.
+ * @param d         The daemon.
+ * @param pdu       The PDU of the frame, with the ttl lowered.
+ * @param sdu       The SDU of the frame, as returned by mip_link_recv().
+ * @return          -1 if error, 0 if the frame was sent, 1 if it is to be
+ *                  copied and take the slow path.
+ * */
+static int mip_forward_in_place(mip_daemon *d, const struct mip_pdu *pdu, char *sdu)
+{
+    int rc;
+    uint8_t next_hop, dest = sdu[0];
+    struct mip_pdu out = *pdu;
+
+    if (mip_route_lookup(d, dest, mip_flow_hash(pdu->src, dest, pdu->sdu_type, d->mip_address),
+        &next_hop)) return 1;
+    if (pending_arp_depth(d->pending, next_hop)) return 1;
+
+    out.dest = next_hop;
+    rc = mip_link_forward(d->arp_table, d->ifs, &out, sdu, d->debug);
+    if (rc == 0 && d->debug)
     {
-        perror("socket");
-        close(upper_fd);
-        return EXIT_FAILURE;
+        printf("<daemon>: forwarding table hit, sending to %d via %d in place\n", dest, next_hop);
     }
 
-    ifs = allocate_memory(sizeof(struct network_interfaces));
-    if (ifs == NULL)
+    return rc;
+}
+
+/**
+ * Sends the packets waiting in the route slot of dest. Each flow takes its
+ * own path if there is a route to the destination, next_hop otherwise.
+ * @param d         The daemon.
+ * @param dest      The destination.
+ * @param next_hop  The next hop to fall back on.
+ * @return          -1 if error, number of flushed packets otherwise.
+ * */
+static int mip_release_route(mip_daemon *d, uint8_t dest, uint8_t next_hop)
+{
+    struct pkt_buf *list, *e;
+
+    list = pending_take_route(d->pending, dest);
+    for (e = list; e != NULL; e = e->next)
     {
-        close(upper_fd); close(lower_fd);
-        return EXIT_FAILURE;
+        e->frame.pdu.dest = next_hop;
+        mip_route_lookup(d, dest, mip_pkt_flow(d, e), &e->frame.pdu.dest);
     }
 
-    arp_table = allocate_memory(sizeof(arp_entry) * MAX_TABLE_SIZE); /* must also free */
-    if (arp_table == NULL)
+    return mip_flush_pending(d, list, -1);
+}
+
+/**
+ * Sends the packets that waited on a route while no routing daemon was
+ * connected, to every destination the route table exported by the new one
+ * resolves, and asks it for the rest. Their lookups were dropped while routing
+ * was down, and a later miss behind them asks for none.
+ * @param d         The daemon, with the routing daemon connected.
+ * @return          -1 if error, 0 otherwise.
+ * */
+static int mip_retry_routes(mip_daemon *d)
+{
+    int dest;
+    uint8_t next_hop;
+
+    for (dest = 0; dest < MAX_MIP_ADDR; dest++)
     {
-        free(ifs);
-        close(upper_fd); close(lower_fd);
-        return EXIT_FAILURE;
+        if (d->pending->route[dest].depth == 0) continue;
+        d->lookup_id[dest] = 0;
+
+        if (!mip_route_lookup(d, dest, 0, &next_hop))
+        {
+            if (mip_release_route(d, dest, next_hop) == -1) return -1;
+            continue;
+        }
+
+        d->lookup_batch[d->lookup_count++] = dest;
+        if (d->lookup_count == MAX_LOOKUP_ENTRIES && mip_flush_lookups(d) == -1) return -1;
     }
 
-    if (get_mac_from_interface(ifs) == -1)
+    return mip_flush_lookups(d);
+}
+
+/**
+ * Accepts a connection on the upper layer socket. The new connection is
+ * registered to wait for its entity type identifier.
+ * */
+static int handle_connection(int fd, void *arg)
+{
+    mip_daemon *d = (mip_daemon*) arg;
+    int accept_fd;
+
+    accept_fd = accept(fd, NULL, NULL);
+    if (accept_fd == -1)
     {
-        free(ifs); free_arp_table(arp_table);
-        close(upper_fd); close(lower_fd);
-        return EXIT_FAILURE;
+        perror("accept");
+        return -1;
     }
 
-    ifs -> raw_socket = lower_fd;
-    ifs -> src_mip_addr = mip_address;
+    if (event_add(&d->loop, accept_fd, EVENT_LEVEL, handle_identifier, d) == -1)
+    {
+        close(accept_fd);
+        return -1;
+    }
+
+    /* the listening socket is level-triggered, remaining requests are reported again */
+    return 0;
+}
+
+/**
+ * Reads the entity type identifier of a new upper layer connection, and
+ * registers the connection with the handler for its type.
+ * */
+static int handle_identifier(int fd, void *arg)
+{
+    mip_daemon *d = (mip_daemon*) arg;
+    char entity_type_identifier;
+    int rc;
+
+    rc = recv(fd, &entity_type_identifier, sizeof(char), MSG_DONTWAIT);
+    if (rc == -1)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        fprintf(stderr, "%s() ", __FUNCTION__);
+        perror("recv");
+        return -1;
+    }
+
+    if (event_remove(&d->loop, fd) == -1) return -1;
 
-    /* get first entry to arp table */
-    arp_table[0] = add_entry(arp_table, mip_address, (uint8_t*) ifs -> addr[0].sll_addr, 
-        local, ifs -> addr[0].sll_ifindex);
-    if (arp_table[0] == NULL)
+    /* closed before identifying itself */
+    if (rc == 0)
     {
-        free(ifs); free_arp_table(arp_table);
-        close(upper_fd); close(lower_fd);
-        return EXIT_FAILURE;
+        close(fd);
+        return 0;
     }
 
-    /* add rest of local ifs */
-    for (c = 1; c < ifs -> ifs_size; c++)
+    /* both upper layer sockets are drained until EAGAIN, so they can be edge-triggered */
+    if (atoi(&entity_type_identifier) == MIP_PING)
     {
-        arp_entry = add_entry(arp_table, mip_address, (uint8_t*) ifs -> addr[c].sll_addr, 
-            local, ifs -> addr[c].sll_ifindex);
-        if (arp_entry == NULL)
-        {
-            free(ifs); free_arp_table(arp_table);
-            close(upper_fd); close(lower_fd);
-            return EXIT_FAILURE;
-        }
+        d->app_fd = fd;
+        return event_add(&d->loop, fd, EVENT_EDGE, handle_app, d);
     }
 
-    epoll_fd = epoll_create(1);
-    if (epoll_fd == -1) /* argument is ignored in Linux 2.6.8 */
+    /* a routing daemon that runs inside this one is the only one */
+    else if (atoi(&entity_type_identifier) == MIP_ROUTING && d->r != NULL)
     {
-        perror("epoll_create");
-        free(ifs); free_arp_table(arp_table);
-        close(upper_fd); close(lower_fd);
-        return EXIT_FAILURE;
+        fprintf(stderr, "<daemon>: routing runs inside the daemon, closing connection\n");
+        close(fd);
+        return 0;
     }
 
-    /* add upper layer socket to table of sockets of interest */
-    rc = epoll_add_to_table(epoll_fd, &events_struct, upper_fd);
-    if (rc == -1)
+    else if (atoi(&entity_type_identifier) == MIP_ROUTING)
     {
-        free(ifs); free_arp_table(arp_table);
-        close(upper_fd); close(lower_fd); close(epoll_fd);
-        return EXIT_FAILURE;
+        d->routing.fd = fd;
+
+        /* a new routing daemon only pushes the routes that differ from an */
+        /* empty table, so it starts from one here too */
+        mip_fib_init(&d->fib);
+
+        /* routes are read from the table the routing daemon exports, and */
+        /* it stops pushing them once it sees we do */
+        route_shm_close(d->routes);
+        d->routes = route_shm_open(d->mip_address, 1);
+        if (d->routes != NULL) __atomic_store_n(&d->routes->attached, 1, __ATOMIC_RELAXED);
+        if (d->debug)
+        {
+            printf("<daemon>: routes are read from %s\n",
+                d->routes != NULL ? "shared memory" : "the routing socket");
+        }
+
+        if (event_add(&d->loop, fd, EVENT_EDGE, handle_routing, d) == -1) return -1;
+        return mip_retry_routes(d);
     }
 
-    /* add lower layer socket to table of sockets of interest */
-    rc = epoll_add_to_table(epoll_fd, &events_struct, lower_fd);
-    if (rc == -1)
+    fprintf(stderr, "<daemon>: unknown entity type %c, closing connection\n", entity_type_identifier);
+    close(fd);
+    return 0;
+}
+
+/**
+ * Broadcasts a HELLO of the routing daemon.
+ * */
+static int routing_broadcast(void *arg, const struct ctrl_msg *msg)
+{
+    mip_daemon *d = (mip_daemon*) arg;
+
+    /* the message starts with its header, in d->buf or in the routing daemon */
+    char *sdu = (char*) msg->body - CTRL_HDR_SIZE;
+
+    return mip_broadcast(d->ifs, d->mip_address, MIP_ROUTING, sdu, msg->len) == -1 ? -1 : 0;
+}
+
+/**
+ * Unicasts an UPDATE, a link-state advert or a probe of the routing daemon to
+ * the neighbour in its header.
+ * */
+static int routing_unicast(void *arg, const struct ctrl_msg *msg)
+{
+    mip_daemon *d = (mip_daemon*) arg;
+    struct mip_pdu pdu = {0};
+    char *sdu = (char*) msg->body - CTRL_HDR_SIZE;
+
+    pdu.dest        = msg->addr;
+    pdu.src         = d->mip_address;
+    pdu.ttl         = DEFAULT_TTL;
+    pdu.sdu_len     = msg->len;
+    pdu.sdu_type    = MIP_ROUTING;
+
+    return mip_link_send(d->arp_table, d->ifs, &pdu, sdu, pdu.sdu_len, d->debug) == -1 ? -1 : 0;
+}
+
+/**
+ * Applies a forwarding table delta, and lets the packets waiting on a lookup
+ * leave as soon as their route is pushed.
+ * */
+static int routing_fib(void *arg, const struct ctrl_msg *msg)
+{
+    mip_daemon *d = (mip_daemon*) arg;
+    const uint8_t *entries = msg->body + FIB_SIZE - CTRL_HDR_SIZE;
+    size_t off, len = msg->len - FIB_SIZE;
+    uint8_t dest;
+    int wc;
+
+    wc = mip_fib_apply_delta(&d->fib, entries, len);
+    if (wc == -1 && d->debug)
     {
-        free(ifs); free_arp_table(arp_table);
-        close(upper_fd); close(lower_fd); close(epoll_fd);
-        return EXIT_FAILURE;
+        printf("<daemon>: dropping malformed forwarding table delta\n");
+    }
+    else if (d->debug)
+    {
+        printf("<daemon>: applied forwarding table delta, %d entries changed, %ld routes\n",
+            wc, d->fib.size);
     }
+    if (wc <= 0 || d->pending->queued == 0) return 0;
 
-    pkt_queue = queue_create();
-    if (pkt_queue == NULL)
+    for (off = 0; off + FIB_ENTRY_SIZE <= len; off += FIB_ENTRY_SIZE + entries[off + 2])
     {
-        free(ifs); free_arp_table(arp_table);
-        close(upper_fd); close(lower_fd); close(epoll_fd);
-        return EXIT_FAILURE;
+        dest = entries[off];
+        if (!d->fib.entries[dest].valid) continue;
+
+        d->lookup_id[dest] = 0;
+        if (mip_release_route(d, dest, MAX_MIP_ADDR) == -1) return -1;
     }
 
-    do
-    {       
-        rc = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+    return 0;
+}
+
+/**
+ * Handles a lookup response, answering a whole batch.
+ * */
+static int routing_response(void *arg, const struct ctrl_msg *msg)
+{
+    mip_daemon *d = (mip_daemon*) arg;
+    uint8_t dest, next_hop;
+    size_t off;
+    int wc;
 
-        /* error */
-        if (rc == -1)
+    for (off = 0; off < msg->body_len; off += 3)
+    {
+        dest = msg->body[off];
+        next_hop = msg->body[off + 1];
+
+        /* the slot was answered already, or asked for again since */
+        if (d->lookup_id[dest] != msg->seq) continue;
+        d->lookup_id[dest] = 0;
+
+        if (d->debug)
         {
-            perror("epoll_wait");
-            free(ifs); free_arp_table(arp_table); free(pkt_buf_entry); free_pkt_buffer(pkt_queue); 
-            queue_flush(pkt_queue);
-            close(upper_fd); close(lower_fd); close(epoll_fd); close(app_fd); close(routing_fd);
-            return EXIT_FAILURE;
+            printf("<daemon>: received lookup response %d for %d, next hop %d\n",
+                msg->seq, dest, next_hop);
         }
 
-        /* someone is trying to connect through the unix socket */
-        else if (events -> data.fd == upper_fd) 
+        /* if we couldn't match the mip address in the routing table */
+        if (next_hop == MAX_MIP_ADDR && mip_route_lookup(d, dest, 0, &next_hop))
         {
-            tmp_fd = handle_connection_request(upper_fd, epoll_fd, events_struct);
-            if (tmp_fd == -1)
+            wc = pending_drop_list(d->pending, pending_take_route(d->pending, dest));
+            if (d->debug)
             {
-                free(ifs); free_arp_table(arp_table); free(pkt_buf_entry); free_pkt_buffer(pkt_queue); 
-                queue_flush(pkt_queue);
-                close(upper_fd); close(lower_fd); close(epoll_fd); close(app_fd); close(routing_fd);
-                return EXIT_FAILURE;
+                printf("<daemon>: no route to destination host was found. Destroyed %d packets\n", wc);
+                mip_print_pending_table(d->pending);
             }
+            continue;
         }
 
-        /* handle entity type indentifier from upper layers */
-        else if (events -> data.fd == tmp_fd)
-        {
-            rc = read(tmp_fd, &entity_type_identifier, sizeof(char));
-            if (rc == -1)
-            {
-                fprintf(stderr, "%s() ", __FUNCTION__);
-                perror("read");
-                free(ifs); free_arp_table(arp_table); free(pkt_buf_entry); free_pkt_buffer(pkt_queue); 
-                queue_flush(pkt_queue);
-                close(upper_fd); close(lower_fd); close(epoll_fd); close(app_fd); close(routing_fd);
-                return EXIT_FAILURE;
-            }
+        /* else, send every packet buffered for this destination */
+        if (mip_release_route(d, dest, next_hop) == -1) return -1;
+    }
 
-            if (atoi(&entity_type_identifier) == MIP_PING) 
-            {
-                app_fd = tmp_fd;  
-            } 
+    return 0;
+}
 
-            else if (atoi(&entity_type_identifier) == MIP_ROUTING)
-            {
-                routing_fd = tmp_fd;
-            }
+/* the handler per opcode of the messages from the routing daemon */
+static const ctrl_handler daemon_handlers[CTRL_OPCODES] = {
+    [CTRL_HELLO]        = routing_broadcast,
+    [CTRL_UPDATE]       = routing_unicast,
+    [CTRL_LSA]          = routing_unicast,
+    [CTRL_PROBE]        = routing_unicast,
+    [CTRL_FIB]          = routing_fib,
+    [CTRL_RESPONSE]     = routing_response,
+};
+
+/**
+ * Handles a single message from the routing daemon.
+ * */
+static int handle_routing(int fd, void *arg)
+{
+    mip_daemon *d = (mip_daemon*) arg;
+    struct ctrl_msg msg;
+    int rc;
 
-            tmp_fd = -1;
-        }
+    rc = mip_routing_recv(fd, d->buf, &msg);
+
+    if (rc == RECV_AGAIN) return 0;
+
+    /* error */
+    if (rc == -1) return -1;
+
+    /* read returned 0 bytes, socket must be closed on other end */
+    if (rc == -2)
+    {
+        if (event_remove(&d->loop, fd) == -1) return -1;
+        close(fd);
+        d->routing.fd = -1;
+
+        /* no route is withdrawn from here on, and none was pushed over the */
+        /* socket while the segment was attached, so none is kept */
+        mip_fib_init(&d->fib);
+        route_shm_close(d->routes);
+        d->routes = NULL;
+        return 0;
+    }
+
+    /* a malformed message is dropped */
+    if (rc == 1) return 1;
+
+    if (ctrl_dispatch(daemon_handlers, d, &msg) == -1) return -1;
+    return 1;
+}
+
+/**
+ * Starts the routing daemon inside this one, on its timers. Each end hands
+ * its messages straight to the handlers of the other, so a lookup is
+ * answered and a forwarding table delta applied before the call that sent it
+ * returns. The options of the routing daemon are set by the caller.
+ * @param d         The daemon, with d->r allocated.
+ * @return          -1 if error, 0 otherwise.
+ * */
+static int mip_routing_embed(mip_daemon *d)
+{
+    routing_daemon *r = d->r;
+
+    r->out.handlers     = daemon_handlers;
+    r->out.ctx          = d;
+    d->routing.handlers = routing_handlers;
+    d->routing.ctx      = r;
 
-        /* handle incoming packet from routing daemon */
-        else if (events -> data.fd == routing_fd)
+    /* the debug output of the routing code follows the daemon's */
+    DEBUG = d->debug;
+
+    /* there is no shared memory to export the routes in, they are pushed */
+    /* straight into the forwarding table */
+    if (routing_init(r, d->mip_address, &d->timers) == -1) return -1;
+    return routing_send_scheduled(r);
+}
+
+/**
+ * Handles a single packet from the application layer.
+ * */
+static int handle_app(int fd, void *arg)
+{
+    mip_daemon *d = (mip_daemon*) arg;
+    int rc;
+    struct pkt_buf *e;
+
+    /* the SDU is read straight into a pool buffer. If none are left, it is */
+    /* read into the scratch buffer and dropped */
+    e = pool_get(d->pool, POOL_OWNER_RX);
+
+    /* read from upper layer socket */
+    rc = mip_app_recv(fd, e != NULL ? e->frame.sdu : d->buf);
+    if (rc <= 0 || e == NULL)
+    {
+        if (e != NULL) pool_put(d->pool, e);
+        if (rc == -1) return -1;
+        if (rc == RECV_AGAIN) return 0;
+
+        /* unix socket closed on other end */
+        if (rc == -2)
         {
-            rc = mip_routing_recv(routing_fd, buf);
+            if (event_remove(&d->loop, fd) == -1) return -1;
+            close(fd);
+            d->app_fd = -1;
+            return 0;
+        }
 
-            /* error */
-            if (rc == -1)
-            {
-                free(ifs); free_arp_table(arp_table); free(pkt_buf_entry); free_pkt_buffer(pkt_queue); 
-                queue_flush(pkt_queue);
-                close(upper_fd); close(lower_fd); close(epoll_fd); close(app_fd); close(routing_fd);
-                return EXIT_FAILURE;
-            }
+        return 1;
+    }
 
-            /* read returned 0 bytes, socket must be closed on other end */
-            if (rc == -2)
-            {
-                rc = epoll_ctl(epoll_fd, EPOLL_CTL_DEL, app_fd, &events_struct);
-                if (rc == -1)
-                {
-                    perror("epoll_ctl");
-                    free(ifs); free_arp_table(arp_table); free(pkt_buf_entry); free_pkt_buffer(pkt_queue); 
-                    queue_flush(pkt_queue);
-                    close(upper_fd); close(lower_fd); close(epoll_fd); close(app_fd); close(routing_fd);
-                    return EXIT_FAILURE;
-                }
-                close(routing_fd);
-                continue;
-            }
+    e->frame.pdu.dest       = e->frame.sdu[0];
+    e->frame.pdu.src        = d->mip_address;
+    e->frame.pdu.ttl        = e->frame.sdu[1];
+    e->frame.pdu.sdu_len    = rc - 2;
+    e->frame.pdu.sdu_type   = MIP_PING;
 
-            /* if we received a hello packet, broadcast it */
-            if (rc == 1)
-            {
-                rc = mip_broadcast(ifs, mip_address, MIP_ROUTING, buf, HEL_SIZE);
-                if (rc == -1)
-                {
-                    free(ifs); free_arp_table(arp_table); free(pkt_buf_entry); free_pkt_buffer(pkt_queue); 
-                    queue_flush(pkt_queue);
-                    close(upper_fd); close(lower_fd); close(epoll_fd); close(app_fd); close(routing_fd);
-                    return EXIT_FAILURE;
-                }
-            }
+    /* send right away if the routing daemon has pushed a route, cache otherwise */
+    if (mip_forward(d, e) == -1) return -1;
 
-            /* if we received an update packet, unicast it */
-            else if (rc == 2)
-            {
-                /* unicast here */
-                pdu = mip_get_pdu(buf[0], mip_address, DEFAULT_TTL, UPD_SIZE + 3 * buf[6], MIP_ROUTING);
-                if (pdu == NULL)
-                {
-                    free(ifs); free_arp_table(arp_table); free(pkt_buf_entry); free_pkt_buffer(pkt_queue); 
-                    queue_flush(pkt_queue);
-                    close(upper_fd); close(lower_fd); close(epoll_fd); close(app_fd); close(routing_fd);
-                    return EXIT_FAILURE;
-                }
-
-                wc = mip_link_send(arp_table, ifs, pdu, buf, pdu->sdu_len + 2, DEBUG);
-                if (wc == -1)
-                {
-                    free(ifs); free_arp_table(arp_table); free(pkt_buf_entry); free_pkt_buffer(pkt_queue); 
-                    queue_flush(pkt_queue); free(pdu);
-                    close(upper_fd); close(lower_fd); close(epoll_fd); close(app_fd); close(routing_fd);
-                    return EXIT_FAILURE;
-                }
-
-                free(pdu);
+    return 1;
+}
 
-            }
+/**
+ * Handles a single frame from the link layer.
+ * */
+static int handle_link(int fd, void *arg)
+{
+    mip_daemon *d = (mip_daemon*) arg;
+    int rc, wc;
+    uint8_t addr_ptr;
+    char *frame_sdu;
+    struct mip_pdu pdu;
+    struct pkt_buf *e;
+
+    (void) fd;
+
+    /* get packet from link layer socket */
+    rc = mip_link_recv(d->arp_table, d->ifs, &pdu, &frame_sdu, &addr_ptr, d->debug);
+
+    /* error or nothing more to read */
+    if (rc == -1) return -1;
+    if (rc == RECV_AGAIN) return 0;
+
+    /* forward packet to application layer, switching dest and src address */
+    if (rc == 0)
+    {
+        wc = d->app_fd == -1 ? 0 :
+            mip_app_send(d->app_fd, pdu.src, frame_sdu[1], frame_sdu + 2, pdu.sdu_len);
+        if (wc == -1) return -1;
+    }
 
-            /* if we get a lookup response */
-            else if (rc == 3)
+    /* forwarding packet, do routing lookup first */
+    else if (rc == 1)
+    {
+        /* check if time-to-live has expired */
+        if (--pdu.ttl == 0) {
+            if (d->debug)
             {
-                sdu = allocate_memory(sizeof(struct mip_sdu));
-                if (sdu == NULL)
-                {
-                    free(ifs); free_arp_table(arp_table); free(pkt_buf_entry); free_pkt_buffer(pkt_queue); 
-                    queue_flush(pkt_queue);
-                    close(upper_fd); close(lower_fd); close(epoll_fd); close(app_fd); close(routing_fd);
-                    return EXIT_FAILURE;
-                }
-
-                sdu->payload = allocate_memory(MAX_RT_PKT_SIZE);
-                if (sdu->payload == NULL)
-                {
-                    free(ifs); free_arp_table(arp_table); free(pkt_buf_entry); free_pkt_buffer(pkt_queue); 
-                    queue_flush(pkt_queue);
-                    close(upper_fd); close(lower_fd); close(epoll_fd); close(app_fd); close(routing_fd);
-                    return EXIT_FAILURE;
-                }
-
-                mip_deserialize_sdu(buf, sdu, RES_SIZE);
-                if (DEBUG) 
-                {
-                    printf("<daemon>: received lookup response:\n");
-                    mip_print_sdu(sdu, MIP_ROUTING);
-                }
-
-                /* if we couldn't match the mip address in the routing table */
-                if ((uint8_t) sdu->payload[3] == MAX_MIP_ADDR)
-                {
-                    // qe = get_entry_by_mip_addr(pkt_queue, sdu->dest);
-                    qe = pkt_queue->tail;
-                    free(sdu->payload); free(sdu);
-                    sdu = (struct mip_sdu*) ((struct pkt_buf_entry*) qe->data)->sdu;
-                    pdu = (struct mip_pdu*) ((struct pkt_buf_entry*) qe->data)->pdu;
-                    if (DEBUG) 
-                    {
-                        printf("<daemon>: no route to destination host was found. Destroying packets:\n");
-                        mip_print_sdu(sdu, MIP_PING);
-                        mip_print_pdu(pdu);
-                    }
-                    free(pdu);
-                    free(sdu->payload);
-                    free(sdu);
-                    queue_entry_destroy(pkt_queue, qe);
-                    continue;
-                }
-
-                /* else, send the buffered packet */
-                // qe = get_entry_by_mip_addr(pkt_queue, sdu->payload[3]);
-                qe = pkt_queue->tail;
-                if (qe == NULL) continue;
-                pdu = (struct mip_pdu*) ((struct pkt_buf_entry*) qe->data)->pdu;
-                pdu->dest = sdu->payload[3];
-                free(sdu->payload); free(sdu);
-                sdu = (struct mip_sdu*) ((struct pkt_buf_entry*) qe->data)->sdu;
-                sdu->ttl = pdu->ttl;
-
-                if (DEBUG) 
-                {
-                    printf("<daemon>: got PDU and SDU from packet buffer to be sent:\n");
-                    mip_print_sdu(sdu, MIP_PING);
-                    mip_print_pdu(pdu);
-                }
-
-                mip_serialize_sdu(buf, sdu);
-
-                /* forward sdu to to link layer */
-                wc = mip_link_send(arp_table, ifs, pdu, buf, pdu->sdu_len + 2, DEBUG);
-                if (wc == -1)
-                {
-                    free(ifs); free_arp_table(arp_table); free(pkt_buf_entry); free_pkt_buffer(pkt_queue); 
-                    queue_flush(pkt_queue);
-                    close(upper_fd); close(lower_fd); close(epoll_fd); close(app_fd); close(routing_fd);
-                    return EXIT_FAILURE;
-                }
-
-                /* we sent arp request, caching packet in buffer again until destination mac address is received */
-                else if (wc == 1)
-                {   
-                    continue;
-                }
-
-                /* we finally sent the packet */
-                else
-                {
-                    free(pdu);
-                    free(sdu->payload);
-                    free(sdu);
-                    queue_entry_destroy(pkt_queue, qe);
-                }
+                printf("<daemon>: PDU time-to-live expired\n");
             }
+            return 1;
         }
 
-        /* handle incoming packet from application layer */
-        else if (events -> data.fd == app_fd) 
+        if (pdu.sdu_len + 2 > MAX_MSG_SIZE) return 1;
+
+        /* with a route and the MAC address of the next hop at hand, the frame */
+        /* is sent from where it was received */
+        wc = mip_forward_in_place(d, &pdu, frame_sdu);
+        if (wc == -1) return -1;
+        if (wc == 0) return 1;
+
+        /* the frame is only valid until the next read, so it is moved to a pool buffer */
+        e = pool_get(d->pool, POOL_OWNER_RX);
+        if (e == NULL)
         {
-            sdu = allocate_memory(sizeof(struct mip_sdu));
-            if (sdu == NULL)
+            if (d->debug)
             {
-                free(ifs); free_arp_table(arp_table); free(pkt_buf_entry); free_pkt_buffer(pkt_queue); 
-                queue_flush(pkt_queue);
-                close(upper_fd); close(lower_fd); close(epoll_fd); close(app_fd); close(routing_fd);
-                return EXIT_FAILURE;
+                printf("<daemon>: packet pool exhausted, dropping packet\n");
             }
+            return 1;
+        }
+        e->frame.pdu = pdu;
+        memcpy(e->frame.sdu, frame_sdu, pdu.sdu_len + 2);
 
-            /* read from upper layer socket */
-            rc = mip_app_recv(app_fd, sdu);
-            if (rc == -1)
-            {
-                free(ifs); free_arp_table(arp_table); free(pkt_buf_entry); free_pkt_buffer(pkt_queue); 
-                queue_flush(pkt_queue);
-                close(upper_fd); close(lower_fd); close(epoll_fd); close(app_fd); close(routing_fd);
-                return EXIT_FAILURE;
-            }
-            
-            /* unix socket closed on other end */
-            else if (rc == -2)
-            {
-                rc = epoll_ctl(epoll_fd, EPOLL_CTL_DEL, app_fd, &events_struct);
-                if (rc == -1)
-                {
-                    perror("epoll_ctl");
-                    free(ifs); free_arp_table(arp_table); free(pkt_buf_entry); free_pkt_buffer(pkt_queue); 
-                    queue_flush(pkt_queue);
-                    close(upper_fd); close(lower_fd); close(epoll_fd); close(app_fd); close(routing_fd);
-                    return EXIT_FAILURE;
-                }
-                close(app_fd);
-                free(sdu->payload); free(sdu);
-                continue;
-            }
+        if (d->debug)
+        {
+            printf("<daemon>: forwarding this packet:\n");
+            mip_print_pkt_buf(e);
+        }
 
-            wc = mip_send_routing_lookup_request(routing_fd, mip_address, sdu->dest, DEBUG);
-            if (wc == -1)
-            {
-                free(ifs); free_arp_table(arp_table); free(pkt_buf_entry); free_pkt_buffer(pkt_queue); 
-                queue_flush(pkt_queue);
-                close(upper_fd); close(lower_fd); close(epoll_fd); close(app_fd); close(routing_fd);
-                return EXIT_FAILURE;
-            }
+        /* send right away if the routing daemon has pushed a route, cache otherwise */
+        if (mip_forward(d, e) == -1) return -1;
+    }
 
-            pdu = mip_get_pdu(sdu->dest, mip_address, sdu->ttl, strlen(sdu->payload), MIP_PING);
-            if (pdu == NULL)
-            {
-                free(ifs); free_arp_table(arp_table); free(pkt_buf_entry); free_pkt_buffer(pkt_queue); 
-                queue_flush(pkt_queue);
-                close(upper_fd); close(lower_fd); close(epoll_fd); close(app_fd); close(routing_fd);
-                return EXIT_FAILURE;
-            }
+    /* SDU is a routing packet, handled right away by a routing daemon that */
+    /* runs inside this one */
+    else if (rc == 2 && mip_routing_up(d))
+    {
+        if (ctrl_send(&d->routing, frame_sdu, pdu.sdu_len) == -1)
+        {
+            fprintf(stderr, "<daemon>: error at %d in %s()\n", __LINE__, __FUNCTION__);
+            return -1;
+        }
+    }
 
-            pkt_buf_entry = allocate_memory(sizeof(struct pkt_buf_entry));
-            if (pkt_buf_entry == NULL)
-            {
-                free(ifs); free_arp_table(arp_table); free(pkt_buf_entry); free_pkt_buffer(pkt_queue); 
-                queue_flush(pkt_queue);
-                close(upper_fd); close(lower_fd); close(epoll_fd); close(app_fd); close(routing_fd);
-                return EXIT_FAILURE;
-            }
+    /* ARP messages were handled by mip_link_recv, and the packets waiting on */
+    /* an ARP response were sent by handle_arp_resolved */
 
-            /* caching packet until we get a lookup response */
-            if (DEBUG) 
-            {
-                printf("<daemon>: caching packet in buffer:\n");
-                mip_print_sdu(sdu, MIP_PING);
-                mip_print_pdu(pdu);
-            }
-            pkt_buf_entry->pdu = pdu;
-            pkt_buf_entry->sdu = sdu;
-            queue_head_push(pkt_queue, pkt_buf_entry);
+    return 1;
+}
+
+/**
+ * Sends the frames of a shaped link that are due.
+ * */
+static int handle_link_timer(int fd, void *arg)
+{
+    mip_daemon *d = (mip_daemon*) arg;
+    (void) fd;
+
+    if (link_timer(d->ifs->link) == -1) return -1;
+
+    /* the timer is read in full */
+    return 0;
+}
+
+/**
+ * Fires the timers of the daemon that are due.
+ * */
+static int handle_timers(int fd, void *arg)
+{
+    mip_daemon *d = (mip_daemon*) arg;
+    (void) fd;
+
+    return timer_run(&d->timers, 0);
+}
+
+/**
+ * Prints the counters of the link, the packet pool, the pending packets and
+ * ARP, every STATS_INTERVAL_MS in debug mode.
+ * */
+static int handle_stats(struct mip_timer *t, void *arg)
+{
+    mip_daemon *d = (mip_daemon*) arg;
+    const struct link_stats *ls = link_get_stats(d->ifs->link);
+    const struct pool_stats *ps = &d->pool->stats;
+    const arp_table *at = d->arp_table;
+
+    printf("<daemon>: link rx %zu frames in %zu batches, tx %zu frames in %zu batches, %zu in place, %zu dropped\n",
+        ls->rx_frames, ls->rx_batches, ls->tx_frames, ls->tx_batches, ls->tx_in_place,
+        ls->tx_dropped);
+    printf("<daemon>: pool %zu in use, %zu at most, exhausted %zu times\n",
+        ps->in_use, ps->high_water, ps->exhausted);
+    printf("<daemon>: pending %zu, dropped %zu full, %zu no route, %zu no ARP reply, %zu expired\n",
+        d->pending->queued, d->pending->dropped_full, d->pending->dropped_route, 
+        d->pending->dropped_arp, d->pending->expired);
+    printf("<daemon>: ARP %zu requests, %zu probes, %zu learned, %zu failures, %zu evictions\n",
+        at->requests, at->probes, at->learned, at->failures, at->evictions);
+    fflush(stdout);
+
+    return timer_add(&d->timers, t, STATS_INTERVAL_MS);
+}
+
+/**
+ * Sends every packet waiting on the MAC address of a next hop, once an ARP
+ * response or a frame from the next hop has told it.
+ * */
+static int handle_arp_resolved(void *arg, uint8_t mip_address)
+{
+    mip_daemon *d = (mip_daemon*) arg;
+    struct pkt_buf *list;
+
+    list = pending_take_arp(d->pending, mip_address);
+    return mip_flush_pending(d, list, -1) == -1 ? -1 : 0;
+}
+
+/**
+ * Drops the packets waiting on a next hop that never answered ARP.
+ * */
+static int handle_arp_failure(void *arg, uint8_t mip_address)
+{
+    mip_daemon *d = (mip_daemon*) arg;
+    size_t dropped;
+
+    dropped = pending_drop_arp(d->pending, mip_address);
+    if (d->debug)
+    {
+        printf("<daemon>: no ARP reply from %d, dropped %ld packets\n", mip_address, dropped);
+    }
+
+    return 0;
+}
+
+void free_mip_daemon(mip_daemon *d)
+{
+    event_loop_close(&d->loop);
+    if (d->upper_fd != -1) close(d->upper_fd);
+    if (d->lower_fd != -1) close(d->lower_fd);
+    if (d->app_fd != -1) close(d->app_fd);
+    if (d->routing.fd != -1) close(d->routing.fd);
+    route_shm_close(d->routes);
+
+    /* the routing daemon runs on the timers, and leaves them before they close */
+    if (d->r != NULL) free_routing_daemon(d->r);
+    if (d->arp_table != NULL) free_arp_table(d->arp_table);
+    free_pending_table(d->pending);
+    timer_cancel(&d->timers, &d->stats_timer);
+    timer_base_close(&d->timers);
+    free_pool(d->pool);
+    if (d->ifs != NULL) free_link(d->ifs->link);
+    free(d->ifs);
+    free(d);
+}
+
+int main(int argc, char* argv[])
+{
+    int HELP = 0;
+    int DEBUG = 0;
+    int LINK_FLAGS = 0;
+    int POOL_FLAGS = 0;
+    int EMBED = 0;
+    int link_state = 0;
+    long hello_interval = HELLO_INTERVAL_MS;
+    long detect_mult = DETECT_MULT;
+    long probe_interval = PROBE_INTERVAL_MS;
+    uint8_t probe[MAX_NEIGHBOURS] = {0};
+    int socket_index = 1, addr_index = 2, c, rc;
+    char                        *unix_socket_name;
+    char                        *wire = NULL;
+    uint8_t                     mip_address;
+    struct network_interfaces   *ifs;
+    struct arp_entry            *arp_entry;
+    struct mip_daemon           *d;
+
+    if (argc < 3 || argc > 21)
+    {
+        printf("%s\n", "usage: ./mip_daemon [-h] [-d] [-r] [-t] [-b] [-H] [-w <wire>] [-e [-l] [-i <hello_ms>] [-m <mult>] [-f <mip>[,<mip>...]] [-p <probe_ms>]] <socket_upper> <mip_address>");
+        return EXIT_SUCCESS;
+    }
+
+    while ((c = getopt(argc, argv, "hdrtbHw:eli:m:f:p:")) != -1)
+    {
+        switch (c)
+        {
+            case 'h':
+                HELP = 1;
+                break;
+            case 'd':
+                DEBUG = 1;
+                break;
+            case 'r':
+                LINK_FLAGS |= LINK_RX_RING;     /* receive from a mapped ring */
+                break;
+            case 't':
+                LINK_FLAGS |= LINK_TX_RING;     /* send through a mapped ring */
+                break;
+            case 'b':
+                LINK_FLAGS |= LINK_QDISC_BYPASS;
+                break;
+            case 'H':
+                POOL_FLAGS |= POOL_HUGEPAGES;
+                break;
+            case 'w':
+                wire = optarg;                  /* AF_UNIX wire instead of the raw socket */
+                break;
+            case 'e':
+                EMBED = 1;                      /* routing runs inside the daemon */
+                break;
+            case 'l':
+                link_state = 1;
+                break;
+            case 'i':
+                hello_interval = routing_parse_option(optarg, UINT16_MAX);
+                break;
+            case 'm':
+                detect_mult = routing_parse_option(optarg, UINT8_MAX);
+                break;
+            case 'p':
+                probe_interval = routing_parse_option(optarg, UINT16_MAX);
+                break;
+            case 'f':
+                if (routing_parse_probes(optarg, probe) == -1) HELP = 1;
+                break;
+            default:
+                break;
         }
+    }
+
+    if (HELP) {
+        printf("%s\n", "-h >> usage: ./mip_daemon [-h] [-d] [-r] [-t] [-b] [-H] [-w <wire>] [-e [-l] [-i <hello_ms>] [-m <mult>] [-f <mip>[,<mip>...]] [-p <probe_ms>]] <socket_upper> <mip_address>");
+        return EXIT_SUCCESS;
+    }
+
+    if (argc - optind != 2 || hello_interval == -1 || detect_mult == -1 || probe_interval == -1)
+    {
+        printf("%s\n", "usage: ./mip_daemon [-h] [-d] [-r] [-t] [-b] [-H] [-w <wire>] [-e [-l] [-i <hello_ms>] [-m <mult>] [-f <mip>[,<mip>...]] [-p <probe_ms>]] <socket_upper> <mip_address>");
+        return EXIT_SUCCESS;
+    }
+    socket_index = optind;
+    addr_index = optind + 1;
+
+    /* get command line arguments */
+    unix_socket_name = argv[socket_index];
+    mip_address = atoi(argv[addr_index]);
+
+    if (!in_range(mip_address, MIN_MIP_ADDR, MAX_MIP_ADDR))
+    {
+        printf("%s {%d...%d} (%d)\n", "mip address must be in range", MIN_MIP_ADDR, MAX_MIP_ADDR, mip_address);
+        return EXIT_SUCCESS;
+    }
+
+    /* create daemon */
+    if (daemon(NO_CHANGE, NO_CHANGE) == -1)
+    {
+        perror("daemon");
+        return EXIT_FAILURE;
+    }
+
+    d = allocate_memory(sizeof(struct mip_daemon));
+    if (d == NULL)
+    {
+        return EXIT_FAILURE;
+    }
 
-        /* handle incoming frame from lower layer */
-        else if (events -> data.fd == lower_fd) 
+    d->upper_fd = d->lower_fd = d->app_fd = d->routing.fd = d->timers.fd = d->loop.epoll_fd = -1;
+    d->mip_address = mip_address;
+    d->debug = DEBUG;
+    mip_fib_init(&d->fib);
+
+    /* the routing daemon runs inside this one instead of connecting to it, */
+    /* with the same options */
+    if (EMBED)
+    {
+        d->r = allocate_memory(sizeof(struct routing_daemon));
+        if (d->r == NULL)
         {
+            free_mip_daemon(d);
+            return EXIT_FAILURE;
+        }
+        d->r->out.fd = d->r->loop.epoll_fd = -1;
+        d->r->link_state        = link_state;
+        d->r->hello_interval    = hello_interval;
+        d->r->detect_mult       = detect_mult;
+        d->r->probe_interval    = probe_interval;
+        memcpy(d->r->probe, probe, MAX_NEIGHBOURS);
+    }
 
-            pdu = allocate_memory(sizeof(struct mip_pdu));
-            if (pdu == NULL)
-            {
-                free(ifs); free_arp_table(arp_table); free(pkt_buf_entry); free_pkt_buffer(pkt_queue); 
-                queue_flush(pkt_queue);
-                close(upper_fd); close(lower_fd); close(epoll_fd); close(app_fd); close(routing_fd);
-                return EXIT_FAILURE;
-            }
+    /* set up listening on local socket comms */
+    d->upper_fd = prepare_unix_socket(unix_socket_name);
+    if (d->upper_fd == -1)
+    {
+        free_mip_daemon(d);
+        return EXIT_FAILURE;
+    }
 
-            /* get packet from link layer socket */
-            rc = mip_link_recv(arp_table, ifs, pdu, buf, &addr_ptr, DEBUG);
+    ifs = d->ifs = allocate_memory(sizeof(struct network_interfaces));
+    if (ifs == NULL)
+    {
+        free_mip_daemon(d);
+        return EXIT_FAILURE;
+    }
 
-            /* error */
-            if (rc == -1)
-            {
-                free(ifs); free_arp_table(arp_table); free(pkt_buf_entry); free_pkt_buffer(pkt_queue); 
-                queue_flush(pkt_queue);
-                close(upper_fd); close(lower_fd); close(epoll_fd); close(app_fd); close(routing_fd);
-                return EXIT_FAILURE;
-            }
+    /* get lower layer socket */
+    if (wire == NULL)
+    {
+        d->lower_fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_MIP));
+        if (d->lower_fd == -1)
+        {
+            perror("socket");
+            free_mip_daemon(d);
+            return EXIT_FAILURE;
+        }
 
-            if (rc < 3)
-            {
-                sdu = allocate_memory(sizeof(struct mip_sdu));
-                if (sdu == NULL)
-                {
-                    fprintf(stderr, "<daemon>: error at %d in %s\n", __LINE__, __FUNCTION__);
-                    free(ifs); free_arp_table(arp_table); free(pkt_buf_entry); free_pkt_buffer(pkt_queue); 
-                    queue_flush(pkt_queue);
-                    close(upper_fd); close(lower_fd); close(epoll_fd); close(app_fd); close(routing_fd);
-                    return EXIT_FAILURE;
-                }
-
-                sdu->payload = allocate_memory(pdu->sdu_len);
-                if (sdu->payload == NULL)
-                {
-                    fprintf(stderr, "<daemon>: error at %d in %s\n", __LINE__, __FUNCTION__);
-                    free(ifs); free_arp_table(arp_table); free(pkt_buf_entry); free_pkt_buffer(pkt_queue); 
-                    queue_flush(pkt_queue);
-                    close(upper_fd); close(lower_fd); close(epoll_fd); close(app_fd); close(routing_fd);
-                    return EXIT_FAILURE;
-                }
-                mip_deserialize_sdu(buf, sdu, pdu->sdu_len + 2);
-            }
+        ifs -> link = link_create(d->lower_fd, LINK_FLAGS);
+    }
+    else
+    {
+        ifs -> link = wire_create(wire, mip_address);
+    }
 
-            /* forward packet to application layer */
-            if (rc == 0)
-            {
-                sdu->dest = pdu->src; /* switching dest and src address */
-
-                wc = mip_app_send(app_fd, sdu);
-                if (wc == -1)
-                {
-                    fprintf(stderr, "<daemon>: error at %d in %s\n", __LINE__, __FUNCTION__);
-                    free(ifs); free_arp_table(arp_table); free(pkt_buf_entry); free_pkt_buffer(pkt_queue); 
-                    queue_flush(pkt_queue);
-                    close(upper_fd); close(lower_fd); close(epoll_fd); close(app_fd); close(routing_fd);
-                    return EXIT_FAILURE;
-                }
-
-                free(pdu); free(sdu->payload); free(sdu);
-            }
+    if (ifs -> link == NULL)
+    {
+        free_mip_daemon(d);
+        return EXIT_FAILURE;
+    }
 
-            /* forwarding packet, do routing lookup first */
-            else if (rc == 1)
-            {
-                /* check if time-to-live has expired */
-                if (--pdu->ttl == 0) {
-                    if (DEBUG) 
-                    {
-                        printf("<daemon>: PDU time-to-live expired\n");
-                    }
-                    free(pdu); free(sdu->payload); free(sdu);
-                    continue;
-                } 
-
-                if (DEBUG) 
-                {
-                    printf("<daemon>: forwarding this packet:\n");
-                    mip_print_sdu(sdu, MIP_PING);
-                }
-
-                wc = mip_send_routing_lookup_request(routing_fd, mip_address, sdu->dest, DEBUG);
-                if (wc == -1)
-                {
-                    fprintf(stderr, "<daemon>: error at %d in %s\n", __LINE__, __FUNCTION__);
-                    free(ifs); free_arp_table(arp_table); free(pkt_buf_entry); free_pkt_buffer(pkt_queue); 
-                    queue_flush(pkt_queue);
-                    close(upper_fd); close(lower_fd); close(epoll_fd); close(app_fd); close(routing_fd);
-                    return EXIT_FAILURE;
-                }
-
-                if (DEBUG) 
-                {
-                    printf("<daemon>: did a lookup to forward packet, pushing it to queue instead.\n");
-                }
-
-                pkt_buf_entry = allocate_memory(sizeof(struct pkt_buf_entry));
-                if (pkt_buf_entry == NULL)
-                {
-                    free(ifs); free_arp_table(arp_table); free(pkt_buf_entry); free_pkt_buffer(pkt_queue); 
-                    queue_flush(pkt_queue);
-                    close(upper_fd); close(lower_fd); close(epoll_fd); close(app_fd); close(routing_fd);
-                    return EXIT_FAILURE;
-                }
-
-                pkt_buf_entry->sdu = sdu;
-                pkt_buf_entry->pdu = pdu;
-                queue_head_push(pkt_queue, pkt_buf_entry);
-            }
+    if (timer_base_init(&d->timers, 1) == -1)
+    {
+        free_mip_daemon(d);
+        return EXIT_FAILURE;
+    }
 
-            /* SDU is a routing packet */
-            else if (rc == 2)
-            {
-                wc = write(routing_fd, buf, pdu->sdu_len);
-                if (wc == -1)
-                {
-                    fprintf(stderr, "<daemon>: error at %d in %s()\n", __LINE__, __FUNCTION__);
-                    free(ifs); free_arp_table(arp_table); free(pkt_buf_entry); free_pkt_buffer(pkt_queue); 
-                    queue_flush(pkt_queue);
-                    close(upper_fd); close(lower_fd); close(epoll_fd); close(app_fd); close(routing_fd);
-                    return EXIT_FAILURE;
-                }
-
-                free(pdu); 
-                free(sdu->payload); 
-                free(sdu);
-            }
+    d->arp_table = arp_table_create(mip_address, ifs, &d->timers);
+    if (d->arp_table == NULL)
+    {
+        free_mip_daemon(d);
+        return EXIT_FAILURE;
+    }
+    d->arp_table -> resolved = handle_arp_resolved;
+    d->arp_table -> resolved_arg = d;
+    d->arp_table -> failure = handle_arp_failure;
+    d->arp_table -> failure_arg = d;
 
-            /* if received msg is an arp response, we can send packets from outgoing buffer */
-            else if (rc == 3)
-            {        
-                free(pdu); 
-                // qe = get_entry_by_mip_addr(pkt_queue, addr_ptr);
-                qe = pkt_queue->tail;
-                if (qe == NULL) continue;
-                sdu = (struct mip_sdu*) ((struct pkt_buf_entry*) qe->data)->sdu;
-                pdu = (struct mip_pdu*) ((struct pkt_buf_entry*) qe->data)->pdu;
-                mip_serialize_sdu(buf, sdu);
-
-                wc = mip_link_send(arp_table, ifs, pdu, buf, pdu->sdu_len + 2, DEBUG);
-                if (wc == -1)
-                {
-                    free(ifs); free_arp_table(arp_table); free(pkt_buf_entry); free_pkt_buffer(pkt_queue); 
-                    queue_flush(pkt_queue);
-                    close(upper_fd); close(lower_fd); close(epoll_fd); close(app_fd); close(routing_fd);
-                    return EXIT_FAILURE;
-                }
-
-                free(pdu);
-                free(sdu->payload);
-                free(sdu);
-                queue_entry_destroy(pkt_queue, qe);                
-                continue;
-            }
+    if (link_discover(ifs -> link, ifs) == -1)
+    {
+        free_mip_daemon(d);
+        return EXIT_FAILURE;
+    }
 
-            /* if received msg was an ARP request, this was handled by mip_link_recv */
-            else if (rc == 4)
-            {
-                free(pdu);
-                continue;
-            } 
+    ifs -> raw_socket = ifs -> link -> fd;
+    ifs -> src_mip_addr = mip_address;
 
+    /* add the local ifs to the arp table */
+    for (c = 0; c < ifs -> ifs_size; c++)
+    {
+        arp_entry = add_local_entry(d->arp_table, (uint8_t*) ifs -> addr[c].sll_addr,
+            ifs -> addr[c].sll_ifindex);
+        if (arp_entry == NULL)
+        {
+            free_mip_daemon(d);
+            return EXIT_FAILURE;
         }
+    }
 
-    } while (1);
+    d->pool = pool_create(POOL_BUFS, POOL_FLAGS);
+    if (d->pool == NULL)
+    {
+        free_mip_daemon(d);
+        return EXIT_FAILURE;
+    }
 
-    printf("<daemon>: user interruption\n");
+    d->pending = pending_create(d->pool, &d->timers);
+    if (d->pending == NULL)
+    {
+        free_mip_daemon(d);
+        return EXIT_FAILURE;
+    }
 
-    /* for debugging memory leaks */
-    free(ifs); 
-    free_arp_table(arp_table); 
-    free(pkt_buf_entry); 
-    free_pkt_buffer(pkt_queue); 
-    queue_flush(pkt_queue);
-    close(upper_fd); close(lower_fd); close(epoll_fd); close(app_fd); close(routing_fd);
-    return EXIT_FAILURE;
-    return EXIT_SUCCESS;
-}
+    if (event_loop_init(&d->loop, EVENT_BUDGET) == -1)
+    {
+        free_mip_daemon(d);
+        return EXIT_FAILURE;
+    }
 
-queue_entry* get_entry_by_mip_addr(struct queue *q, uint8_t addr)
-{
-    size_t len = queue_length(q);
-    struct queue_entry *qe = q->head;
-    struct mip_sdu *e;
-    int i;
+    /* add upper layer socket to table of sockets of interest */
+    rc = event_add(&d->loop, d->upper_fd, EVENT_LEVEL, handle_connection, d);
+    if (rc == -1)
+    {
+        free_mip_daemon(d);
+        return EXIT_FAILURE;
+    }
 
-    for (i = 0; i < (int) len; i++)
+    /* add lower layer socket to table of sockets of interest. Every frame is */
+    /* read with MSG_DONTWAIT until EAGAIN, so it can be edge-triggered */
+    rc = event_add(&d->loop, ifs -> link -> fd, EVENT_EDGE, handle_link, d);
+    if (rc == -1)
     {
-        e = (mip_sdu*) qe->data;
-        if (e->dest == addr)
+        free_mip_daemon(d);
+        return EXIT_FAILURE;
+    }
+
+    /* frames held back by a shaped link are sent when their timer expires */
+    if (ifs -> link -> timer_fd != -1)
+    {
+        rc = event_add(&d->loop, ifs -> link -> timer_fd, EVENT_LEVEL, handle_link_timer, d);
+        if (rc == -1)
         {
-            return qe;
-        } 
-        qe = qe->next;
+            free_mip_daemon(d);
+            return EXIT_FAILURE;
+        }
     }
-    fprintf(stderr, "[WARNING]: %s() at line %d, did not return a packet from buffer\n", __FUNCTION__, __LINE__);
-    return NULL; /* this may happen if we get multiple ARP responses */
-}
 
-void free_pkt_buffer(queue *pkt_buf)
-{
-    int i;
-    int len = (int) queue_length(pkt_buf);
-    struct queue_entry *qe = pkt_buf->head;
-    struct mip_sdu *sdu;
-    struct mip_pdu *pdu;
+    /* ARP retransmits and aging, pending packet expiry and stats run on the timers */
+    rc = event_add(&d->loop, d->timers.fd, EVENT_LEVEL, handle_timers, d);
+    if (rc == -1)
+    {
+        free_mip_daemon(d);
+        return EXIT_FAILURE;
+    }
 
-    for (i = 0; i < (int) len; i++)
+    timer_init(&d->stats_timer, handle_stats, d);
+    if (d->debug && timer_add(&d->timers, &d->stats_timer, STATS_INTERVAL_MS) == -1)
     {
-        sdu = (struct mip_sdu*) ((struct pkt_buf_entry*) qe->data)->sdu;
-        pdu = (struct mip_pdu*) ((struct pkt_buf_entry*) qe->data)->pdu;
-        free(sdu->payload); free(sdu); free(pdu);
-        
-        qe = qe->next;
+        free_mip_daemon(d);
+        return EXIT_FAILURE;
     }
-}
\ No newline at end of file
+
+    /* the routing daemon says HELLO right away, and starts its timers from now */
+    if (d->r != NULL && mip_routing_embed(d) == -1)
+    {
+        free_mip_daemon(d);
+        return EXIT_FAILURE;
+    }
+
+    /* dispatch every ready socket on each wakeup, then send every routing */
+    /* message, lookup and frame it produced in one batch */
+    while ((rc = event_loop_run_once(&d->loop, -1)) != -1)
+    {
+        if (d->r != NULL && routing_send_scheduled(d->r) == -1) break;
+        if (mip_flush_lookups(d) == -1) break;
+        if (link_flush(ifs -> link) == -1) break;
+    }
+
+    printf("<daemon>: user interruption\n");
+
+    /* for debugging memory leaks */
+    free_mip_daemon(d);
+    return EXIT_FAILURE;
+}
@@ -45,98 +45,101 @@ void mip_print_sdu(mip_sdu *sdu, int type)
         printf("%29s\n\n", "--- MIP SDU END ---");
     }
 
-    else if (type == MIP_ROUTING)
-    {
-        mip_print_routing_sdu(sdu);
-    }
 }
 
-void mip_print_routing_sdu(struct mip_sdu *sdu) 
+void mip_print_ctrl_msg(const struct ctrl_msg *msg) 
 {
-    uint8_t i;
-    char type[4];
+    size_t i;
+    const uint8_t *b = msg->body;
     char* lines = "---------------------";
     char *can_reach = "dest", *via = "via", *hops = "hops";
-    memcpy(type, sdu->payload, 3);
-    type[3] = '\0';
 
-    printf("\n%35s\n", "--- MIP ROUTING SDU START ---");
-
-    if (!strncmp(type, HELLO, 3))
-    {
-        printf("%22s %s\n", "Type: ", "HELLO");
-        printf("%22s %d\n", "Dest: ", sdu->dest);
-        printf("%22s %d\n", "TTL: ", sdu->ttl);
-        printf("%22s %d\n", "Source: ", sdu->payload[3]);
-    }          
+    printf("\n%35s\n", "--- MIP ROUTING MESSAGE START ---");
+    printf("%22s %s\n", "Type: ", ctrl_name(msg->opcode));
+    printf("%22s %d\n", "Address: ", msg->addr);
+    printf("%22s %d\n", "Length: ", msg->len);
+    printf("%22s %d\n", "Sequence: ", msg->seq);
 
-    else if (!strncmp(type, UPDATE, 3))
+    switch (msg->opcode)
     {
-        printf("%22s %s\n", "Type: ", "UPDATE");
-        printf("%22s %d\n", "Dest: ", sdu->dest);
-        printf("%22s %d\n", "TTL: ", sdu->ttl);
-        printf("%22s %d\n", "Length: ", sdu->payload[4]);
-        printf("%4s %25s\n", "", lines);
-        printf("%9s | %s | %s | %s |\n", "", can_reach, via, hops);
-        printf("%4s %25s\n", "", lines);
-
-        for (i = 0; i < (int) sdu->payload[4]; i++)
-        {
-            printf("%8s | %4d | %3d | %4d |\n", "", (uint8_t) sdu->payload[i * 3 + 5], (uint8_t) sdu->payload[i * 3 + 6], (uint8_t) sdu->payload[i * 3 + 7]);
+        case CTRL_HELLO:
+        case CTRL_PROBE:
+            printf("%22s %d\n", "Source: ", b[0]);
+            printf("%22s %d ms\n", "Interval: ", b[1] << 8 | b[2]);
+            printf("%22s %d\n", "Detect mult: ", b[3]);
+            break;
+
+        case CTRL_UPDATE:
+            printf("%22s %d\n", "Source: ", b[0]);
+            printf("%22s %s\n", "Kind: ", b[1] & UPD_FULL ? "full" 
+                : b[1] & UPD_RESYNC ? "resync request" : "delta");
+            printf("%4s %25s\n", "", lines);
+            printf("%9s | %s | %s | %s |\n", "", can_reach, via, hops);
             printf("%4s %25s\n", "", lines);
-        }
-    }
-
-    else if (!strncmp(type, REQUESTPKT, 3))
-    {
-        printf("%22s %s\n", "Type: ", "REQUEST");
-        printf("%22s %d\n", "Dest: ", sdu->dest);
-        printf("%22s %d\n", "TTL: ", sdu->ttl);
-        printf("%22s %d\n", "Requesting: ", sdu->payload[3]);
-    } 
 
-    else if (!strncmp(type, RESPONSEPKT, 3))
-    {
-        printf("%22s %s\n", "Type: ", "RESPONSE");
-        printf("%22s %d\n", "Dest: ", sdu->dest);
-        printf("%22s %d\n", "TTL: ", sdu->ttl);
-        if ((uint8_t) sdu->payload[3] == MAX_MIP_ADDR)
-            printf("%27s\n", "No path found");
-        else printf("%22s %d\n", "Responding with: ", sdu->payload[3]);
+            for (i = 2; i < msg->body_len; i += 3)
+            {
+                printf("%8s | %4d | %3d | %4d |\n", "", b[i], b[i + 1], b[i + 2]);
+                printf("%4s %25s\n", "", lines);
+            }
+            break;
+
+        case CTRL_LSA:
+            printf("%22s %d\n", "Source: ", b[0]);
+            printf("%22s %d\n", "Origin: ", b[1]);
+            printf("%22s", "Links: ");
+            for (i = 2; i < msg->body_len; i++) printf(" %d", b[i]);
+            printf("\n");
+            break;
+
+        case CTRL_REQUEST:
+            printf("%22s", "Requesting: ");
+            for (i = 0; i < msg->body_len; i++) printf(" %d", b[i]);
+            printf("\n");
+            break;
+
+        case CTRL_RESPONSE:
+            for (i = 0; i < msg->body_len; i += 3)
+            {
+                printf("%22s %d", "Requested: ", b[i]);
+                if (b[i + 1] == MAX_MIP_ADDR) printf(", no path found\n");
+                else printf(", next hop %d\n", b[i + 1]);
+            }
+            break;
+
+        case CTRL_FIB:
+            printf("%22s %d\n", "Source: ", b[0]);
+            for (i = 1; i + FIB_ENTRY_SIZE <= msg->body_len; i += FIB_ENTRY_SIZE + b[i + 2])
+                printf("%22s %d, %d hops over %d paths\n", "Entry: ", b[i], b[i + 1], b[i + 2]);
+            break;
     }
 
-    else printf("%30s\n", "undefined packet type");
-
-    printf("%34s\n\n", "--- MIP ROUTING SDU END ---");
+    printf("%34s\n\n", "--- MIP ROUTING MESSAGE END ---");
 }
 
-void mip_print_routing_table(struct queue *routing_table)
+void mip_print_routing_table(routing_table *routing_table)
 {
-    int i;
-    size_t len = queue_length(routing_table);
+    int i, dest;
     char* lines = "-------------------------";
     char *num = "#", *can_reach = "dest", *via = "via", *hops = "hops";
 
-    struct queue_entry *qe;
-    struct mip_routing_table_entry *e;
-
     printf("\n%11s %20s\n", "", "MIP ROUTING TABLE");
     printf("%10s %s\n", "", lines);
     printf("%10s | %s | %s | %s | %s |\n", "", num, can_reach, via, hops);
     printf("%10s %s\n", "", lines);
 
-    qe = routing_table->head;
-
-    for (i = 0; i < (int) len; i++)
+    /* the best path of each destination, as it is advertised */
+    for (dest = 0, i = 0; dest < RTABLE_SLOTS; dest++)
     {
-        e = (struct mip_routing_table_entry*) qe->data;
-        printf("%10s | %d | %4d | %3d | %4d |\n", "", i, e->dest, e->next_hop, e->hops);
+        if (!routing_table->known[dest]) continue;
+
+        printf("%10s | %d | %4d | %3d | %4d |\n", "", i++, dest, 
+            routing_table->next_hop[dest], routing_table->hops[dest]);
         printf("%10s %25s\n", "", lines);
-        qe = qe->next;
     }
 }
 
-void mip_debug(arp_entry **arp_table, 
+void mip_debug(arp_table *arp_table, 
     uint8_t *src_mac, uint8_t *dest_mac, 
     uint8_t src_mip, uint8_t dest_mip)
 {
@@ -149,27 +152,34 @@ void mip_debug(arp_entry **arp_table,
     mip_print_arp_content(arp_table);
 }
 
-void mip_print_arp_content(arp_entry **entries)
+void mip_print_arp_content(arp_table *table)
 {
-    int i;
+    int i, n = 0;
     printf("\n%s\n", "ARP cache content\n");
 
-    if (entries[0] == NULL)
+    for (i = 0; i < table -> local_count; i++)
     {
-        printf("%s\n", "<daemon>: arp cache is empty...");
-        return;
+        printf("%d\n", n++);
+        mip_print_arp_entry(&table -> local[i]);
     }
 
-    for (i = 0; i < MAX_TABLE_SIZE && entries[i]; i++)
+    for (i = 0; i < ARP_TABLE_SIZE; i++)
     {
-        printf("%d\n", i);
-        mip_print_arp_entry(entries[i]);
+        if (table -> entries[i].state == ARP_NONE) continue;
+        printf("%d\n", n++);
+        mip_print_arp_entry(&table -> entries[i]);
+    }
+
+    if (n == 0)
+    {
+        printf("%s\n", "<daemon>: arp cache is empty...");
     }
 }
 
 void mip_print_arp_entry(arp_entry *e)
 {
     uint8_t local[MAC_ADDR_LEN] = LOCAL;
+    static const char *states[] = { "none", "permanent", "reachable", "stale", "probe", "failed" };
     printf("%-18s: %u\n", "MIP address", e -> mip_address);
     printf("%-18s: ", "MAC address");
     print_mac_address(e -> dest_mac_addr, MAC_ADDR_LEN);
@@ -178,6 +188,7 @@ void mip_print_arp_entry(arp_entry *e)
     if (memcmp(e -> interface, local, MAC_ADDR_LEN) == 0) printf("%-11s\n", "local");
     else print_mac_address(e -> interface, MAC_ADDR_LEN);
     printf("%-18s: %d\n", "Interface index", e -> ifindex);
+    printf("%-18s: %s\n", "State", states[e -> state]);
     printf("\n");
 }
 
@@ -191,23 +202,29 @@ void mip_print_arp_packet(mip_arp_sdu sdu)
     printf("%25s\n\n", " --- ARP packet --- ");
 }
 
-void mip_print_packet_queue(struct queue *q)
+void mip_print_pending_table(struct pending_table *pt)
 {
     int i;
-    size_t len = queue_length(q);
 
-    struct queue_entry *qe;
-    struct mip_sdu *e;
+    printf("%20s (%ld)\n", "PENDING PACKETS", pt->queued);
+    printf("%-25s: %ld\n", "Dropped, slot full", pt->dropped_full);
+    printf("%-25s: %ld\n", "Dropped, no route", pt->dropped_route);
+    printf("%-25s: %ld\n", "Dropped, no ARP reply", pt->dropped_arp);
+    printf("%-25s: %ld\n", "Dropped, lookup expired", pt->expired);
 
-    printf("%20s (%ld)\n", "PACKET QUEUE", len);
-
-    qe = q->head;
-
-    for (i = 0; i < (int) len; i++)
+    for (i = 0; i < PENDING_SLOTS; i++)
     {
-        e = (struct mip_sdu*) qe->data;
-        printf("%d\n", i);
-        mip_print_sdu(e, MIP_PING);
-        qe = qe->next;
+        if (!pt->route[i].depth && !pt->arp[i].depth && !pt->drops[i]) continue;
+        printf("%8s | %3d | route %2ld | arp %2ld | drops %ld\n", "", i, 
+            pt->route[i].depth, pt->arp[i].depth, pt->drops[i]);
     }
-}
\ No newline at end of file
+}
+
+void mip_print_pkt_buf(struct pkt_buf *buf)
+{
+    printf("\n%30s\n", "--- MIP SDU START ---");
+    printf("%20s %d\n", "Destination:", (uint8_t) buf->frame.sdu[0]);
+    printf("%20s %d\n", "TTL:", buf->frame.pdu.ttl);
+    printf("%7s%.*s%s\n", "\"", (int) buf->frame.pdu.sdu_len, buf->frame.sdu + 2, "\"");
+    printf("%29s\n\n", "--- MIP SDU END ---");
+}
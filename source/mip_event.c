@@ -0,0 +1,173 @@
+#include "../headers/mip_event.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+
+int event_loop_init(event_loop *loop, int budget)
+{
+    int i;
+
+    memset(loop, 0, sizeof(struct event_loop));
+    for (i = 0; i < EVENT_MAX_HANDLERS; i++) loop->handlers[i].fd = -1;
+    loop->budget = budget > 0 ? budget : 1;
+
+    loop->epoll_fd = epoll_create(1); /* argument is ignored in Linux 2.6.8 */
+    if (loop->epoll_fd == -1)
+    {
+        perror("epoll_create");
+        return -1;
+    }
+
+    return 0;
+}
+
+int event_add(event_loop *loop, int fd, int edge, event_handler_fn handle, void *arg)
+{
+    int i;
+    struct event_handler *h = NULL;
+    struct epoll_event ev = {0};
+
+    for (i = 0; i < EVENT_MAX_HANDLERS; i++)
+    {
+        if (loop->handlers[i].fd == -1)
+        {
+            h = &loop->handlers[i];
+            break;
+        }
+    }
+
+    if (h == NULL)
+    {
+        fprintf(stderr, "%s(): event table is full\n", __FUNCTION__);
+        return -1;
+    }
+
+    ev.events   = EPOLLIN | EPOLLHUP | (edge ? EPOLLET : 0);
+    ev.data.ptr = h;
+
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1)
+    {
+        perror("epoll_ctl");
+        return -1;
+    }
+
+    h->fd       = fd;
+    h->edge     = edge;
+    h->backlog  = 0;
+    h->handle   = handle;
+    h->arg      = arg;
+    return 0;
+}
+
+int event_remove(event_loop *loop, int fd)
+{
+    int i;
+    struct epoll_event ev = {0};
+
+    for (i = 0; i < EVENT_MAX_HANDLERS; i++)
+    {
+        if (loop->handlers[i].fd != fd) continue;
+
+        loop->handlers[i].fd = -1;
+        loop->handlers[i].backlog = 0;
+
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, &ev) == -1)
+        {
+            perror("epoll_ctl");
+            return -1;
+        }
+        return 0;
+    }
+
+    return -1;
+}
+
+int event_loop_run_once(event_loop *loop, int timeout)
+{
+    int i, j, rc, nready = 0, active, handled = 0;
+    int left[EVENT_MAX_HANDLERS];
+    struct event_handler *ready[EVENT_MAX_HANDLERS], *h;
+    struct epoll_event events[MAX_EVENTS];
+
+    /* fds that ran out of budget last round are revisited first */
+    for (i = 0; i < EVENT_MAX_HANDLERS; i++)
+    {
+        h = &loop->handlers[i];
+        if (h->fd == -1 || !h->backlog) continue;
+        h->backlog = 0;
+        ready[nready++] = h;
+    }
+
+    /* do not block while there is work left over */
+    rc = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, nready ? 0 : timeout);
+    loop->stats.waits++;
+    if (rc == -1)
+    {
+        if (errno == EINTR) return 0;
+        perror("epoll_wait");
+        return -1;
+    }
+    loop->stats.events += rc;
+
+    /* walk every ready event, not only the first one */
+    for (i = 0; i < rc; i++)
+    {
+        h = (struct event_handler*) events[i].data.ptr;
+        for (j = 0; j < nready && ready[j] != h; j++);
+        if (j == nready) ready[nready++] = h;
+    }
+
+    for (i = 0; i < nready; i++) left[i] = loop->budget;
+
+    /* round robin, one message per fd per pass, until all are drained or out of budget */
+    do
+    {
+        active = 0;
+        for (i = 0; i < nready; i++)
+        {
+            h = ready[i];
+            if (left[i] == 0) continue;
+
+            /* the handler was removed by an earlier handler in this round */
+            if (h->fd == -1)
+            {
+                left[i] = 0;
+                continue;
+            }
+
+            rc = h->handle(h->fd, h->arg);
+            loop->stats.calls++;
+            if (rc == -1) return -1;
+
+            if (rc == 0)
+            {
+                left[i] = 0;
+                continue;
+            }
+
+            handled++;
+            loop->stats.handled++;
+
+            /* an edge-triggered fd will not be reported again, remember it */
+            if (--left[i] == 0)
+            {
+                loop->stats.backlogs++;
+                if (h->edge) h->backlog = 1;
+                continue;
+            }
+
+            active = 1;
+        }
+    } while (active);
+
+    return handled;
+}
+
+void event_loop_close(event_loop *loop)
+{
+    if (loop->epoll_fd != -1) close(loop->epoll_fd);
+    loop->epoll_fd = -1;
+}
@@ -0,0 +1,265 @@
+#define _GNU_SOURCE                 /* recvmmsg */
+
+#include "../headers/mip_event.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+
+/*
+ * Microbenchmark for the event dispatch layer. The raw, application and
+ * routing sockets of the daemon are emulated with datagram socket pairs. For
+ * each burst size, packets are spread over the three sockets and then drained
+ * by the old loop (one read of events[0] per wakeup) and by the event layer,
+ * once with a recv() per packet and once with recvmmsg() batches the way the
+ * raw socket is read. Reports syscalls (epoll_wait() plus reads) per packet.
+ */
+
+#define BENCH_SOCKETS       3
+#define BENCH_ROUNDS        2000
+#define BENCH_PKT_SIZE      64
+#define BENCH_BATCH         32          /* as LINK_BATCH */
+
+static const int bursts[] = {1, 4, 16, 64};
+
+static int pairs[BENCH_SOCKETS][2];
+static size_t received, reads;
+
+/**
+ * Receive batch of one socket, read like the raw socket of the daemon.
+ * @param drained   Set if the last batch was short, so the socket is empty.
+ * */
+struct bench_batch {
+    int                 fd;
+    int                 count;
+    int                 next;
+    int                 drained;
+    struct mmsghdr      msgs[BENCH_BATCH];
+    struct iovec        iov[BENCH_BATCH];
+    char                bufs[BENCH_BATCH][BENCH_PKT_SIZE];
+};
+
+static struct bench_batch batches[BENCH_SOCKETS];
+
+static int bench_handle(int fd, void *arg)
+{
+    char buf[BENCH_PKT_SIZE];
+
+    (void) arg;
+
+    reads++;
+    if (recv(fd, buf, BENCH_PKT_SIZE, MSG_DONTWAIT) == -1)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        perror("recv");
+        return -1;
+    }
+
+    received++;
+    return 1;
+}
+
+/**
+ * Hands out one packet of the batch per call, and reads the next batch once
+ * it is used up. A short batch ends the drain without a read for EAGAIN.
+ * */
+static int bench_handle_batch(int fd, void *arg)
+{
+    int i, rc;
+    struct bench_batch *b = arg;
+
+    if (b->next == b->count)
+    {
+        if (b->drained)
+        {
+            b->drained = 0;
+            return 0;
+        }
+
+        for (i = 0; i < BENCH_BATCH; i++)
+        {
+            b->iov[i].iov_base              = b->bufs[i];
+            b->iov[i].iov_len               = BENCH_PKT_SIZE;
+            b->msgs[i].msg_hdr.msg_iov      = &b->iov[i];
+            b->msgs[i].msg_hdr.msg_iovlen   = 1;
+        }
+
+        b->next = b->count = 0;
+        reads++;
+        rc = recvmmsg(fd, b->msgs, BENCH_BATCH, MSG_DONTWAIT, NULL);
+        if (rc == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            perror("recvmmsg");
+            return -1;
+        }
+
+        b->count = rc;
+        b->drained = rc < BENCH_BATCH;
+    }
+
+    b->next++;
+    received++;
+    return 1;
+}
+
+static int bench_fill(int burst)
+{
+    int i;
+    char buf[BENCH_PKT_SIZE] = {0};
+
+    for (i = 0; i < burst; i++)
+    {
+        if (send(pairs[i % BENCH_SOCKETS][1], buf, BENCH_PKT_SIZE, 0) == -1)
+        {
+            perror("send");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static double elapsed_us(struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e6 + (now.tv_nsec - start->tv_nsec) / 1e3;
+}
+
+/**
+ * Drains bursts the way the daemons did before the event layer: level-triggered,
+ * only events[0] is looked at, one read per wakeup.
+ * */
+static int bench_legacy(int burst, size_t *syscalls, double *us)
+{
+    int epoll_fd, i, r, rc;
+    char buf[BENCH_PKT_SIZE];
+    struct epoll_event ev = {0}, events[MAX_EVENTS];
+    struct timespec start;
+
+    epoll_fd = epoll_create(1);
+    if (epoll_fd == -1)
+    {
+        perror("epoll_create");
+        return -1;
+    }
+
+    for (i = 0; i < BENCH_SOCKETS; i++)
+    {
+        ev.events = EPOLLIN;
+        ev.data.fd = pairs[i][0];
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pairs[i][0], &ev) == -1)
+        {
+            perror("epoll_ctl");
+            close(epoll_fd);
+            return -1;
+        }
+    }
+
+    *syscalls = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < BENCH_ROUNDS; r++)
+    {
+        if (bench_fill(burst) == -1) break;
+
+        for (received = 0; received < (size_t) burst; )
+        {
+            rc = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+            (*syscalls)++;
+            if (rc <= 0) break;
+
+            if (read(events->data.fd, buf, BENCH_PKT_SIZE) > 0) received++;
+            (*syscalls)++;
+        }
+    }
+    *us = elapsed_us(&start);
+
+    close(epoll_fd);
+    return r == BENCH_ROUNDS ? 0 : -1;
+}
+
+/**
+ * Drains bursts with the event layer, reading in batches if batch is set.
+ * */
+static int bench_event(int burst, int batch, size_t *syscalls, double *us)
+{
+    int i, r;
+    struct event_loop loop;
+    struct timespec start;
+
+    if (event_loop_init(&loop, EVENT_BUDGET) == -1) return -1;
+
+    reads = 0;
+    for (i = 0; i < BENCH_SOCKETS; i++)
+    {
+        memset(&batches[i], 0, sizeof(struct bench_batch));
+        if (event_add(&loop, pairs[i][0], EVENT_EDGE, batch ? bench_handle_batch : bench_handle,
+            &batches[i]) == -1)
+        {
+            event_loop_close(&loop);
+            return -1;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 0; r < BENCH_ROUNDS; r++)
+    {
+        if (bench_fill(burst) == -1) break;
+
+        for (received = 0; received < (size_t) burst; )
+        {
+            if (event_loop_run_once(&loop, -1) == -1) break;
+        }
+    }
+    *us = elapsed_us(&start);
+    *syscalls = loop.stats.waits + reads;
+
+    event_loop_close(&loop);
+    return r == BENCH_ROUNDS ? 0 : -1;
+}
+
+int main()
+{
+    int i, b;
+    size_t legacy_calls, event_calls, batch_calls, pkts;
+    double legacy_us, event_us, batch_us;
+
+    for (i = 0; i < BENCH_SOCKETS; i++)
+    {
+        if (socketpair(AF_UNIX, SOCK_DGRAM, 0, pairs[i]) == -1)
+        {
+            perror("socketpair");
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("%-8s %-12s %-12s %-12s %-12s %-12s %-12s\n", "burst", "legacy", "event",
+        "batched", "legacy", "event", "batched");
+    printf("%-8s %-38s %-38s\n", "", "syscalls/pkt", "ns/pkt");
+
+    for (b = 0; b < (int) (sizeof(bursts) / sizeof(bursts[0])); b++)
+    {
+        if (bench_legacy(bursts[b], &legacy_calls, &legacy_us) == -1) return EXIT_FAILURE;
+        if (bench_event(bursts[b], 0, &event_calls, &event_us) == -1) return EXIT_FAILURE;
+        if (bench_event(bursts[b], 1, &batch_calls, &batch_us) == -1) return EXIT_FAILURE;
+
+        pkts = (size_t) BENCH_ROUNDS * bursts[b];
+        printf("%-8d %-12.2f %-12.2f %-12.2f %-12.0f %-12.0f %-12.0f\n", bursts[b],
+            (double) legacy_calls / pkts, (double) event_calls / pkts,
+            (double) batch_calls / pkts, legacy_us * 1e3 / pkts, event_us * 1e3 / pkts,
+            batch_us * 1e3 / pkts);
+    }
+
+    for (i = 0; i < BENCH_SOCKETS; i++)
+    {
+        close(pairs[i][0]);
+        close(pairs[i][1]);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,95 @@
+#include "../headers/mip_fib.h"
+#include "../headers/mip_routing.h"
+#include "../headers/mip.h"
+
+#include <string.h>         /* memset, memcpy, memcmp */
+
+void mip_fib_init(mip_fib *fib)
+{
+    memset(fib, 0, sizeof(struct mip_fib));
+}
+
+uint32_t mip_flow_hash(uint8_t src, uint8_t dest, uint8_t sdu_type, uint8_t self)
+{
+    uint32_t h = (uint32_t) src << 24 | (uint32_t) dest << 16 | (uint32_t) sdu_type << 8 | self;
+
+    /* murmur3 finalizer, every input bit flips about half of the output */
+    h ^= h >> 16;
+    h *= 0x85EBCA6B;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35;
+    h ^= h >> 16;
+    return h;
+}
+
+int mip_fib_lookup(mip_fib *fib, uint8_t dest, uint32_t hash, uint8_t *next_hop)
+{
+    struct mip_fib_entry *e = &fib->entries[dest];
+
+    if (!e->valid) return 1;
+
+    /* scales the hash to the number of paths without a division */
+    *next_hop = e->next_hop[((uint64_t) hash * e->paths) >> 32];
+    return 0;
+}
+
+int mip_fib_update(mip_fib *fib, uint8_t dest, const uint8_t *next_hops, int count,
+    uint8_t hops)
+{
+    struct mip_fib_entry *e = &fib->entries[dest];
+
+    if (count > FIB_MAX_PATHS) count = FIB_MAX_PATHS;
+
+    /* withdrawal */
+    if (hops == INFINITY || count == 0 || next_hops[0] == MAX_MIP_ADDR)
+    {
+        if (!e->valid) return 0;
+        e->valid = 0;
+        fib->size--;
+        return 1;
+    }
+
+    if (e->valid && e->hops == hops && e->paths == count
+        && !memcmp(e->next_hop, next_hops, count)) return 0;
+
+    if (!e->valid) fib->size++;
+    memcpy(e->next_hop, next_hops, count);
+    e->paths    = count;
+    e->hops     = hops;
+    e->valid    = 1;
+    return 1;
+}
+
+/**
+ * Checks that the entries of a delta end exactly where the message does.
+ * */
+static int fib_delta_valid(const uint8_t *entries, size_t len)
+{
+    size_t off = 0;
+
+    while (off < len)
+    {
+        if (off + FIB_ENTRY_SIZE > len) return 0;
+        off += FIB_ENTRY_SIZE + entries[off + 2];
+    }
+
+    return off == len;
+}
+
+int mip_fib_apply_delta(mip_fib *fib, const uint8_t *entries, size_t len)
+{
+    int changed = 0;
+    size_t off;
+
+    /* checked whole first, the packets waiting on the routes of a delta are */
+    /* only released if it applied */
+    if (!fib_delta_valid(entries, len)) return -1;
+
+    for (off = 0; off < len; off += FIB_ENTRY_SIZE + entries[off + 2])
+    {
+        changed += mip_fib_update(fib, entries[off], entries + off + FIB_ENTRY_SIZE,
+            entries[off + 2], entries[off + 1]);
+    }
+
+    return changed;
+}
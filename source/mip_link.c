@@ -0,0 +1,669 @@
+#define _GNU_SOURCE                 /* recvmmsg, sendmmsg */
+
+#include "../headers/mip_link.h"
+#include "../headers/common.h"
+#include "../headers/utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <linux/if_packet.h>
+#include <arpa/inet.h>            /* htons */
+
+/**
+ * Preallocated frames and message headers for one direction of the link.
+ * @param msgs      Message headers passed to recvmmsg()/sendmmsg().
+ * @param iov       One iovec per frame, pointing at frames.
+ * @param names     Link layer address of each frame.
+ * @param frames    The frames.
+ * @param count     Number of frames in the batch.
+ * @param next      Next received frame to hand out. Unused for sending.
+ * @param borrowed  Number of queued frames whose iovec points at a received
+ *                  frame instead. Unused for receiving.
+ * @param drained   Set if the last recvmmsg() returned a short batch, so the
+ *                  socket was empty. Unused for sending.
+ * */
+struct link_batch {
+    struct mmsghdr          msgs[LINK_BATCH];
+    struct iovec            iov[LINK_BATCH];
+    struct sockaddr_ll      names[LINK_BATCH];
+    struct link_frame       frames[LINK_BATCH];
+    int                     count;
+    int                     next;
+    int                     borrowed;
+    int                     drained;
+};
+
+/**
+ * TPACKET_V3 receive ring mapped from the kernel.
+ * @param map       Start of the mapping, NULL if the ring is not in use.
+ * @param map_len   Length of the mapping.
+ * @param block     Index of the block being read.
+ * @param pkt       Next packet in the block, NULL if the block is not held.
+ * @param left      Packets left to hand out from the block.
+ * */
+struct link_ring {
+    char                    *map;
+    size_t                  map_len;
+    unsigned int            block;
+    struct tpacket3_hdr     *pkt;
+    unsigned int            left;
+};
+
+/**
+ * TPACKET_V2 transmit ring on a socket of its own. Frames are written into
+ * slots in ring order and sent by one send() per run of frames to the same
+ * interface.
+ * @param fd        The sending socket. Binds no protocol, so it receives nothing.
+ * @param map       Start of the mapping, NULL if the ring is not in use.
+ * @param map_len   Length of the mapping.
+ * @param head      Next slot to write.
+ * @param pending   Number of written slots not yet kicked.
+ * @param ifindex   Interface of the pending slots.
+ * */
+struct link_tx_ring {
+    int                     fd;
+    char                    *map;
+    size_t                  map_len;
+    unsigned int            head;
+    unsigned int            pending;
+    int                     ifindex;
+};
+
+/**
+ * State of the raw socket backend.
+ * @param raw_socket    The AF_PACKET socket.
+ * @param flags         The LINK_* flags of the link.
+ * @param rx            Received frames not yet handed out.
+ * @param tx            Frames queued for sending.
+ * @param ring          The receive ring, if LINK_RX_RING is set.
+ * @param tx_ring       The transmit ring, if LINK_TX_RING is set.
+ * */
+struct raw_link {
+    int                     raw_socket;
+    int                     flags;
+    struct link_batch       rx;
+    struct link_batch       tx;
+    struct link_ring        ring;
+    struct link_tx_ring     tx_ring;
+};
+
+static void link_batch_init(struct link_batch *b)
+{
+    int i;
+
+    for (i = 0; i < LINK_BATCH; i++)
+    {
+        b->iov[i].iov_base              = &b->frames[i];
+        b->iov[i].iov_len               = sizeof(struct link_frame);
+        b->msgs[i].msg_hdr.msg_name     = &b->names[i];
+        b->msgs[i].msg_hdr.msg_namelen  = sizeof(struct sockaddr_ll);
+        b->msgs[i].msg_hdr.msg_iov      = &b->iov[i];
+        b->msgs[i].msg_hdr.msg_iovlen   = 1;
+    }
+}
+
+static int link_ring_setup(struct raw_link *link)
+{
+    int version = TPACKET_V3;
+    struct tpacket_req3 req = {0};
+
+    if (setsockopt(link->raw_socket, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1)
+    {
+        perror("setsockopt PACKET_VERSION");
+        return -1;
+    }
+
+    req.tp_block_size       = LINK_RING_BLOCK_SIZE;
+    req.tp_block_nr         = LINK_RING_BLOCKS;
+    req.tp_frame_size       = LINK_RING_FRAME_SIZE;
+    req.tp_frame_nr         = LINK_RING_BLOCK_SIZE / LINK_RING_FRAME_SIZE * LINK_RING_BLOCKS;
+    req.tp_retire_blk_tov   = LINK_RING_RETIRE_MS;
+
+    if (setsockopt(link->raw_socket, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1)
+    {
+        perror("setsockopt PACKET_RX_RING");
+        return -1;
+    }
+
+    link->ring.map_len = (size_t) LINK_RING_BLOCK_SIZE * LINK_RING_BLOCKS;
+    link->ring.map = mmap(NULL, link->ring.map_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_LOCKED, link->raw_socket, 0);
+    if (link->ring.map == MAP_FAILED)
+    {
+        perror("mmap");
+        link->ring.map = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+static struct tpacket2_hdr *link_tx_slot(struct link_tx_ring *ring, unsigned int i)
+{
+    return (struct tpacket2_hdr*) (ring->map + (size_t) i * LINK_TX_FRAME_SIZE);
+}
+
+/* with SOCK_RAW, the frame starts where the sockaddr_ll of a received frame would be */
+static struct link_frame *link_tx_data(struct tpacket2_hdr *slot)
+{
+    return (struct link_frame*) ((char*) slot + TPACKET2_HDRLEN - sizeof(struct sockaddr_ll));
+}
+
+static int link_tx_ring_setup(struct raw_link *link)
+{
+    unsigned int i;
+    int version = TPACKET_V2;
+    struct tpacket_req req = {0};
+    struct link_tx_ring *ring = &link->tx_ring;
+
+    ring->fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (ring->fd == -1)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    if (setsockopt(ring->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1)
+    {
+        perror("setsockopt PACKET_VERSION");
+        return -1;
+    }
+
+    req.tp_block_size   = LINK_TX_BLOCK_SIZE;
+    req.tp_block_nr     = LINK_TX_BLOCKS;
+    req.tp_frame_size   = LINK_TX_FRAME_SIZE;
+    req.tp_frame_nr     = LINK_TX_FRAMES;
+
+    if (setsockopt(ring->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) == -1)
+    {
+        perror("setsockopt PACKET_TX_RING");
+        return -1;
+    }
+
+    ring->map_len = (size_t) LINK_TX_BLOCK_SIZE * LINK_TX_BLOCKS;
+    ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+    if (ring->map == MAP_FAILED)
+    {
+        perror("mmap");
+        ring->map = NULL;
+        return -1;
+    }
+
+    /* every MIP frame has the same ethertype, write it once */
+    for (i = 0; i < LINK_TX_FRAMES; i++)
+    {
+        link_tx_data(link_tx_slot(ring, i))->hdr.eth_proto[0] = ETH_P_MIP >> 8;
+        link_tx_data(link_tx_slot(ring, i))->hdr.eth_proto[1] = ETH_P_MIP & 0xFF;
+    }
+
+    return 0;
+}
+
+/**
+ * Hands out the next frame from the receive ring, in place. A block is given
+ * back to the kernel when every frame in it has been handed out, on the call
+ * after its last frame, so the last frame stays valid until then.
+ * */
+static int link_ring_next(mip_link *link, struct link_frame **frame, struct sockaddr_ll **addr)
+{
+    struct raw_link *raw = link->state;
+    struct link_ring *ring = &raw->ring;
+    struct tpacket_block_desc *desc;
+    struct tpacket3_hdr *pkt;
+
+    if (ring->pkt != NULL && ring->left == 0)
+    {
+        /* frames forwarded in place are sent before the kernel gets the block back */
+        if (raw->tx.borrowed && link_flush(link) == -1) return -1;
+
+        desc = (struct tpacket_block_desc*) (ring->map + (size_t) ring->block * LINK_RING_BLOCK_SIZE);
+        __atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        ring->block = (ring->block + 1) % LINK_RING_BLOCKS;
+        ring->pkt = NULL;
+    }
+
+    if (ring->pkt == NULL)
+    {
+        desc = (struct tpacket_block_desc*) (ring->map + (size_t) ring->block * LINK_RING_BLOCK_SIZE);
+        if (!(__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+            return RECV_AGAIN;
+
+        ring->pkt  = (struct tpacket3_hdr*) ((char*) desc + desc->hdr.bh1.offset_to_first_pkt);
+        ring->left = desc->hdr.bh1.num_pkts;
+        link->stats.rx_batches++;
+        link->stats.rx_frames += ring->left;
+
+        /* a block can be retired by timeout with no packets in it */
+        if (ring->left == 0) return link_ring_next(link, frame, addr);
+    }
+
+    pkt = ring->pkt;
+    *frame = (struct link_frame*) ((char*) pkt + pkt->tp_mac);
+    *addr = (struct sockaddr_ll*) ((char*) pkt + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+
+    ring->left--;
+    ring->pkt = (struct tpacket3_hdr*) ((char*) pkt + pkt->tp_next_offset);
+
+    /* keep the block held until the next call */
+    if (ring->left == 0) ring->pkt = pkt;
+
+    return pkt->tp_snaplen;
+}
+
+static int raw_next(mip_link *link, struct link_frame **frame, struct sockaddr_ll **addr)
+{
+    int i, rc;
+    struct raw_link *raw = link->state;
+    struct link_batch *rx = &raw->rx;
+
+    if (raw->ring.map != NULL) return link_ring_next(link, frame, addr);
+
+    if (rx->next == rx->count)
+    {
+        /* a short batch emptied the socket, and a frame that arrived since */
+        /* raises a new edge, so the read that would only get EAGAIN is skipped */
+        if (rx->drained)
+        {
+            rx->drained = 0;
+            return RECV_AGAIN;
+        }
+
+        /* frames forwarded in place are sent before the batch is read over */
+        if (raw->tx.borrowed && link_flush(link) == -1) return -1;
+
+        /* recvmmsg() writes back the lengths, reset them for the next batch */
+        for (i = 0; i < LINK_BATCH; i++)
+        {
+            rx->iov[i].iov_len              = sizeof(struct link_frame);
+            rx->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_ll);
+            rx->msgs[i].msg_hdr.msg_flags   = 0;
+        }
+
+        rx->next = rx->count = 0;
+        rc = recvmmsg(raw->raw_socket, rx->msgs, LINK_BATCH, MSG_DONTWAIT, NULL);
+        if (rc == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return RECV_AGAIN;
+            perror("recvmmsg");
+            return -1;
+        }
+
+        rx->count = rc;
+        rx->drained = rc < LINK_BATCH;
+        link->stats.rx_batches++;
+        link->stats.rx_frames += rc;
+    }
+
+    i = rx->next++;
+    *frame = &rx->frames[i];
+    *addr = &rx->names[i];
+    return rx->msgs[i].msg_len;
+}
+
+/**
+ * Sends every written slot of the transmit ring.
+ * @param link      The link.
+ * @param flags     0 to wait until the frames are sent, MSG_DONTWAIT otherwise.
+ * */
+static int link_tx_kick(mip_link *link, int flags)
+{
+    int wc;
+    struct sockaddr_ll to = {0};
+    struct link_tx_ring *ring = &((struct raw_link*) link->state)->tx_ring;
+
+    to.sll_family   = AF_PACKET;
+    to.sll_protocol = htons(ETH_P_MIP);
+    to.sll_ifindex  = ring->ifindex;
+
+    wc = sendto(ring->fd, NULL, 0, flags, (struct sockaddr*) &to, sizeof(struct sockaddr_ll));
+    if (wc == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+    {
+        perror("sendto");
+        link->stats.tx_dropped += ring->pending;
+        ring->pending = 0;
+        return -1;
+    }
+
+    if (ring->pending)
+    {
+        link->stats.tx_batches++;
+        link->stats.tx_frames += ring->pending;
+    }
+
+    wc = ring->pending;
+    ring->pending = 0;
+    return wc;
+}
+
+static struct link_frame *link_tx_ring_reserve(mip_link *link, const struct sockaddr_ll *to)
+{
+    uint32_t status;
+    struct link_tx_ring *ring = &((struct raw_link*) link->state)->tx_ring;
+    struct tpacket2_hdr *slot;
+
+    /* one send() covers one interface, so a change of interface ends the batch */
+    if (ring->pending && to->sll_ifindex != ring->ifindex && link_tx_kick(link, MSG_DONTWAIT) == -1)
+        return NULL;
+
+    slot = link_tx_slot(ring, ring->head);
+    status = __atomic_load_n(&slot->tp_status, __ATOMIC_ACQUIRE);
+
+    /* the kernel rejected the frame last time this slot was used */
+    if (status == TP_STATUS_WRONG_FORMAT)
+    {
+        link->stats.tx_dropped++;
+        status = TP_STATUS_AVAILABLE;
+    }
+
+    /* the ring has wrapped around to frames that are not sent yet, wait for them */
+    if (status != TP_STATUS_AVAILABLE)
+    {
+        if (link_tx_kick(link, 0) == -1) return NULL;
+        status = __atomic_load_n(&slot->tp_status, __ATOMIC_ACQUIRE);
+        if (status != TP_STATUS_AVAILABLE && status != TP_STATUS_WRONG_FORMAT)
+        {
+            fprintf(stderr, "%s(): transmit ring is full\n", __FUNCTION__);
+            return NULL;
+        }
+    }
+
+    ring->ifindex = to->sll_ifindex;
+    return link_tx_data(slot);
+}
+
+static struct link_frame *raw_reserve(mip_link *link, const struct sockaddr_ll *to)
+{
+    struct raw_link *raw = link->state;
+    struct link_batch *tx = &raw->tx;
+
+    if (raw->tx_ring.map != NULL) return link_tx_ring_reserve(link, to);
+
+    if (tx->count == LINK_BATCH && link_flush(link) == -1) return NULL;
+
+    memcpy(&tx->names[tx->count], to, sizeof(struct sockaddr_ll));
+    return &tx->frames[tx->count];
+}
+
+static void raw_commit(mip_link *link, size_t sdu_len)
+{
+    struct raw_link *raw = link->state;
+    struct link_tx_ring *ring = &raw->tx_ring;
+    struct tpacket2_hdr *slot;
+
+    if (ring->map != NULL)
+    {
+        slot = link_tx_slot(ring, ring->head);
+        slot->tp_len = LINK_HEADER_SIZE + sdu_len;
+        __atomic_store_n(&slot->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+        ring->head = (ring->head + 1) % LINK_TX_FRAMES;
+        ring->pending++;
+        return;
+    }
+
+    raw->tx.iov[raw->tx.count++].iov_len = LINK_HEADER_SIZE + sdu_len;
+}
+
+/**
+ * Queues a received frame by pointing an iovec of the transmit batch at it,
+ * so sendmmsg() reads it where it was received. A transmit ring slot can only
+ * be written, so the frame is copied into it instead.
+ * */
+static int raw_forward(mip_link *link, const struct sockaddr_ll *to,
+    struct link_frame *frame, size_t sdu_len)
+{
+    struct raw_link *raw = link->state;
+    struct link_batch *tx = &raw->tx;
+
+    if (raw->tx_ring.map != NULL)
+        return link_queue_frame(link, to, &frame->hdr, &frame->pdu, frame->sdu, sdu_len);
+
+    if (tx->count == LINK_BATCH && link_flush(link) == -1) return -1;
+
+    memcpy(&tx->names[tx->count], to, sizeof(struct sockaddr_ll));
+    tx->iov[tx->count].iov_base = frame;
+    tx->iov[tx->count].iov_len  = LINK_HEADER_SIZE + sdu_len;
+    tx->count++;
+    tx->borrowed++;
+    link->stats.tx_in_place++;
+    return 0;
+}
+
+/**
+ * Points the iovecs of frames forwarded in place back at the frames of the
+ * transmit batch, once they are sent or dropped.
+ * */
+static void raw_reclaim(struct link_batch *tx)
+{
+    int i;
+
+    if (tx->borrowed == 0) return;
+
+    for (i = 0; i < tx->count; i++) tx->iov[i].iov_base = &tx->frames[i];
+    tx->borrowed = 0;
+}
+
+static int raw_flush(mip_link *link)
+{
+    int sent = 0, wc;
+    struct raw_link *raw = link->state;
+    struct link_batch *tx = &raw->tx;
+
+    if (raw->tx_ring.map != NULL)
+    {
+        return raw->tx_ring.pending ? link_tx_kick(link, MSG_DONTWAIT) : 0;
+    }
+
+    while (sent < tx->count)
+    {
+        wc = sendmmsg(raw->raw_socket, tx->msgs + sent, tx->count - sent, 0);
+        if (wc == -1)
+        {
+            if (errno == EINTR) continue;
+            perror("sendmmsg");
+            link->stats.tx_dropped += tx->count - sent;
+            raw_reclaim(tx);
+            tx->count = 0;
+            return -1;
+        }
+
+        link->stats.tx_batches++;
+        link->stats.tx_frames += wc;
+        sent += wc;
+    }
+
+    raw_reclaim(tx);
+    tx->count = 0;
+    return sent;
+}
+
+static int raw_discover(mip_link *link, struct network_interfaces *ifs)
+{
+    (void) link;
+    return get_mac_from_interface(ifs);
+}
+
+static void raw_close(mip_link *link)
+{
+    struct raw_link *raw = link->state;
+
+    if (raw == NULL) return;
+    if (raw->ring.map != NULL) munmap(raw->ring.map, raw->ring.map_len);
+    if (raw->tx_ring.map != NULL) munmap(raw->tx_ring.map, raw->tx_ring.map_len);
+    if (raw->tx_ring.fd != -1) close(raw->tx_ring.fd);
+    free(raw);
+}
+
+static const struct link_ops raw_ops = {
+    .name       = "raw",
+    .discover   = raw_discover,
+    .next       = raw_next,
+    .reserve    = raw_reserve,
+    .commit     = raw_commit,
+    .forward    = raw_forward,
+    .flush      = raw_flush,
+    .close      = raw_close,
+};
+
+mip_link *link_new(const struct link_ops *ops, void *state, int fd, int timer_fd)
+{
+    mip_link *link;
+
+    link = allocate_memory(sizeof(struct mip_link));
+    if (link == NULL) return NULL;
+
+    link->ops = ops;
+    link->state = state;
+    link->fd = fd;
+    link->timer_fd = timer_fd;
+    return link;
+}
+
+mip_link *link_create(int raw_socket, int flags)
+{
+    int one = 1;
+    struct raw_link *raw;
+    mip_link *link;
+
+    raw = allocate_memory(sizeof(struct raw_link));
+    if (raw == NULL) return NULL;
+
+    raw->raw_socket = raw_socket;
+    raw->flags = flags;
+    raw->tx_ring.fd = -1;
+    link_batch_init(&raw->rx);
+    link_batch_init(&raw->tx);
+
+    link = link_new(&raw_ops, raw, raw_socket, -1);
+    if (link == NULL)
+    {
+        free(raw);
+        return NULL;
+    }
+
+    if ((flags & LINK_RX_RING) && link_ring_setup(raw) == -1)
+    {
+        free_link(link);
+        return NULL;
+    }
+
+    if ((flags & LINK_TX_RING) && link_tx_ring_setup(raw) == -1)
+    {
+        free_link(link);
+        return NULL;
+    }
+
+    /* hand frames straight to the driver, without the qdisc layer */
+    if ((flags & LINK_QDISC_BYPASS) &&
+        setsockopt(raw->tx_ring.map != NULL ? raw->tx_ring.fd : raw_socket,
+            SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one)) == -1)
+    {
+        perror("setsockopt PACKET_QDISC_BYPASS");
+        free_link(link);
+        return NULL;
+    }
+
+    return link;
+}
+
+int link_discover(mip_link *link, struct network_interfaces *ifs)
+{
+    return link->ops->discover(link, ifs);
+}
+
+int link_next_frame(mip_link *link, struct link_frame **frame, struct sockaddr_ll **addr)
+{
+    int rc;
+
+    /* the raw socket also sees frames we send through another socket */
+    while ((rc = link->ops->next(link, frame, addr)) >= 0 && (*addr)->sll_pkttype == PACKET_OUTGOING);
+
+    return rc;
+}
+
+struct link_frame *link_reserve_frame(mip_link *link, const struct sockaddr_ll *to)
+{
+    return link->ops->reserve(link, to);
+}
+
+void link_commit_frame(mip_link *link, size_t sdu_len)
+{
+    link->ops->commit(link, sdu_len);
+}
+
+int link_queue_frame(mip_link *link, const struct sockaddr_ll *to,
+    const struct frame_header *hdr, const struct mip_pdu *pdu,
+    const void *sdu, size_t sdu_len)
+{
+    struct link_frame *frame;
+
+    if (sdu_len > MAX_MSG_SIZE)
+    {
+        fprintf(stderr, "%s(): sdu of %ld bytes is too large\n", __FUNCTION__, sdu_len);
+        return -1;
+    }
+
+    frame = link_reserve_frame(link, to);
+    if (frame == NULL) return -1;
+
+    /* the ethertype of a ring slot is already in place */
+    memcpy(&frame->hdr, hdr, 2 * MAC_ADDR_LEN);
+    frame->hdr.eth_proto[0] = ETH_P_MIP >> 8;
+    frame->hdr.eth_proto[1] = ETH_P_MIP & 0xFF;
+    memcpy(&frame->pdu, pdu, sizeof(struct mip_pdu));
+    memcpy(frame->sdu, sdu, sdu_len);
+
+    link_commit_frame(link, sdu_len);
+    return 0;
+}
+
+int link_forward_frame(mip_link *link, const struct sockaddr_ll *to,
+    struct link_frame *frame, size_t sdu_len)
+{
+    if (sdu_len > MAX_MSG_SIZE)
+    {
+        fprintf(stderr, "%s(): sdu of %ld bytes is too large\n", __FUNCTION__, sdu_len);
+        return -1;
+    }
+
+    /* a backend that holds on to queued frames has them copied */
+    if (link->ops->forward == NULL)
+        return link_queue_frame(link, to, &frame->hdr, &frame->pdu, frame->sdu, sdu_len);
+
+    return link->ops->forward(link, to, frame, sdu_len);
+}
+
+int link_flush(mip_link *link)
+{
+    return link->ops->flush(link);
+}
+
+int link_timer(mip_link *link)
+{
+    uint64_t expirations;
+
+    if (read(link->timer_fd, &expirations, sizeof(uint64_t)) == -1 &&
+        errno != EAGAIN && errno != EWOULDBLOCK)
+    {
+        perror("read");
+        return -1;
+    }
+
+    return link->ops->flush(link);
+}
+
+const struct link_stats *link_get_stats(mip_link *link)
+{
+    return &link->stats;
+}
+
+void free_link(mip_link *link)
+{
+    if (link == NULL) return;
+    link->ops->close(link);
+    free(link);
+}
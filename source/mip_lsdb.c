@@ -0,0 +1,317 @@
+#include "../headers/mip_lsdb.h"
+#include "../headers/mip.h"
+
+#include <string.h>         /* memset, memcpy */
+
+/**
+ * Binary min-heap of hosts on their distance, ties broken on MIP address.
+ * The position of each host is kept, so a host whose distance gets shorter
+ * is moved up in place instead of being pushed twice.
+ * @param node      The hosts, heap ordered.
+ * @param pos       Index of each host in node, -1 if it is not in the heap.
+ * @param size      Number of hosts in the heap.
+ * */
+struct spf_heap {
+    uint8_t                 node[RTABLE_SLOTS];
+    int16_t                 pos[RTABLE_SLOTS];
+    int                     size;
+};
+
+static int heap_less(const lsdb *db, uint8_t a, uint8_t b)
+{
+    return db->dist[a] < db->dist[b] || (db->dist[a] == db->dist[b] && a < b);
+}
+
+static void heap_swap(struct spf_heap *h, int i, int j)
+{
+    uint8_t tmp = h->node[i];
+
+    h->node[i] = h->node[j];
+    h->node[j] = tmp;
+    h->pos[h->node[i]] = i;
+    h->pos[h->node[j]] = j;
+}
+
+static void heap_init(struct spf_heap *h)
+{
+    memset(h->pos, 0xFF, sizeof(h->pos));
+    h->size = 0;
+}
+
+/**
+ * Inserts a host, or moves it up if its distance got shorter.
+ * */
+static void heap_push(const lsdb *db, struct spf_heap *h, uint8_t v)
+{
+    int i = h->pos[v], parent;
+
+    if (i == -1)
+    {
+        i = h->size++;
+        h->node[i] = v;
+        h->pos[v] = i;
+    }
+
+    while (i > 0)
+    {
+        parent = (i - 1) / 2;
+        if (!heap_less(db, h->node[i], h->node[parent])) break;
+        heap_swap(h, i, parent);
+        i = parent;
+    }
+}
+
+static uint8_t heap_pop(const lsdb *db, struct spf_heap *h)
+{
+    int i = 0, child;
+    uint8_t top = h->node[0];
+
+    heap_swap(h, 0, --h->size);
+    h->pos[top] = -1;
+
+    while ((child = 2 * i + 1) < h->size)
+    {
+        if (child + 1 < h->size && heap_less(db, h->node[child + 1], h->node[child])) child++;
+        if (!heap_less(db, h->node[child], h->node[i])) break;
+        heap_swap(h, i, child);
+        i = child;
+    }
+
+    return top;
+}
+
+/**
+ * Checks if the advert of a lists b.
+ * */
+static int has_link(const lsdb *db, uint8_t a, uint8_t b)
+{
+    int i;
+    const struct lsa *l = &db->lsa[a];
+
+    for (i = 0; i < l->count; i++)
+    {
+        if (l->links[i] == b) return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Makes v one hop further than u, or adds the first hops of u to those of v
+ * if it already is, and queues v if anything changed.
+ * */
+static void reach(lsdb *db, struct spf_heap *h, uint8_t u, uint8_t v)
+{
+    int i;
+    uint64_t *to = db->first_hops[v], grown = 0;
+
+    if (db->dist[u] + 1 < db->dist[v])
+    {
+        db->dist[v] = db->dist[u] + 1;
+        memset(to, 0, sizeof(db->first_hops[v]));
+    }
+
+    if (u == db->mip_address)
+    {
+        grown = ~to[v / 64] & (uint64_t) 1 << (v % 64);
+        to[v / 64] |= grown;
+    }
+
+    for (i = 0; u != db->mip_address && i < LSDB_SET_WORDS; i++)
+    {
+        grown |= db->first_hops[u][i] & ~to[i];
+        to[i] |= db->first_hops[u][i];
+    }
+
+    if (grown) heap_push(db, h, v);
+}
+
+/**
+ * Runs Dijkstra from the hosts in the heap, relaxing the links that both
+ * ends advertise. A host is popped after every host closer than it, so its
+ * first hops are complete by then.
+ * */
+static void relax(lsdb *db, struct spf_heap *h)
+{
+    int i;
+    uint8_t u, v;
+    const struct lsa *l;
+
+    while (h->size)
+    {
+        u = heap_pop(db, h);
+        l = &db->lsa[u];
+
+        for (i = 0; i < l->count; i++)
+        {
+            v = l->links[i];
+            if (db->dist[u] + 1 > db->dist[v] || !has_link(db, v, u)) continue;
+            reach(db, h, u, v);
+        }
+    }
+}
+
+static void spf_full(lsdb *db)
+{
+    struct spf_heap h;
+    uint8_t self = db->mip_address;
+
+    memset(db->dist, INFINITY, RTABLE_SLOTS);
+    memset(db->first_hops, 0, sizeof(db->first_hops));
+    db->dist[self] = 0;
+
+    heap_init(&h);
+    heap_push(db, &h, self);
+    relax(db, &h);
+    db->full_runs++;
+}
+
+/**
+ * A link that came up can only make paths shorter or add equal ones, so only
+ * the end it brings closer and the hosts behind it are relaxed.
+ * */
+static void spf_link_up(lsdb *db, uint8_t a, uint8_t b)
+{
+    struct spf_heap h;
+
+    heap_init(&h);
+    if (db->dist[a] != INFINITY && db->dist[a] + 1 <= db->dist[b]) reach(db, &h, a, b);
+    else if (db->dist[b] != INFINITY && db->dist[b] + 1 <= db->dist[a]) reach(db, &h, b, a);
+    if (h.size == 0) return;
+
+    relax(db, &h);
+    db->incremental++;
+}
+
+/**
+ * Brings the tree up to date after the advert of origin changed from old.
+ * A link going down that no shortest path used changes no path.
+ * */
+static void apply_change(lsdb *db, uint8_t origin, const struct lsa *old)
+{
+    int i;
+    uint8_t x;
+    const struct lsa *l = &db->lsa[origin];
+
+    for (i = 0; i < old->count; i++)
+    {
+        x = old->links[i];
+        if (has_link(db, origin, x) || !has_link(db, x, origin)) continue;
+
+        if (db->dist[x] != INFINITY && (db->dist[x] == db->dist[origin] + 1
+            || db->dist[origin] == db->dist[x] + 1))
+        {
+            spf_full(db);
+            return;
+        }
+    }
+
+    for (i = 0; i < l->count; i++)
+    {
+        x = l->links[i];
+        if (has_link(db, x, origin)) spf_link_up(db, origin, x);
+    }
+}
+
+void lsdb_init(lsdb *db, uint8_t mip_address)
+{
+    memset(db, 0, sizeof(struct lsdb));
+    db->mip_address = mip_address;
+    db->lsa[mip_address].present = 1;
+    spf_full(db);
+}
+
+int lsdb_link_up(lsdb *db, uint8_t neighbour)
+{
+    struct lsa *l = &db->lsa[db->mip_address];
+    struct lsa old = *l;
+
+    if (has_link(db, db->mip_address, neighbour) || l->count == LSDB_MAX_LINKS) return 0;
+
+    l->links[l->count++] = neighbour;
+    l->seq++;
+    apply_change(db, db->mip_address, &old);
+    return 1;
+}
+
+int lsdb_link_down(lsdb *db, uint8_t neighbour)
+{
+    int i;
+    struct lsa *l = &db->lsa[db->mip_address];
+    struct lsa old = *l;
+
+    for (i = 0; i < l->count; i++)
+    {
+        if (l->links[i] == neighbour) break;
+    }
+    if (i == l->count) return 0;
+
+    l->links[i] = l->links[--l->count];
+    l->seq++;
+    apply_change(db, db->mip_address, &old);
+    return 1;
+}
+
+void lsdb_refresh(lsdb *db)
+{
+    db->lsa[db->mip_address].seq++;
+}
+
+int lsdb_adjacent(const lsdb *db, uint8_t neighbour)
+{
+    return has_link(db, db->mip_address, neighbour);
+}
+
+int lsdb_merge(lsdb *db, uint8_t origin, uint16_t seq, const uint8_t *links, int count)
+{
+    int i;
+    struct lsa *l = &db->lsa[origin];
+    struct lsa old = *l;
+
+    if (origin == MAX_MIP_ADDR) return LSDB_SAME;
+    if (l->present && seq == l->seq) return LSDB_SAME;
+
+    /* sequence numbers wrap, newer is less than half the space ahead */
+    if (l->present && (int16_t) (seq - l->seq) < 0) return LSDB_OLDER;
+
+    /* an advert of ours from before a restart */
+    if (origin == db->mip_address)
+    {
+        l->seq = seq + 1;
+        return LSDB_OLDER;
+    }
+
+    l->present  = 1;
+    l->seq      = seq;
+    l->count    = 0;
+    for (i = 0; i < count && l->count < LSDB_MAX_LINKS; i++)
+    {
+        if (links[i] != MAX_MIP_ADDR && links[i] != origin) l->links[l->count++] = links[i];
+    }
+
+    apply_change(db, origin, &old);
+    return LSDB_NEWER;
+}
+
+int lsdb_install(const lsdb *db, routing_table *rt)
+{
+    int i, j, count, changed = 0;
+    uint8_t next_hops[RTABLE_MAX_PATHS];
+    uint64_t word;
+
+    for (i = 0; i < RTABLE_SLOTS; i++)
+    {
+        if (i == db->mip_address || i == MAX_MIP_ADDR) continue;
+
+        /* the bitmap is walked in ascending order */
+        for (j = 0, count = 0; j < LSDB_SET_WORDS && count < RTABLE_MAX_PATHS; j++)
+        {
+            for (word = db->first_hops[i][j]; word && count < RTABLE_MAX_PATHS; word &= word - 1)
+                next_hops[count++] = j * 64 + __builtin_ctzll(word);
+        }
+
+        changed += rtable_install(rt, i, next_hops, count, db->dist[i]);
+    }
+
+    return changed;
+}
@@ -0,0 +1,172 @@
+#include "../headers/mip_pending.h"
+#include "../headers/utils.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+static int route_expired(struct mip_timer *t, void *arg);
+
+pending_table *pending_create(struct pkt_pool *pool, timer_base *timers)
+{
+    pending_table *pt;
+    int i;
+
+    pt = allocate_memory(sizeof(struct pending_table));
+    if (pt == NULL) return NULL;
+
+    pt->pool = pool;
+    pt->timers = timers;
+
+    for (i = 0; i < PENDING_SLOTS; i++)
+        timer_init(&pt->route[i].timer, route_expired, pt);
+
+    return pt;
+}
+
+static size_t pending_push(pending_table *pt, struct pending_list *l,
+    struct pkt_buf *e, uint8_t dest)
+{
+    /* tail drop, the packets already waiting keep their order */
+    if (l->depth >= PENDING_MAX_DEPTH)
+    {
+        pt->drops[dest]++;
+        pt->dropped_full++;
+        pool_put(pt->pool, e);
+        return 0;
+    }
+
+    pool_handoff(e, POOL_OWNER_PENDING);
+    e->next = NULL;
+    if (l->tail == NULL) l->head = e;
+    else l->tail->next = e;
+    l->tail = e;
+
+    pt->queued++;
+    return ++l->depth;
+}
+
+static struct pkt_buf *pending_take(pending_table *pt, struct pending_list *l)
+{
+    struct pkt_buf *list = l->head;
+
+    pt->queued -= l->depth;
+    l->head = l->tail = NULL;
+    l->depth = 0;
+
+    return list;
+}
+
+ssize_t pending_push_route(pending_table *pt, struct pkt_buf *e)
+{
+    uint8_t dest = e->frame.sdu[0];
+    size_t depth = pending_push(pt, &pt->route[dest], e, dest);
+
+    /* the lookup sent for the first packet is waited on for so long */
+    if (depth == 1 && timer_add(pt->timers, &pt->route[dest].timer, PENDING_ROUTE_MS) == -1)
+        return -1;
+
+    return depth;
+}
+
+size_t pending_push_arp(pending_table *pt, struct pkt_buf *e)
+{
+    return pending_push(pt, &pt->arp[e->frame.pdu.dest], e, e->frame.sdu[0]);
+}
+
+struct pkt_buf *pending_take_route(pending_table *pt, uint8_t dest)
+{
+    timer_cancel(pt->timers, &pt->route[dest].timer);
+    return pending_take(pt, &pt->route[dest]);
+}
+
+struct pkt_buf *pending_take_arp(pending_table *pt, uint8_t next_hop)
+{
+    return pending_take(pt, &pt->arp[next_hop]);
+}
+
+size_t pending_arp_depth(pending_table *pt, uint8_t next_hop)
+{
+    return pt->arp[next_hop].depth;
+}
+
+size_t pending_drop_list(pending_table *pt, struct pkt_buf *list)
+{
+    size_t n = 0;
+    struct pkt_buf *next;
+
+    while (list != NULL)
+    {
+        next = list->next;
+        pt->drops[(uint8_t) list->frame.sdu[0]]++;
+        pt->dropped_route++;
+        pool_put(pt->pool, list);
+        list = next;
+        n++;
+    }
+
+    return n;
+}
+
+size_t pending_drop_arp(pending_table *pt, uint8_t next_hop)
+{
+    size_t n = 0;
+    struct pkt_buf *list = pending_take_arp(pt, next_hop), *next;
+
+    while (list != NULL)
+    {
+        next = list->next;
+        pt->drops[(uint8_t) list->frame.sdu[0]]++;
+        pt->dropped_arp++;
+        pool_put(pt->pool, list);
+        list = next;
+        n++;
+    }
+
+    return n;
+}
+
+static int route_expired(struct mip_timer *t, void *arg)
+{
+    pending_table *pt = (pending_table*) arg;
+    struct pending_list *l = timer_container(t, struct pending_list, timer);
+    struct pkt_buf *list = pending_take(pt, l), *next;
+
+    while (list != NULL)
+    {
+        next = list->next;
+        pt->drops[(uint8_t) list->frame.sdu[0]]++;
+        pt->expired++;
+        pool_put(pt->pool, list);
+        list = next;
+    }
+
+    return 0;
+}
+
+static void free_pending_list(pending_table *pt, struct pending_list *l)
+{
+    struct pkt_buf *e = l->head, *next;
+
+    while (e != NULL)
+    {
+        next = e->next;
+        pool_put(pt->pool, e);
+        e = next;
+    }
+}
+
+void free_pending_table(pending_table *pt)
+{
+    int i;
+
+    if (pt == NULL) return;
+
+    for (i = 0; i < PENDING_SLOTS; i++)
+    {
+        timer_cancel(pt->timers, &pt->route[i].timer);
+        free_pending_list(pt, &pt->route[i]);
+        free_pending_list(pt, &pt->arp[i]);
+    }
+
+    free(pt);
+}
@@ -0,0 +1,104 @@
+#include "../headers/mip_pool.h"
+#include "../headers/utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+pkt_pool *pool_create(size_t count, int flags)
+{
+    size_t i, len;
+    pkt_pool *pool;
+
+    pool = allocate_memory(sizeof(struct pkt_pool));
+    if (pool == NULL) return NULL;
+
+    len = count * sizeof(struct pkt_buf);
+    pool->bufs = MAP_FAILED;
+
+    if (flags & POOL_HUGEPAGES)
+    {
+        pool->map_len = (len + POOL_HUGEPAGE_SIZE - 1) & ~((size_t) POOL_HUGEPAGE_SIZE - 1);
+        pool->bufs = mmap(NULL, pool->map_len, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        if (pool->bufs == MAP_FAILED)
+        {
+            fprintf(stderr, "<daemon>: no huge pages for the packet pool, using normal pages\n");
+        }
+        pool->hugepages = pool->bufs != MAP_FAILED;
+    }
+
+    /* page aligned, so every buffer starts on a cache line */
+    if (pool->bufs == MAP_FAILED)
+    {
+        pool->map_len = len;
+        pool->bufs = mmap(NULL, pool->map_len, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    }
+
+    if (pool->bufs == MAP_FAILED)
+    {
+        perror("mmap");
+        free(pool);
+        return NULL;
+    }
+
+    pool->count = count;
+    for (i = count; i > 0; i--)
+    {
+        pool->bufs[i - 1].owner = POOL_OWNER_FREE;
+        pool->bufs[i - 1].next = pool->free;
+        pool->free = &pool->bufs[i - 1];
+    }
+
+    return pool;
+}
+
+pkt_buf *pool_get(pkt_pool *pool, uint8_t owner)
+{
+    pkt_buf *buf = pool->free;
+
+    if (buf == NULL)
+    {
+        pool->stats.exhausted++;
+        return NULL;
+    }
+
+    pool->free = buf->next;
+    buf->next = NULL;
+    buf->owner = owner;
+
+    pool->stats.gets++;
+    if (++pool->stats.in_use > pool->stats.high_water) pool->stats.high_water = pool->stats.in_use;
+
+    return buf;
+}
+
+void pool_handoff(pkt_buf *buf, uint8_t owner)
+{
+    buf->owner = owner;
+}
+
+void pool_put(pkt_pool *pool, pkt_buf *buf)
+{
+    if (buf->owner == POOL_OWNER_FREE)
+    {
+        fprintf(stderr, "<daemon>: packet buffer %ld given back twice\n", buf - pool->bufs);
+        pool->stats.bad_puts++;
+        return;
+    }
+
+    buf->owner = POOL_OWNER_FREE;
+    buf->next = pool->free;
+    pool->free = buf;
+
+    pool->stats.puts++;
+    pool->stats.in_use--;
+}
+
+void free_pool(pkt_pool *pool)
+{
+    if (pool == NULL) return;
+    munmap(pool->bufs, pool->map_len);
+    free(pool);
+}
@@ -2,460 +2,541 @@
 #include "../headers/mip.h"
 #include "../headers/mip_debug.h"
 #include "../headers/common.h"
-#include "../headers/queue.h"
 #include "../headers/utils.h"
+#include "../headers/mip_event.h"
 
-#include <stdlib.h>         /* macros */
-#include <unistd.h>         /* daemon */
+#include <stdlib.h>         /* macros, strtol */
+#include <unistd.h>         /* close */
 #include <stdio.h>          /* prints */
-#include <string.h>         /* memcpy */
-#include <sys/timerfd.h>    /* timer fd */
+#include <string.h>         /* memcpy, strtok_r */
+#include <errno.h>          /* errno */
 
-int HELP = 0;
 int DEBUG = 0;
 
-int main(int argc, char* argv[])
+/**
+ * Schedules a HELLO, and the next expiry of the HELLO timer.
+ * */
+static int hello_expired(struct mip_timer *t, void *arg)
 {
-    uint8_t                         mip_address, updated = 0, hello_count = 0;
-    int                             sockfd, epollfd, timerfd;
-    int                             rc, wc, c, i;
-    int                             socket_index = 1, addr_index = 2;
-    enum states                     state = STATE_HELLO;
-    struct epoll_event              events_struct = {0}, events[MAX_EVENTS] = {0};
-    struct itimerspec               timer;
-    struct queue_entry              *qe;
-    struct mip_routing_table_entry  *e, *e2;
-    struct queue                    *routing_table;
-    struct mip_sdu                  *sdu;
+    routing_daemon *r = (routing_daemon*) arg;
 
-    if (argc < 3)
+    r->hello_pending = 1;
+    return timer_add(r->timers, t, r->hello_interval);
+}
+
+/**
+ * Schedules the probes, and the next expiry of the probe timer while any
+ * link is probed.
+ * */
+static int probe_expired(struct mip_timer *t, void *arg)
+{
+    int i;
+    routing_daemon *r = (routing_daemon*) arg;
+
+    for (i = 0; i < MAX_NEIGHBOURS; i++)
     {
-        printf("usage: ./mip_routing <socket_lower> <mip_address>\n");
-        return EXIT_SUCCESS;
+        if (r->probe[i]) break;
     }
+    if (i == MAX_NEIGHBOURS) return 0;
+
+    r->probe_pending = 1;
+    return timer_add(r->timers, t, r->probe_interval);
+}
 
-    if (argc < 3 || argc > 5)
+/**
+ * Owes every adjacent host a full UPDATE, so a delta that was lost without
+ * being noticed is repaired, and schedules the next resync. With link-state,
+ * our advert is flooded again instead.
+ * */
+static int resync_expired(struct mip_timer *t, void *arg)
+{
+    int i;
+    routing_daemon *r = (routing_daemon*) arg;
+    routing_table *rt = &r->routing_table;
+
+    if (r->link_state)
     {
-        printf("usage: ./mip_routing [-h] [-d] <socket_lower> <mip_address>\n");
-        return EXIT_SUCCESS;
+        lsdb_refresh(&r->lsdb);
+        r->lsa_pending = 1;
+        return timer_add(r->timers, t, RESYNC_INTERVAL_MS);
     }
 
-    while ((c = getopt(argc, argv, "hd")) != -1)
+    for (i = 0; i < rt->columns; i++)
     {
-        switch (c)
-        {
-            case 'h':
-                HELP = 1;
-                break;
-            case 'd':
-                DEBUG = 1;
-                socket_index = 2;
-                addr_index = 3;
-                break;
-            default:
-                break;
-        }
-    }
+        if (!rtable_adjacent(rt, rt->neighbour[i])) continue;
 
-    if (HELP) {
-        printf("%s\n", "-h >> usage: ./mip_daemon [-h] [-d] <socket_upper> <mip_address>");
-        return EXIT_SUCCESS;
+        r->peer[rt->neighbour[i]].send_full = 1;
+        r->peer_pending = 1;
     }
 
-    mip_address = (uint8_t) atoi(argv[addr_index]);
+    return timer_add(r->timers, t, RESYNC_INTERVAL_MS);
+}
 
-    /* create daemon */
-    if (daemon(NO_CHANGE, NO_CHANGE) == -1)
-    {
-        perror("daemon");
-        return EXIT_FAILURE;
-    }
+/**
+ * Pushes the best paths that changed to the daemon's forwarding table.
+ * */
+static int push_routes(routing_daemon *r)
+{
+    int wc;
+
+    wc = push_fib_updates(&r->out, &r->routing_table, &r->fib_state, r->routes,
+        r->mip_address);
+    return wc == -1 ? -1 : 0;
+}
 
-    timer.it_interval.tv_sec = HELLO_TIMEOUT;
-	timer.it_interval.tv_nsec = 0;
-	timer.it_value.tv_sec = HELLO_TIMEOUT;
-	timer.it_value.tv_nsec = 0;
+/**
+ * Sets every route over a neighbour that went silent unreachable, and
+ * withdraws or reroutes the daemon's forwarding entries.
+ * */
+static int dead_expired(struct mip_timer *t, void *arg)
+{
+    routing_daemon *r = (routing_daemon*) arg;
+    uint8_t neighbour = t - r->dead_timer;
 
-    sockfd = mip_connect_unix_socket(argv[socket_index], MIP_ROUTING + '0');
-    if (sockfd == -1)
+    /* the link leaves our advert, and the tree is computed without it */
+    if (r->link_state)
     {
-        fprintf(stderr, " >>> <routing>: did you remember to start the daemon?\n");
-        return EXIT_FAILURE;
+        if (lsdb_link_down(&r->lsdb, neighbour)) r->lsa_pending = 1;
+        lsdb_install(&r->lsdb, &r->routing_table);
     }
 
-    timerfd = timerfd_create(CLOCK_REALTIME, 0);
-    if (timerfd == -1)
-    {
-        perror("timerfd_create");
-        close(sockfd);
-        return EXIT_FAILURE;
-    }
+    /* hosts behind a timed out link are rerouted or unreachable */
+    else if (rtable_neighbour_down(&r->routing_table, neighbour)) r->update_pending = 1;
 
-    epollfd = epoll_create(1);
-    if (epollfd == -1)
+    /* its deltas are followed again from the full UPDATE it gets when it is back */
+    memset(&r->peer[neighbour], 0, sizeof(struct upd_peer));
+
+    /* it is only probed back once it probes again */
+    r->probe[neighbour]         &= PROBE_LOCAL;
+    r->probe_detect[neighbour]  = 0;
+
+    if (DEBUG) 
     {
-        perror("epoll_create");
-        close(sockfd); close(timerfd);
-        return EXIT_FAILURE;
+        printf("<routing>: timeout for node %d\n", neighbour);
+        mip_print_routing_table(&r->routing_table);
     }
 
-    rc = epoll_add_to_table(epollfd, &events_struct, sockfd);
-    if (rc == -1)
+    return push_routes(r);
+}
+
+/**
+ * Follows the sequence numbers of the UPDATEs of a neighbour. A gap, or a
+ * delta before any full UPDATE, means its routes here may be stale, so it is
+ * asked for its full table once. A resync request is answered with one.
+ * */
+static void check_sequence(routing_daemon *r, const struct ctrl_msg *msg)
+{
+    struct upd_peer *p = &r->peer[msg->body[0]];
+    uint16_t seq = msg->seq;
+    uint8_t flags = msg->body[1];
+
+    if (flags & UPD_RESYNC)
     {
-        close(sockfd); close(timerfd); close(epollfd);
-        return EXIT_FAILURE;
+        p->send_full = 1;
+        r->peer_pending = 1;
+        return;
     }
 
-    rc = epoll_add_to_table(epollfd, &events_struct, timerfd);
-    if (rc == -1)
+    if (flags & UPD_FULL)
     {
-        close(sockfd); close(timerfd); close(epollfd);
-        return EXIT_FAILURE;
+        p->synced   = 1;
+        p->asked    = 0;
     }
 
-    routing_table = queue_create();
-    if (routing_table == NULL)
+    else if (!p->synced || seq != (uint16_t) (p->seq + 1))
     {
-        close(sockfd); close(timerfd); close(epollfd);
-        return EXIT_FAILURE;
+        if (DEBUG)
+        {
+            printf("<routing>: delta %d from node %d out of sequence\n", seq, msg->body[0]);
+        }
+
+        /* a lost request is made up for by the periodic resync */
+        if (p->synced || !p->asked)
+        {
+            p->send_resync  = 1;
+            p->asked        = 1;
+            r->peer_pending = 1;
+        }
+        p->synced = 0;
     }
 
-    wc = update_entry(routing_table, mip_address, mip_address, 0, hello_count);
-    if (wc == -1)
+    p->seq = seq;
+}
+
+/**
+ * Merges a received advert. A newer one is flooded on to every adjacent host
+ * but the one it came from, and an older one is answered with ours, so the
+ * sender catches up.
+ * */
+static int handle_lsa(void *arg, const struct ctrl_msg *msg)
+{
+    int i, rc;
+    uint8_t neighbour;
+    routing_daemon *r = (routing_daemon*) arg;
+    uint8_t src     = msg->body[0];
+    uint8_t origin  = msg->body[1];
+    struct lsa *l   = &r->lsdb.lsa[r->mip_address];
+
+    if (!r->link_state) return 0;
+
+    rc = lsdb_merge(&r->lsdb, origin, msg->seq, msg->body + 2, msg->body_len - 2);
+
+    if (rc == LSDB_NEWER)
     {
-        close(sockfd); close(timerfd); close(epollfd);
-        free_routing_table(routing_table); queue_flush(routing_table);
-        return EXIT_FAILURE;
+        for (i = 0; i < l->count; i++)
+        {
+            neighbour = l->links[i];
+            if (neighbour == src) continue;
+            if (send_lsa(&r->out, &r->lsdb, origin, r->mip_address, neighbour) == -1)
+                return -1;
+        }
+
+        lsdb_install(&r->lsdb, &r->routing_table);
     }
 
-    sdu = allocate_memory(sizeof(struct mip_sdu));
-    if (sdu == NULL)
+    /* our own advert is flooded anew with a sequence number past the old one */
+    else if (rc == LSDB_OLDER && origin == r->mip_address) r->lsa_pending = 1;
+
+    else if (rc == LSDB_OLDER)
     {
-        close(sockfd); close(timerfd); close(epollfd);
-        queue_flush(routing_table); free(routing_table);
-        return EXIT_FAILURE;
+        if (send_lsa(&r->out, &r->lsdb, origin, r->mip_address, src) == -1) return -1;
     }
 
-    sdu->payload = allocate_memory(MAX_RT_PKT_SIZE);
-    if (sdu->payload == NULL)
+    return push_routes(r);
+}
+
+/**
+ * Checks if a neighbour said HELLO and has not gone down since.
+ * */
+static int is_adjacent(routing_daemon *r, uint8_t neighbour)
+{
+    if (r->link_state) return lsdb_adjacent(&r->lsdb, neighbour);
+    return rtable_adjacent(&r->routing_table, neighbour);
+}
+
+/**
+ * Restarts the dead timer of a neighbour that said HELLO or probed. It is down
+ * after being silent for as many of its intervals as its detect multiplier.
+ * While it probes, its probes set how soon that is.
+ * */
+static int neighbour_alive(routing_daemon *r, uint8_t neighbour, uint32_t detect_ms)
+{
+    uint32_t probe_ms = r->probe_detect[neighbour];
+
+    if (probe_ms && probe_ms < detect_ms) detect_ms = probe_ms;
+    return timer_add(r->timers, &r->dead_timer[neighbour], detect_ms);
+}
+
+/**
+ * Reads the detection time a HELLO or probe asks for: its interval times its
+ * detect multiplier.
+ * */
+static uint32_t detect_time(const struct ctrl_msg *msg)
+{
+    uint16_t interval = msg->body[1] << 8 | msg->body[2];
+    uint8_t mult = msg->body[3];
+
+    if (interval == 0) interval = HELLO_INTERVAL_MS;
+    if (mult == 0) mult = DETECT_MULT;
+    return (uint32_t) interval * mult;
+}
+
+/**
+ * Takes a probe from an adjacent neighbour as a sign of life, and starts
+ * probing it back if we do not already, so both ends detect a failure as
+ * fast.
+ * */
+static int handle_probe(void *arg, const struct ctrl_msg *msg)
+{
+    routing_daemon *r = (routing_daemon*) arg;
+    uint8_t neighbour = msg->body[0];
+
+    if (!is_adjacent(r, neighbour)) return 0;
+
+    r->probe_detect[neighbour] = detect_time(msg);
+    if (neighbour_alive(r, neighbour, r->probe_detect[neighbour]) == -1) return -1;
+
+    if (r->probe[neighbour]) return 0;
+
+    r->probe[neighbour] |= PROBE_REMOTE;
+    r->probe_pending = 1;
+    if (timer_pending(&r->probe_timer)) return 0;
+    return timer_add(r->timers, &r->probe_timer, r->probe_interval);
+}
+
+/**
+ * Takes a HELLO as a sign of life of its sender. A neighbour that just came
+ * up is owed every route or advert we have.
+ * */
+static int handle_hello(void *arg, const struct ctrl_msg *msg)
+{
+    int wc, adjacent;
+    routing_daemon *r = (routing_daemon*) arg;
+    uint8_t neighbour = msg->body[0];
+
+    if (r->link_state)
     {
-        close(sockfd); close(timerfd); close(epollfd);
-        free(sdu); free_routing_table(routing_table); 
-        queue_flush(routing_table);
-        return EXIT_FAILURE;
+        /* a neighbour that just came up is given the whole database */
+        if (lsdb_link_up(&r->lsdb, neighbour))
+        {
+            lsdb_install(&r->lsdb, &r->routing_table);
+            r->lsa_pending = 1;
+            r->peer[neighbour].send_full = 1;
+            r->peer_pending = 1;
+        }
     }
 
-    do
+    else
     {
-        memset(sdu->payload, 0, MAX_RT_PKT_SIZE);
-
-        switch(state) {
-
-            case STATE_WAIT:
-                rc = epoll_wait(epollfd, events, MAX_EVENTS, -1); /* timeout set by timerfd */
-                
-                /* error */
-                if (rc == -1)
-                {
-                    close(sockfd); close(timerfd); close(epollfd);
-                    free(sdu->payload); free(sdu); free_routing_table(routing_table); 
-                    queue_flush(routing_table);
-                    return EXIT_FAILURE;
-                }
-
-                /* timeout */
-                if (events -> data.fd == timerfd)
-                {
-                    state = STATE_HELLO;
-                    updated = 0;
-                    while ((e = check_for_timeouts(routing_table, hello_count)) != NULL)
-                    {
-
-                        /* setting hosts unreachable over timed out links as unreachable */
-                        e->hops = INFINITY;
-
-                        qe = routing_table->head;
-                        for (i = 0; i < (int) queue_length(routing_table); i++)
-                        {
-                            e2 = (struct mip_routing_table_entry*) qe->data;
-                            if (e2->next_hop == e->next_hop) e2->hops = INFINITY; 
-                            qe = qe->next;
-                        }
-
-                        // e->hello_count = hello_count;
-                        if (DEBUG) 
-                        {
-                            printf("<routing>: timeout for node %d\n", e->dest);
-                            mip_print_routing_table(routing_table);
-                        }
-                        updated = 1;
-                    }
-
-                    /* because we can't be in two states concurrently, we send update now */
-                    if (updated)
-                    {
-                        /* deliberately sending update, specifying triggering host to be a */
-                        /* non-existing host. */
-                        wc = send_update(sockfd, routing_table, 255, mip_address);
-                        if (wc == -1)
-                        {
-                            close(sockfd); close(timerfd); close(epollfd);
-                            free(sdu->payload); free(sdu); free_routing_table(routing_table); 
-                            queue_flush(routing_table);
-                            return EXIT_FAILURE;
-                        }
-                    }
-
-                    break;
-                }
-
-                rc = recv_from_daemon(sockfd, sdu);
-                if (rc == -1)
-                {
-                    close(sockfd); close(timerfd); close(epollfd);
-                    free(sdu->payload); free(sdu); free_routing_table(routing_table); 
-                    queue_flush(routing_table);
-                    return EXIT_FAILURE;
-                }
-
-                wc = update_table(routing_table, sdu, mip_address, hello_count);   
-
-                if (!strncmp(sdu->payload, HELLO, 3))
-                {
-                    wc = update_entry(routing_table, sdu->payload[3], sdu->payload[3], 1, hello_count);
-                    if (wc == -1)
-                    {
-                        close(sockfd); close(timerfd); close(epollfd);
-                        free(sdu->payload); free(sdu); free_routing_table(routing_table); 
-                        queue_flush(routing_table);
-                        return EXIT_FAILURE;
-                    }
-
-                    update_hello_count(routing_table, sdu->payload[3], hello_count);
-
-                    /* if we did an update to our routing table, propagate update table to adjacent hosts */
-                    if (wc)
-                    {
-                        state = STATE_UPDATE;
-                    }
-                }
-
-                else if (!strncmp(sdu->payload, UPDATE, 3))
-                {    
-
-                    /* if we did an update to our routing table, propagate update table to adjacent hosts */
-                    if (wc)
-                    {
-                        state = STATE_UPDATE;
-                    }
-                }
-
-                else if (!strncmp(sdu->payload, REQUESTPKT, 3))
-                {
-                    wc = send_routing_res(sockfd, routing_table, mip_address, sdu->payload[3]);
-                    if (wc == -1)
-                    {
-                        close(sockfd); close(timerfd); close(epollfd);
-                        free(sdu->payload); free(sdu); free_routing_table(routing_table); 
-                        queue_flush(routing_table);
-                        return EXIT_FAILURE;
-                    }
-                }
-                break;
-
-            case STATE_HELLO:
-                wc = send_hello(sockfd, mip_address);
-                if (wc == -1)
-                {
-                    close(sockfd); close(timerfd); close(epollfd);
-                    free(sdu->payload); free(sdu); free_routing_table(routing_table); 
-                    queue_flush(routing_table);
-                    return EXIT_FAILURE;
-                }
-
-                hello_count++;
-                state = STATE_WAIT;
-
-                wc = timerfd_settime(timerfd, 0, &timer, NULL);
-                if (wc == -1)
-                {
-                    perror("timerfd_settime");
-                    close(sockfd); close(timerfd); close(epollfd);
-                    free(sdu->payload); free(sdu); free_routing_table(routing_table); 
-                    queue_flush(routing_table);
-                    return EXIT_FAILURE;
-                }
-
-                break;
-
-            case STATE_UPDATE:
-
-                /* deliberately sending update, specifying triggering host to be a */
-                /* non-existing host. */
-                wc = send_update(sockfd, routing_table, 255, mip_address);
-                if (wc == -1)
-                {
-                    close(sockfd); close(timerfd); close(epollfd);
-                    free(sdu->payload); free(sdu); free_routing_table(routing_table); 
-                    queue_flush(routing_table);
-                    return EXIT_FAILURE;
-                }
-
-                state = STATE_WAIT;
-                break;
-
-            case STATE_EXIT:
-                close(sockfd); close(timerfd); close(epollfd);
-                free(sdu->payload); free(sdu); free_routing_table(routing_table); 
-                queue_flush(routing_table);
-                return EXIT_FAILURE;
-
-            default:
-                fprintf(stderr, "<routing>: undefined state, exiting...\n");
-                close(sockfd); close(timerfd); close(epollfd);
-                free(sdu->payload); free(sdu); free_routing_table(routing_table); 
-                queue_flush(routing_table);
-                return EXIT_FAILURE;
-        }      
-    } while (1);
-
-    /* for valgrind debugging */
-    printf("<routing>: user interruption\n");
-    close(sockfd); close(timerfd); close(epollfd);
-    free(sdu->payload); free_routing_table(routing_table); free(sdu); queue_flush(routing_table);
-    return EXIT_SUCCESS;
-}
-
-struct mip_routing_table_entry *check_for_timeouts(queue *routing_table, uint8_t hello_count)
-{
-    int i;
-    struct queue_entry *qe = routing_table->head;
-    struct mip_routing_table_entry *re;
-    int table_len = (int) queue_length(routing_table);
+        adjacent = rtable_adjacent(&r->routing_table, neighbour);
+        wc = rtable_update(&r->routing_table, neighbour, neighbour, 1);
 
-    for (i = 0; i < table_len; i++)
-    {
-        re = (struct mip_routing_table_entry*) qe->data;
-        
-        /* is adjacent has is not in sync with hello counter */
-        if (re->hops == 1 && re->hello_count != hello_count)
+        /* a neighbour that just came up has missed every delta so far */
+        if (!adjacent && rtable_adjacent(&r->routing_table, neighbour))
         {
-            return re;
+            r->peer[neighbour].send_full = 1;
+            r->peer_pending = 1;
         }
-        
-        qe = qe->next;
+
+        /* if we did an update to our routing table, propagate update table to adjacent hosts */
+        if (wc) r->update_pending = 1;
     }
 
-    return NULL;
+    /* the neighbour is down if it does not say HELLO again in time */
+    if (neighbour_alive(r, neighbour, detect_time(msg)) == -1) return -1;
+
+    /* keep the daemon's forwarding table in sync with our best paths */
+    return push_routes(r);
 }
 
-int update_entry(queue *routing_table, uint8_t src, uint8_t dest, uint8_t hops, uint8_t hello_count)
+/**
+ * Merges a full or delta UPDATE, following its sequence number.
+ * */
+static int handle_update(void *arg, const struct ctrl_msg *msg)
 {
-    int i, existing = 0;
-    struct queue_entry *qe = routing_table->head;
-    struct mip_routing_table_entry *re = NULL, *new_e;
-    int table_len = (int) queue_length(routing_table);
+    routing_daemon *r = (routing_daemon*) arg;
 
-    /* All paths implementation */
-    new_e = allocate_memory(sizeof(struct mip_routing_table_entry));
-    if (new_e == NULL)
-    {
-        return -1;
-    }
+    check_sequence(r, msg);
 
-    new_e->dest             = dest;
-    new_e->hops             = hops;
-    new_e->next_hop         = src;
-    new_e->hello_count      = hello_count;
+    /* if we did an update to our routing table, propagate update table to adjacent hosts */
+    if (update_table(&r->routing_table, msg)) r->update_pending = 1;
 
-    /* edge case if we add first entry to the table */
-    if (qe == NULL)
-    {
-        queue_tail_push(routing_table, new_e);
-        return 1;
-    }
+    return push_routes(r);
+}
+
+/**
+ * Answers a batch of lookups of the daemon with a single response.
+ * */
+static int handle_request(void *arg, const struct ctrl_msg *msg)
+{
+    routing_daemon *r = (routing_daemon*) arg;
 
-    /* normal use case */
-    else 
+    return send_routing_res(&r->out, &r->routing_table, r->mip_address, msg->seq,
+        msg->body, msg->body_len);
+}
+
+/* the handler per opcode, the messages the daemon only writes have none */
+const ctrl_handler routing_handlers[CTRL_OPCODES] = {
+    [CTRL_HELLO]        = handle_hello,
+    [CTRL_UPDATE]       = handle_update,
+    [CTRL_REQUEST]      = handle_request,
+    [CTRL_LSA]          = handle_lsa,
+    [CTRL_PROBE]        = handle_probe,
+};
+
+int routing_init(routing_daemon *r, uint8_t mip_address, timer_base *timers)
+{
+    int i;
+
+    r->mip_address = mip_address;
+    r->timers = timers;
+    init_fib_state(&r->fib_state);
+
+    if (r->hello_interval == 0) r->hello_interval = HELLO_INTERVAL_MS;
+    if (r->detect_mult == 0) r->detect_mult = DETECT_MULT;
+    if (r->probe_interval == 0) r->probe_interval = PROBE_INTERVAL_MS;
+
+    timer_init(&r->hello_timer, hello_expired, r);
+    timer_init(&r->resync_timer, resync_expired, r);
+    timer_init(&r->probe_timer, probe_expired, r);
+    for (i = 0; i < MAX_NEIGHBOURS; i++)
+        timer_init(&r->dead_timer[i], dead_expired, r);
+
+    rtable_init(&r->routing_table, mip_address);
+    if (r->link_state) lsdb_init(&r->lsdb, mip_address);
+
+    r->buf = allocate_memory(MAX_RT_PKT_SIZE);
+    if (r->buf == NULL) return -1;
+
+    if (timer_add(timers, &r->resync_timer, RESYNC_INTERVAL_MS) == -1) return -1;
+
+    /* the selected links are probed once their neighbour said HELLO */
+    if (timer_add(timers, &r->probe_timer, r->probe_interval) == -1) return -1;
+
+    /* say hello right away, then on every expiry of the timer */
+    r->hello_pending = 1;
+    return timer_add(timers, &r->hello_timer, r->hello_interval);
+}
+
+int routing_handle_msg(routing_daemon *r, const struct ctrl_msg *msg)
+{
+    return ctrl_dispatch(routing_handlers, r, msg);
+}
+
+int routing_send_scheduled(routing_daemon *r)
+{
+    int i, j;
+    struct upd_peer *p;
+    struct lsa *l = &r->lsdb.lsa[r->mip_address];
+
+    if (r->peer_pending)
     {
-        /* only adding if we have not stored the entry */
-        for (i = 0; i < table_len; i++)
+        r->peer_pending = 0;
+        for (i = 0; i < MAX_NEIGHBOURS; i++)
         {
-            re = (struct mip_routing_table_entry*) qe->data;
+            p = &r->peer[i];
 
-            /* we already have the stored entry */
-            if (re->dest == dest && re->next_hop == src && re->hops == hops)
+            /* a link-state neighbour that came up is sent every advert we have */
+            for (j = 0; r->link_state && p->send_full && j < RTABLE_SLOTS; j++)
             {
-                existing = 1;
+                if (!r->lsdb.lsa[j].present || j == r->mip_address) continue;
+                if (send_lsa(&r->out, &r->lsdb, j, r->mip_address, i) == -1) return -1;
             }
 
-            else if (re->dest == dest && re->next_hop == src && re->hops == INFINITY)
-            {
-                re->hops = hops;
-                existing = 1;
-            }
+            if (r->link_state) p->send_full = 0;
+            if (p->send_full && send_update(&r->out, &r->routing_table, r->mip_address,
+                &r->upd_seq, UPD_FULL, i) == -1) return -1;
+            if (p->send_resync && send_update(&r->out, &r->routing_table, r->mip_address,
+                &r->upd_seq, UPD_RESYNC, i) == -1) return -1;
 
-            /* destination and next hops is already stored, but path is proposed to be unreachable. */
-            else if (re->dest == dest && re->next_hop == src && hops == INFINITY)
-            {
-                re->hops = hops;
-            }
+            p->send_full    = 0;
+            p->send_resync  = 0;
+        }
+    }
 
-            qe = qe->next;
+    if (r->update_pending)
+    {
+        r->update_pending = 0;
+        if (send_update(&r->out, &r->routing_table, r->mip_address, &r->upd_seq, 
+            0, MAX_MIP_ADDR) == -1) return -1;
+    }
+
+    if (r->lsa_pending)
+    {
+        r->lsa_pending = 0;
+        for (i = 0; i < l->count; i++)
+        {
+            if (send_lsa(&r->out, &r->lsdb, r->mip_address, r->mip_address,
+                l->links[i]) == -1) return -1;
         }
+    }
 
-        if (!existing)
+    if (r->probe_pending)
+    {
+        r->probe_pending = 0;
+        for (i = 0; i < MAX_NEIGHBOURS; i++)
         {
-            queue_tail_push(routing_table, new_e);
-            return 1;
+            if (!r->probe[i] || !is_adjacent(r, i)) continue;
+            if (send_probe(&r->out, r->mip_address, i, r->probe_interval,
+                r->detect_mult) == -1) return -1;
         }
+    }
+
+    if (r->hello_pending)
+    {
+        r->hello_pending = 0;
+        if (send_hello(&r->out, r->mip_address, r->hello_interval, r->detect_mult) == -1)
+            return -1;
+    }
+
+    return 0;
+}
+
+void free_routing_daemon(routing_daemon *r)
+{
+    int i;
+
+    /* the timers live in the daemon, the timer base must not keep them */
+    if (r->timers != NULL)
+    {
+        timer_cancel(r->timers, &r->hello_timer);
+        timer_cancel(r->timers, &r->resync_timer);
+        timer_cancel(r->timers, &r->probe_timer);
+        for (i = 0; i < MAX_NEIGHBOURS; i++) timer_cancel(r->timers, &r->dead_timer[i]);
+    }
+
+    event_loop_close(&r->loop);
+    if (r->out.fd != -1) close(r->out.fd);
+    free(r->buf);
+
+    /* the daemon falls back to the socket once it reconnects to another */
+    if (r->routes != NULL)
+    {
+        route_shm_close(r->routes);
+        route_shm_unlink(r->mip_address);
+    }
+    free(r);
+}
+
+long routing_parse_option(const char *arg, long max)
+{
+    char *end;
+    long v = strtol(arg, &end, 10);
+
+    if (*end != '\0' || v <= 0 || v > max) return -1;
+    return v;
+}
 
-        free(new_e);
+int routing_parse_probes(char *list, uint8_t *probe)
+{
+    char *save, *peer;
+    long v;
 
-        return 0;
+    for (peer = strtok_r(list, ",", &save); peer != NULL; peer = strtok_r(NULL, ",", &save))
+    {
+        v = routing_parse_option(peer, MAX_MIP_ADDR - 1);
+        if (v == -1) return -1;
+        probe[v] = PROBE_LOCAL;
     }
+
+    return 0;
 }
 
-int update_table(queue * routing_table, struct mip_sdu *sdu, uint8_t mip_address, uint8_t hello_count)
+int update_table(routing_table *routing_table, const struct ctrl_msg *msg)
 {
-    int i, k;
-    uint8_t src, dest, hops;
+    size_t i;
+    uint8_t src, dest, next_hop, hops;
     int updated = 0; 
-    int update_size = sdu->payload[4];
+    const uint8_t *entries = msg->body + UPD_SIZE - CTRL_HDR_SIZE;
 
-    for (i = 0; i < update_size; i++)
+    src = msg->body[0];
+    for (i = 0; i < msg->body_len - (UPD_SIZE - CTRL_HDR_SIZE); i += 3)
     {
-        /* if this host is the next in the path, we skip the update. This is in order */
-        /* to prevent overwriting the path for to a broken link */
-        if (sdu->payload[i * 3 + 6] == mip_address) continue;
+        dest        = entries[i];
+        next_hop    = entries[i + 1];
+        hops        = entries[i + 2];
 
-        /* else, we send the entry to update function */
-        src     = sdu->payload[3];
-        dest    = sdu->payload[i * 3 + 5];
-        hops    = ((uint8_t) sdu->payload[i * 3 + 7] == INFINITY) 
-            ? sdu->payload[i * 3 + 7] : sdu->payload[i * 3 + 7] + 1;
+        /* a path of the sender that goes over this host is no path for us */
+        if (next_hop == routing_table->mip_address || hops >= INFINITY - 1) hops = INFINITY;
+        else hops++;
 
-        k = update_entry(routing_table, src, dest, hops, hello_count);
-        if (k)
-        {
-            updated = 1;
-            if (DEBUG) 
-            {
-                printf("<routing>: updated routing table\n");
-                mip_print_routing_table(routing_table);
-            }
+        if (rtable_update(routing_table, src, dest, hops)) updated = 1;
+    }
 
-        } 
+    if (updated && DEBUG) 
+    {
+        printf("<routing>: updated routing table\n");
+        mip_print_routing_table(routing_table);
     }
 
     return updated;
 }
 
-int recv_from_daemon(int socket, mip_sdu *sdu)
+int recv_from_daemon(int socket, char *buf, struct ctrl_msg *msg)
 {
     int rc;
-    char buf[MAX_RT_PKT_SIZE]; /* max size of routing table */
-    rc = read(socket, buf, MAX_RT_PKT_SIZE);
+    rc = recv(socket, buf, MAX_RT_PKT_SIZE, MSG_DONTWAIT);
+    if (rc == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return RECV_AGAIN;
     if (rc <= 0)
     {
         fprintf(stderr, "%s() ", __FUNCTION__);
@@ -463,213 +544,262 @@ int recv_from_daemon(int socket, mip_sdu *sdu)
         return -1;
     }
 
-    mip_deserialize_sdu(buf, sdu, rc);
+    if (ctrl_parse(buf, rc, msg) == -1)
+    {
+        if (DEBUG) printf("<routing>: dropped malformed message of %d bytes\n", rc);
+        return 1;
+    }
+
     return 0;
 }
 
-int send_hello(int socket, uint8_t src)
+int send_hello(const struct ctrl_out *out, uint8_t src, uint16_t interval, uint8_t mult)
 {
-    int wc;
     char buf[HEL_SIZE] = {0};
 
-    buf[0] = src;
-    buf[1] = 0;
-    buf[2] = 'H';
-    buf[3] = 'E';
-    buf[4] = 'L';
-    buf[5] = src;
+    ctrl_header(buf, src, CTRL_HELLO, HEL_SIZE, 0);
+    buf[8]  = src;
+    buf[9]  = interval >> 8;
+    buf[10] = interval & 0xFF;
+    buf[11] = mult;
+
+    return ctrl_send(out, buf, HEL_SIZE);
+}
 
-    wc = write(socket, buf, HEL_SIZE);
-    if (wc == -1)
+int send_probe(const struct ctrl_out *out, uint8_t src, uint8_t to, uint16_t interval,
+    uint8_t mult)
+{
+    char buf[PRB_SIZE] = {0};
+
+    ctrl_header(buf, to, CTRL_PROBE, PRB_SIZE, 0);
+    buf[8]  = src;
+    buf[9]  = interval >> 8;
+    buf[10] = interval & 0xFF;
+    buf[11] = mult;
+
+    return ctrl_send(out, buf, PRB_SIZE);
+}
+
+/**
+ * Writes an UPDATE to a neighbour with poisoned reverse: the paths over the
+ * neighbour are unreachable for it. The buffer is left as it was.
+ * */
+static int write_update(const struct ctrl_out *out, routing_table *routing_table, char *buf,
+    int len, uint8_t neighbour)
+{
+    int i;
+
+    buf[0] = neighbour;
+    for (i = UPD_SIZE; i < len; i += 3)
     {
-        fprintf(stderr, "%s() ", __FUNCTION__);
-        perror("write");  
+        if ((uint8_t) buf[i + 1] == neighbour) buf[i + 2] = INFINITY;
     }
-    return wc;
+
+    if (ctrl_send(out, buf, len) == -1) return -1;
+
+    /* the next neighbour is told the real hop counts again */
+    for (i = UPD_SIZE; i < len; i += 3)
+    {
+        if ((uint8_t) buf[i + 1] == neighbour) buf[i + 2] = routing_table->hops[(uint8_t) buf[i]];
+    }
+
+    return 0;
 }
 
-int send_update(int socket, struct queue *routing_table, uint8_t last_upd_src, uint8_t src)
+/**
+ * Writes an UPDATE packet to a neighbour, or to every adjacent host.
+ * */
+static int write_update_to(const struct ctrl_out *out, routing_table *routing_table, char *buf,
+    int len, uint8_t to)
 {
+    int i;
+    uint8_t neighbour;
 
-    int wc, i, j, added = 0;
-    struct queue_entry *qe = routing_table->head;
-    struct mip_routing_table_entry *e;
-    int table_len = (int) queue_length(routing_table);
-    int bufsize = UPD_SIZE + 3 * table_len;
-    int upd_size = UPD_SIZE;
-    char buf[bufsize];
-    memset(buf, 0, bufsize);
-
-    /* buf[0] will be target host */
-    buf[1] = 0;
-    buf[2] = 'U';
-    buf[3] = 'P';
-    buf[4] = 'D';
-    buf[5] = src;
+    if (to != MAX_MIP_ADDR) return write_update(out, routing_table, buf, len, to);
 
-    /* only add shortest paths */ 
-    for (i = 0; i < table_len; i++)
+    /* write update for each neighbour */
+    for (i = 0; i < routing_table->columns; i++)
     {
-        e = (struct mip_routing_table_entry*) qe->data;
+        neighbour = routing_table->neighbour[i];
+        if (!rtable_adjacent(routing_table, neighbour)) continue;
 
-        /* checking if entry is already added to the buffer */
-        for (j = UPD_SIZE; j < bufsize; j += 3)
-        {
-            /* if it's already in buffer */
-            if (buf[j] == e->dest)
-            {
-                added = 1;
-                break;
-            }
-        }
+        if (write_update(out, routing_table, buf, len, neighbour) == -1) return -1;
+    }
+
+    return 0;
+}
+
+int send_update(const struct ctrl_out *out, routing_table *routing_table, uint8_t src, uint16_t *seq,
+    uint8_t flags, uint8_t to)
+{
+    int i = 0, dest = 0, count = 0, chunk;
+    uint8_t entries[3 * RTABLE_SLOTS];
+    char buf[MAX_RT_PKT_SIZE];
 
-        /* if it already stored in buffer, look for better paths */
-        /* j will be index of where it is stored */
-        if (added)
+    /* the best path of every known destination, unreachable ones included */
+    /* so their withdrawal propagates */
+    if (flags & UPD_FULL)
+    {
+        for (dest = 0; dest < RTABLE_SLOTS; dest++)
         {
-            /* this entry is "better" */
-            if (e->hops < buf[j + 2])
-            {
-                buf[j] = e->dest;
-                buf[j + 1] = e->next_hop;
-                buf[j + 2] = e->hops;
-            }
+            if (!routing_table->known[dest]) continue;
 
-            i--;
+            entries[3 * count]      = dest;
+            entries[3 * count + 1]  = routing_table->next_hop[dest];
+            entries[3 * count + 2]  = routing_table->hops[dest];
+            count++;
         }
+    }
 
-        /* if not, store it in buffer */
-        else 
+    /* a delta only carries the destinations whose best path changed */
+    else if (!(flags & UPD_RESYNC))
+    {
+        while ((dest = rtable_take_changed(routing_table, dest)) != -1)
         {
-            buf[UPD_SIZE + 3 * i] = e->dest;
-            buf[UPD_SIZE + 3 * i + 1] = e->next_hop;
-            buf[UPD_SIZE + 3 * i + 2] = e->hops;
-            upd_size += 3;
+            entries[3 * count]      = dest;
+            entries[3 * count + 1]  = routing_table->next_hop[dest];
+            entries[3 * count + 2]  = routing_table->hops[dest];
+            count++;
         }
 
-        qe = qe->next;
-        if (qe == NULL) break;
-        added = 0;
+        if (count == 0) return 0;
     }
 
-    buf[6] = (upd_size - UPD_SIZE) / 3;
+    /* buf[0] will be target host */
+    buf[8] = src;
+    buf[9] = flags;
 
-    qe = routing_table->head;
-    /* write update for each neighbour */
-    for (i = 0; i < table_len; i++)
+    /* a packet holds what the 9 bit sdu_len allows. each packet is merged */
+    /* on its own, so losing one only loses the routes in it */
+    do
     {
-        e = (struct mip_routing_table_entry*) qe->data;
+        chunk = count - i < MAX_RT_ENTRIES ? count - i : MAX_RT_ENTRIES;
 
-        /* if node is neighbour and not were update came from */
-        if (e->hops == 1 && e->next_hop != last_upd_src)
-        {
-            buf[0] = e->next_hop;
+        /* a full update tells where the following delta will carry on from */
+        if (!(flags & (UPD_FULL | UPD_RESYNC))) (*seq)++;
 
-            /* loop through all next_hop fields and set poison reverse */
-            for (j = 0; j < UPD_SIZE + 1; j++)
-            {
-                if (buf[j] == buf[0]) buf[j + 1] = INFINITY;
-            }
+        ctrl_header(buf, 0, CTRL_UPDATE, UPD_SIZE + 3 * chunk, *seq);
+        memcpy(buf + UPD_SIZE, entries + 3 * i, 3 * chunk);
 
-            wc = write(socket, buf, upd_size);
-            if (wc == -1)
-            {
-                fprintf(stderr, "%s() ", __FUNCTION__);
-                perror("write");
-                return -1;
-            }
-        }
-        qe = qe->next;
+        if (write_update_to(out, routing_table, buf, UPD_SIZE + 3 * chunk, to) == -1)
+            return -1;
+        i += chunk;
     }
+    while (i < count);
 
     return 0;
 }
 
-static int lookup(queue *routing_table, struct mip_routing_table_entry *e, uint8_t req)
+int send_lsa(const struct ctrl_out *out, lsdb *lsdb, uint8_t origin, uint8_t src, uint8_t to)
 {
-    int i;
-    struct queue_entry *qe = routing_table->head;
-    struct mip_routing_table_entry *re;
-    e->hops = INFINITY;
-    for (i = 0; i < (int) queue_length(routing_table); i++)
-    {
-        re = (struct mip_routing_table_entry*) qe->data;
-        if (re->dest == req && re->hops != INFINITY)
-        {
-            /* get better path */
-            if (re->hops < e->hops) *e = *re;
-        } 
-        qe = qe->next;
-    }
+    struct lsa *l = &lsdb->lsa[origin];
+    char buf[LSA_SIZE + LSDB_MAX_LINKS];
 
-    if (e->hops != INFINITY) return 0;
-    if (DEBUG) 
-    {
-        printf("<routing>: did not find matching MIP address\n");
-    }
-    e->next_hop  = MAX_MIP_ADDR;
-    return -1;
+    ctrl_header(buf, to, CTRL_LSA, LSA_SIZE + l->count, l->seq);
+    buf[8] = src;
+    buf[9] = origin;
+    memcpy(buf + LSA_SIZE, l->links, l->count);
+
+    return ctrl_send(out, buf, LSA_SIZE + l->count);
 }
 
-int send_routing_res(int socket, queue *routing_table, uint8_t src, uint8_t req)
+int send_routing_res(const struct ctrl_out *out, routing_table *routing_table, uint8_t src,
+    uint16_t id, const uint8_t *dests, int count)
 {
-    int wc;
-    struct mip_routing_table_entry e;
-    char buf[RES_SIZE] = {0};
-    
-    wc = lookup(routing_table, &e, req);
+    int i;
+    uint8_t next_hop, hops;
+    char buf[RES_SIZE + 3 * MAX_LOOKUP_ENTRIES] = {0};
 
-    buf[0] = src;
-    buf[1] = e.hops;
-    buf[2] = 'R';
-    buf[3] = 'E';
-    buf[4] = 'S';
-    buf[5] = e.next_hop;
+    if (count > MAX_LOOKUP_ENTRIES) count = MAX_LOOKUP_ENTRIES;
 
-    wc = write(socket, buf, RES_SIZE);
-    if (wc == -1)
+    ctrl_header(buf, src, CTRL_RESPONSE, RES_SIZE + 3 * count, id);
+
+    for (i = 0; i < count; i++)
     {
-        fprintf(stderr, "%s() ", __FUNCTION__);
-        perror("write");
-        return -1;
+        hops = rtable_lookup(routing_table, dests[i], &next_hop);
+        if (hops == INFINITY && DEBUG) 
+        {
+            printf("<routing>: did not find matching MIP address %d\n", dests[i]);
+        }
+
+        buf[RES_SIZE + 3 * i]       = dests[i];
+        buf[RES_SIZE + 3 * i + 1]   = next_hop;
+        buf[RES_SIZE + 3 * i + 2]   = hops;
     }
 
-    return 0;
+    return ctrl_send(out, buf, RES_SIZE + 3 * count);
 }
 
-void update_hello_count(queue *routing_table, uint8_t src, uint8_t hello_count)
+void init_fib_state(struct mip_fib_state *state)
 {
-    int i;
-    struct queue_entry *qe = routing_table->head;
-    struct mip_routing_table_entry *re;
-    int table_len = (int) queue_length(routing_table);
+    memset(state->path_count, 0, FIB_MAX_ENTRIES);
+    memset(state->hops, INFINITY, FIB_MAX_ENTRIES);
+}
 
-    for (i = 0; i < table_len; i++)
+static int write_fib_delta(const struct ctrl_out *out, char *buf, uint8_t src, int len)
+{
+    ctrl_header(buf, src, CTRL_FIB, len, 0);
+    buf[8] = src;
+    return ctrl_send(out, buf, len);
+}
+
+int push_fib_updates(const struct ctrl_out *out, routing_table *routing_table,
+    struct mip_fib_state *state, route_shm *shm, uint8_t src)
+{
+    int i = 0, count = 0, pushed = 0, len = FIB_SIZE, paths, rc = 0;
+    uint8_t next_hop, hops;
+    const uint8_t *next_hops;
+    char buf[MAX_RT_PKT_SIZE] = {0};
+
+    /* a daemon that reads the segment is not woken up for every change */
+    int by_socket = shm == NULL || !__atomic_load_n(&shm->attached, __ATOMIC_RELAXED);
+
+    if (shm != NULL) route_shm_write_begin(shm);
+
+    /* only the destinations whose cached paths changed are looked at */
+    while ((i = rtable_take_dirty(routing_table, i)) != -1)
     {
-        re = (struct mip_routing_table_entry*) qe->data;
-        
-        if (re->hops == 1 && re->dest == src) /* is adjacent host */
+        hops = rtable_lookup(routing_table, i, &next_hop);
+        paths = rtable_paths(routing_table, i, &next_hops);
+        if (hops == state->hops[i] && paths == state->path_count[i]
+            && !memcmp(next_hops, state->paths[i], paths)) continue;
+
+        memcpy(state->paths[i], next_hops, paths);
+        state->path_count[i]    = paths;
+        state->hops[i]          = hops;
+        pushed++;
+
+        if (shm != NULL) route_shm_set(shm, i, next_hops, paths, hops);
+        if (!by_socket) continue;
+
+        /* a single message holds as much as an update */
+        if (len + FIB_ENTRY_SIZE + paths > MAX_RT_PKT_SIZE)
         {
-            re->hello_count = hello_count;
-            return;
+            rc = write_fib_delta(out, buf, src, len);
+            if (rc == -1) break;
+            count = 0;
+            len = FIB_SIZE;
         }
-        
-        qe = qe->next;
+
+        buf[len]        = i;
+        buf[len + 1]    = hops;
+        buf[len + 2]    = paths;
+        memcpy(buf + len + FIB_ENTRY_SIZE, next_hops, paths);
+        len += FIB_ENTRY_SIZE + paths;
+        count++;
     }
-}
 
-void free_routing_table(queue *routing_table)
-{
-    int i;
-    int len = (int) queue_length(routing_table);
-    struct queue_entry *qe = routing_table->head;
-    struct mip_routing_table_entry *e;
+    /* the segment is left consistent even if a write failed */
+    if (shm != NULL) route_shm_write_end(shm);
+    if (rc == -1) return -1;
+
+    if (count && write_fib_delta(out, buf, src, len) == -1) return -1;
 
-    for (i = 0; i < len; i++)
+    if (DEBUG && pushed)
     {
-        e = (struct mip_routing_table_entry*) qe->data;
-        free(e);
-        
-        qe = qe->next;
+        printf("<routing>: pushed %d forwarding entries to daemon%s\n", pushed,
+            by_socket ? "" : " through shared memory");
     }
+
+    return pushed;
 }
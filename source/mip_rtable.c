@@ -0,0 +1,285 @@
+#include "../headers/mip_rtable.h"
+#include "../headers/mip.h"
+
+#include <string.h>         /* memset, memcpy, memcmp */
+
+/**
+ * Marks the best route of a destination as changed.
+ * */
+static void mark_dirty(routing_table *rt, uint8_t dest)
+{
+    rt->dirty[dest / 64]    |= (uint64_t) 1 << (dest % 64);
+    rt->changed[dest / 64]  |= (uint64_t) 1 << (dest % 64);
+}
+
+/**
+ * Marks the equal-cost next hops of a destination as changed. Only the
+ * forwarding table needs to know, the advertised route is the same.
+ * */
+static void mark_paths(routing_table *rt, uint8_t dest)
+{
+    rt->dirty[dest / 64] |= (uint64_t) 1 << (dest % 64);
+}
+
+/**
+ * Sets the equal-cost next hops of a destination, in ascending order.
+ * */
+static void set_paths(routing_table *rt, uint8_t dest, const uint8_t *next_hops, int count)
+{
+    if (count > RTABLE_MAX_PATHS) count = RTABLE_MAX_PATHS;
+    if (count == rt->path_count[dest] && !memcmp(rt->paths[dest], next_hops, count)) return;
+
+    memcpy(rt->paths[dest], next_hops, count);
+    rt->path_count[dest] = count;
+    mark_paths(rt, dest);
+}
+
+/**
+ * Collects the neighbours a destination is as few hops away over as its
+ * best route.
+ * */
+static void update_paths(routing_table *rt, uint8_t dest)
+{
+    int i, j, count = 0;
+    uint8_t hops = rt->hops[dest], next_hops[RTABLE_MAX_NEIGHBOURS], tmp;
+    const uint8_t *row = rt->cost[dest];
+
+    for (i = 0; hops != INFINITY && i < rt->columns; i++)
+    {
+        if (row[i] != hops) continue;
+
+        /* insertion sort, there are only a handful */
+        for (j = count++; j > 0 && next_hops[j - 1] > rt->neighbour[i]; j--)
+        {
+            tmp = next_hops[j - 1];
+            next_hops[j - 1] = next_hops[j];
+            next_hops[j] = tmp;
+        }
+        next_hops[j] = rt->neighbour[i];
+    }
+
+    set_paths(rt, dest, next_hops, count);
+}
+
+/**
+ * Finds the first set bit of a destination bitmap from `from` on, and clears it.
+ * */
+static int take_bit(uint64_t *map, int from)
+{
+    int i, bit;
+    uint64_t word;
+
+    for (i = from / 64; i < RTABLE_SLOTS / 64; i++)
+    {
+        word = map[i];
+        if (i == from / 64) word &= ~(uint64_t) 0 << (from % 64);
+        if (word == 0) continue;
+
+        bit = __builtin_ctzll(word);
+        map[i] &= ~((uint64_t) 1 << bit);
+        return i * 64 + bit;
+    }
+
+    return -1;
+}
+
+/**
+ * Sets the cached best route of a destination.
+ * @return          1 if it changed, 0 otherwise.
+ * */
+static int set_best(routing_table *rt, uint8_t dest, uint8_t col, uint8_t hops)
+{
+    uint8_t next_hop;
+
+    if (hops == INFINITY) col = RTABLE_NONE;
+    next_hop = col == RTABLE_NONE ? MAX_MIP_ADDR : rt->neighbour[col];
+
+    if (rt->next_hop[dest] == next_hop && rt->hops[dest] == hops)
+    {
+        rt->best[dest] = col;
+        return 0;
+    }
+
+    rt->best[dest]      = col;
+    rt->next_hop[dest]  = next_hop;
+    rt->hops[dest]      = hops;
+    mark_dirty(rt, dest);
+    return 1;
+}
+
+/**
+ * Picks the cheapest column of a destination from scratch. The current best
+ * column wins ties, so equal routes do not flap.
+ * @return          1 if the best route changed, 0 otherwise.
+ * */
+static int recompute(routing_table *rt, uint8_t dest)
+{
+    int i;
+    uint8_t col = rt->best[dest];
+    uint8_t hops = col == RTABLE_NONE ? INFINITY : rt->cost[dest][col];
+    const uint8_t *row = rt->cost[dest];
+
+    for (i = 0; i < rt->columns; i++)
+    {
+        if (row[i] < hops)
+        {
+            col     = i;
+            hops    = row[i];
+        }
+    }
+
+    return set_best(rt, dest, col, hops);
+}
+
+/**
+ * Finds the column of a neighbour, or gives it a free one.
+ * @return          The column, RTABLE_NONE if every column is taken.
+ * */
+static uint8_t get_column(routing_table *rt, uint8_t neighbour)
+{
+    int i, col = rt->column[neighbour];
+
+    if (col != RTABLE_NONE) return col;
+
+    for (i = 0; i < rt->columns; i++)
+    {
+        if (rt->neighbour[i] == MAX_MIP_ADDR) break;
+    }
+
+    if (i == RTABLE_MAX_NEIGHBOURS) return RTABLE_NONE;
+    if (i == rt->columns) rt->columns++;
+
+    rt->neighbour[i]        = neighbour;
+    rt->column[neighbour]   = i;
+    return i;
+}
+
+void rtable_init(routing_table *rt, uint8_t mip_address)
+{
+    memset(rt, 0, sizeof(struct routing_table));
+    rt->mip_address = mip_address;
+
+    memset(rt->neighbour, MAX_MIP_ADDR, RTABLE_MAX_NEIGHBOURS);
+    memset(rt->column, RTABLE_NONE, RTABLE_SLOTS);
+    memset(rt->cost, INFINITY, sizeof(rt->cost));
+    memset(rt->best, RTABLE_NONE, RTABLE_SLOTS);
+    memset(rt->next_hop, MAX_MIP_ADDR, RTABLE_SLOTS);
+    memset(rt->hops, INFINITY, RTABLE_SLOTS);
+
+    /* the route to this host is advertised like any other */
+    rt->next_hop[mip_address]   = mip_address;
+    rt->hops[mip_address]       = 0;
+    rt->paths[mip_address][0]   = mip_address;
+    rt->path_count[mip_address] = 1;
+    rt->known[mip_address]      = 1;
+    rt->size                    = 1;
+    mark_dirty(rt, mip_address);
+}
+
+int rtable_update(routing_table *rt, uint8_t neighbour, uint8_t dest, uint8_t hops)
+{
+    int changed;
+    uint8_t col, best, old;
+
+    if (dest == rt->mip_address || dest == MAX_MIP_ADDR) return 0;
+    if (neighbour == rt->mip_address || neighbour == MAX_MIP_ADDR) return 0;
+
+    if (!rt->known[dest])
+    {
+        rt->known[dest] = 1;
+        rt->size++;
+    }
+
+    col = get_column(rt, neighbour);
+    if (col == RTABLE_NONE || rt->cost[dest][col] == hops) return 0;
+
+    old = rt->cost[dest][col];
+    rt->cost[dest][col] = hops;
+    best = rt->best[dest];
+
+    /* a better route replaces the best one, and the best one getting */
+    /* cheaper stays best. only the best one getting worse needs a scan */
+    if (best == RTABLE_NONE || hops < rt->hops[dest])
+        changed = hops == INFINITY ? 0 : set_best(rt, dest, col, hops);
+    else if (col != best) changed = 0;
+    else changed = recompute(rt, dest);
+
+    /* the equal-cost next hops only change if a route got or lost the best cost */
+    if (changed || old == rt->hops[dest] || hops == rt->hops[dest]) update_paths(rt, dest);
+    return changed;
+}
+
+int rtable_install(routing_table *rt, uint8_t dest, const uint8_t *next_hops, int count,
+    uint8_t hops)
+{
+    uint8_t next_hop = count ? next_hops[0] : MAX_MIP_ADDR;
+
+    if (dest == rt->mip_address || dest == MAX_MIP_ADDR) return 0;
+
+    if (hops != INFINITY && !rt->known[dest])
+    {
+        rt->known[dest] = 1;
+        rt->size++;
+    }
+
+    set_paths(rt, dest, next_hops, count);
+    if (rt->next_hop[dest] == next_hop && rt->hops[dest] == hops) return 0;
+
+    rt->best[dest]      = RTABLE_NONE;
+    rt->next_hop[dest]  = next_hop;
+    rt->hops[dest]      = hops;
+    mark_dirty(rt, dest);
+    return 1;
+}
+
+int rtable_neighbour_down(routing_table *rt, uint8_t neighbour)
+{
+    int i, changed = 0;
+    uint8_t col = rt->column[neighbour];
+
+    if (col == RTABLE_NONE) return 0;
+
+    for (i = 0; i < RTABLE_SLOTS; i++)
+    {
+        if (rt->cost[i][col] == INFINITY) continue;
+
+        rt->cost[i][col] = INFINITY;
+        if (rt->best[i] == col) changed += recompute(rt, i);
+        update_paths(rt, i);
+    }
+
+    rt->neighbour[col]      = MAX_MIP_ADDR;
+    rt->column[neighbour]   = RTABLE_NONE;
+    while (rt->columns && rt->neighbour[rt->columns - 1] == MAX_MIP_ADDR) rt->columns--;
+
+    return changed;
+}
+
+int rtable_adjacent(const routing_table *rt, uint8_t neighbour)
+{
+    uint8_t col = rt->column[neighbour];
+
+    return col != RTABLE_NONE && rt->cost[neighbour][col] == 1;
+}
+
+uint8_t rtable_lookup(const routing_table *rt, uint8_t dest, uint8_t *next_hop)
+{
+    *next_hop = rt->next_hop[dest];
+    return rt->hops[dest];
+}
+
+int rtable_paths(const routing_table *rt, uint8_t dest, const uint8_t **next_hops)
+{
+    *next_hops = rt->paths[dest];
+    return rt->path_count[dest];
+}
+
+int rtable_take_dirty(routing_table *rt, int from)
+{
+    return take_bit(rt->dirty, from);
+}
+
+int rtable_take_changed(routing_table *rt, int from)
+{
+    return take_bit(rt->changed, from);
+}
@@ -0,0 +1,157 @@
+#include "../headers/mip_shm.h"
+
+#include <stdio.h>          /* snprintf, perror */
+#include <string.h>         /* memset, memcpy */
+#include <errno.h>          /* errno */
+#include <fcntl.h>          /* O_* */
+#include <unistd.h>         /* ftruncate, close */
+#include <sys/mman.h>       /* shm_open, mmap */
+#include <sys/stat.h>       /* fstat */
+
+static void shm_name(char *name, uint8_t mip_address)
+{
+    snprintf(name, SHM_NAME_LEN, SHM_NAME_FMT, mip_address);
+}
+
+route_shm *route_shm_create(uint8_t mip_address)
+{
+    int fd, i;
+    char name[SHM_NAME_LEN];
+    route_shm *shm;
+
+    /* a left over segment is replaced, not truncated under a process that */
+    /* still has it mapped */
+    shm_name(name, mip_address);
+    shm_unlink(name);
+    fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd == -1)
+    {
+        perror("shm_open");
+        return NULL;
+    }
+
+    if (ftruncate(fd, sizeof(struct route_shm)) == -1)
+    {
+        perror("ftruncate");
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    shm = mmap(NULL, sizeof(struct route_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED)
+    {
+        perror("mmap");
+        shm_unlink(name);
+        return NULL;
+    }
+
+    memset(shm, 0, sizeof(struct route_shm));
+    for (i = 0; i < RTABLE_SLOTS; i++) shm->routes[i].hops = INFINITY;
+    shm->version = SHM_VERSION;
+
+    /* a reader only trusts the segment once the magic is in place */
+    __atomic_store_n(&shm->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+    return shm;
+}
+
+route_shm *route_shm_open(uint8_t mip_address, int writable)
+{
+    int fd, prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    char name[SHM_NAME_LEN];
+    struct stat st;
+    route_shm *shm;
+
+    shm_name(name, mip_address);
+    fd = shm_open(name, writable ? O_RDWR : O_RDONLY, 0);
+    if (fd == -1)
+    {
+        if (errno != ENOENT) perror("shm_open");
+        return NULL;
+    }
+
+    /* a segment still being set up is too short */
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t) sizeof(struct route_shm))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    shm = mmap(NULL, sizeof(struct route_shm), prot, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED)
+    {
+        perror("mmap");
+        return NULL;
+    }
+
+    if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC
+        || shm->version != SHM_VERSION)
+    {
+        munmap(shm, sizeof(struct route_shm));
+        return NULL;
+    }
+
+    return shm;
+}
+
+void route_shm_close(route_shm *shm)
+{
+    if (shm != NULL) munmap(shm, sizeof(struct route_shm));
+}
+
+void route_shm_unlink(uint8_t mip_address)
+{
+    char name[SHM_NAME_LEN];
+
+    shm_name(name, mip_address);
+    shm_unlink(name);
+}
+
+void route_shm_write_begin(route_shm *shm)
+{
+    __atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELAXED);
+
+    /* the odd seq is visible before any of the routes change */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void route_shm_set(route_shm *shm, uint8_t dest, const uint8_t *next_hops, int count,
+    uint8_t hops)
+{
+    struct shm_route *r = &shm->routes[dest];
+
+    if (count > RTABLE_MAX_PATHS) count = RTABLE_MAX_PATHS;
+
+    memcpy(r->next_hop, next_hops, count);
+    memset(r->next_hop + count, 0, RTABLE_MAX_PATHS - count);
+    r->paths    = count;
+    r->hops     = hops;
+    r->generation++;
+}
+
+void route_shm_write_end(route_shm *shm)
+{
+    __atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELEASE);
+}
+
+int route_shm_lookup(const route_shm *shm, uint8_t dest, struct shm_route *route)
+{
+    int i;
+    uint32_t seq;
+
+    for (i = 0; i < SHM_READ_RETRIES; i++)
+    {
+        seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) continue;
+
+        memcpy(route, &shm->routes[dest], sizeof(struct shm_route));
+
+        /* the copy is done before seq is read again */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) == seq) return 0;
+    }
+
+    return -1;
+}
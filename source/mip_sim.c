@@ -0,0 +1,1110 @@
+#include "../headers/mip_sim.h"
+#include "../headers/mip.h"
+#include "../headers/mip_arp.h"
+#include "../headers/mip_fib.h"
+#include "../headers/mip_link.h"
+#include "../headers/mip_routing.h"
+#include "../headers/common.h"
+#include "../headers/utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <linux/if_packet.h>
+#include <arpa/inet.h>            /* htons */
+
+static double wall_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int event_before(const struct sim_event *a, const struct sim_event *b)
+{
+    return a->time < b->time || (a->time == b->time && a->seq < b->seq);
+}
+
+static struct sim_event *sim_event_new(mip_sim *sim, uint64_t time, int type, int node)
+{
+    struct sim_event *ev = sim->free_events;
+
+    if (ev != NULL) sim->free_events = ev->next;
+    else if ((ev = allocate_memory(sizeof(struct sim_event))) == NULL) return NULL;
+
+    ev->time = time;
+    ev->type = type;
+    ev->node = node;
+    return ev;
+}
+
+static void sim_event_free(mip_sim *sim, struct sim_event *ev)
+{
+    ev->next = sim->free_events;
+    sim->free_events = ev;
+}
+
+static int sim_schedule(mip_sim *sim, struct sim_event *ev)
+{
+    size_t i, parent;
+    struct sim_event **heap;
+
+    if (sim->heap_len == sim->heap_cap)
+    {
+        heap = realloc(sim->heap, sizeof(struct sim_event*) * (sim->heap_cap ? 2 * sim->heap_cap : 1024));
+        if (heap == NULL)
+        {
+            perror("realloc");
+            sim_event_free(sim, ev);
+            return -1;
+        }
+        sim->heap = heap;
+        sim->heap_cap = sim->heap_cap ? 2 * sim->heap_cap : 1024;
+    }
+
+    ev->seq = sim->seq++;
+
+    /* sift up */
+    for (i = sim->heap_len++; i > 0; i = parent)
+    {
+        parent = (i - 1) / 2;
+        if (!event_before(ev, sim->heap[parent])) break;
+        sim->heap[i] = sim->heap[parent];
+    }
+    sim->heap[i] = ev;
+
+    return 0;
+}
+
+static struct sim_event *sim_pop(mip_sim *sim)
+{
+    size_t i, child;
+    struct sim_event *top, *last;
+
+    top = sim->heap[0];
+    last = sim->heap[--sim->heap_len];
+
+    /* sift down */
+    for (i = 0; (child = 2 * i + 1) < sim->heap_len; i = child)
+    {
+        if (child + 1 < sim->heap_len && event_before(sim->heap[child + 1], sim->heap[child])) child++;
+        if (!event_before(sim->heap[child], last)) break;
+        sim->heap[i] = sim->heap[child];
+    }
+    if (sim->heap_len) sim->heap[i] = last;
+
+    return top;
+}
+
+static void sim_mac(uint8_t *mac, uint8_t local, uint8_t peer)
+{
+    memset(mac, 0, MAC_ADDR_LEN);
+    mac[0] = 0x02;              /* locally administered, unicast */
+    mac[4] = local;
+    mac[5] = peer;
+}
+
+static int sim_discover(mip_link *link, struct network_interfaces *ifs)
+{
+    struct sim_node *node = link->state;
+    int i;
+
+    memset(ifs->addr, 0, sizeof(ifs->addr));
+    for (i = 0; i < node->degree; i++)
+    {
+        ifs->addr[i].sll_family     = AF_PACKET;
+        ifs->addr[i].sll_protocol   = htons(ETH_P_MIP);
+        ifs->addr[i].sll_ifindex    = i + 1;
+        ifs->addr[i].sll_halen      = MAC_ADDR_LEN;
+        sim_mac(ifs->addr[i].sll_addr, node->mip_address, node->peers[i]);
+    }
+
+    ifs->ifs_size = node->degree;
+    return 0;
+}
+
+static int sim_next(mip_link *link, struct link_frame **frame, struct sockaddr_ll **addr)
+{
+    struct sim_node *node = link->state;
+
+    if (!node->rx_ready) return RECV_AGAIN;
+
+    node->rx_ready = 0;
+    link->stats.rx_batches++;
+    link->stats.rx_frames++;
+
+    *frame = &node->rx;
+    *addr = &node->rx_addr;
+    return node->rx_len;
+}
+
+static struct link_frame *sim_reserve(mip_link *link, const struct sockaddr_ll *to)
+{
+    struct sim_node *node = link->state;
+
+    node->tx_if = to->sll_ifindex;
+    return &node->tx;
+}
+
+static void sim_count(mip_sim *sim, const struct link_frame *frame, size_t len)
+{
+    struct ctrl_msg msg;
+
+    if (frame->pdu.sdu_type == MIP_PING)
+    {
+        sim->counters.data_frames++;
+        return;
+    }
+
+    sim->counters.control_bytes += len;
+    if (frame->pdu.sdu_type == MIP_ARP) sim->counters.arp++;
+    else if (ctrl_parse(frame->sdu, frame->pdu.sdu_len, &msg) == -1) return;
+    else if (msg.opcode == CTRL_HELLO) sim->counters.hello++;
+    else if (msg.opcode == CTRL_UPDATE) sim->counters.update++;
+    else if (msg.opcode == CTRL_LSA) sim->counters.lsa++;
+    else if (msg.opcode == CTRL_PROBE) sim->counters.probe++;
+}
+
+/* the frame travels to the other end of the interface, and arrives after its delay */
+static void sim_commit(mip_link *link, size_t sdu_len)
+{
+    struct sim_node *node = link->state;
+    mip_sim *sim = node->sim;
+    struct sim_event *ev;
+    int i = node->tx_if - 1;
+
+    if (i < 0 || i >= node->degree || node->down[i])
+    {
+        link->stats.tx_dropped++;
+        return;
+    }
+
+    ev = sim_event_new(sim, sim->now + node->delay_us[i], SIM_EV_FRAME, node->peers[i]);
+    if (ev == NULL)
+    {
+        link->stats.tx_dropped++;
+        return;
+    }
+
+    ev->ifindex = node->peer_if[i];
+    ev->len = LINK_HEADER_SIZE + sdu_len;
+    memcpy(&ev->frame, &node->tx, ev->len);
+
+    if (sim_schedule(sim, ev) == -1)
+    {
+        link->stats.tx_dropped++;
+        return;
+    }
+
+    sim_count(sim, &ev->frame, ev->len);
+    link->stats.tx_batches++;
+    link->stats.tx_frames++;
+}
+
+static int sim_flush(mip_link *link)
+{
+    (void) link;
+    return 0;
+}
+
+static void sim_close(mip_link *link)
+{
+    (void) link;
+}
+
+static const struct link_ops sim_ops = {
+    .name       = "sim",
+    .discover   = sim_discover,
+    .next       = sim_next,
+    .reserve    = sim_reserve,
+    .commit     = sim_commit,
+    .flush      = sim_flush,
+    .close      = sim_close,
+};
+
+static int sim_can_link(mip_sim *sim, int a, int b)
+{
+    struct sim_node *na = &sim->nodes[a], *nb = &sim->nodes[b];
+    int i;
+
+    if (a == b || na->degree == MAX_IFS || nb->degree == MAX_IFS) return 0;
+
+    for (i = 0; i < na->degree; i++)
+    {
+        if (na->peers[i] == b) return 0;
+    }
+
+    return 1;
+}
+
+static void sim_add_node(mip_sim *sim, int a)
+{
+    if (sim->nodes[a].present) return;
+    sim->nodes[a].present = 1;
+    sim->nodes[a].mip_address = a;
+    sim->nodes[a].fd = -1;
+    sim->node_count++;
+}
+
+static int sim_add_link(mip_sim *sim, int a, int b, uint32_t delay_us)
+{
+    struct sim_node *na, *nb;
+
+    if (!in_range(a, 1, SIM_MAX_NODES + 1) || !in_range(b, 1, SIM_MAX_NODES + 1) || !sim_can_link(sim, a, b))
+    {
+        fprintf(stderr, "<sim>: cannot link %d and %d, addresses are 1 to %d, with at most %d links each\n",
+            a, b, SIM_MAX_NODES, MAX_IFS);
+        return -1;
+    }
+
+    na = &sim->nodes[a];
+    nb = &sim->nodes[b];
+
+    na->peers[na->degree]       = b;
+    na->peer_if[na->degree]     = nb->degree + 1;
+    na->delay_us[na->degree]    = delay_us;
+    nb->peers[nb->degree]       = a;
+    nb->peer_if[nb->degree]     = na->degree + 1;
+    nb->delay_us[nb->degree]    = delay_us;
+    na->degree++;
+    nb->degree++;
+
+    sim_add_node(sim, a);
+    sim_add_node(sim, b);
+    sim->link_count++;
+    return 0;
+}
+
+/**
+ * Finds the interface of a node that links it to peer.
+ * @return          The index of the interface, -1 if they are not linked.
+ * */
+static int sim_find_if(struct sim_node *node, int peer)
+{
+    int i;
+
+    for (i = 0; i < node->degree; i++)
+    {
+        if (node->peers[i] == peer) return i;
+    }
+
+    return -1;
+}
+
+/**
+ * Selects the link between a and b for fast probes, at both ends.
+ * */
+static int sim_probe_link(mip_sim *sim, int a, int b)
+{
+    int ia, ib;
+
+    if (!in_range(a, 1, SIM_MAX_NODES + 1) || !in_range(b, 1, SIM_MAX_NODES + 1)) return -1;
+
+    ia = sim_find_if(&sim->nodes[a], b);
+    ib = sim_find_if(&sim->nodes[b], a);
+    if (ia == -1 || ib == -1) return -1;
+
+    sim->nodes[a].probe[ia] = 1;
+    sim->nodes[b].probe[ib] = 1;
+    return 0;
+}
+
+/**
+ * Schedules the link between a and b to go down after ms milliseconds.
+ * */
+static int sim_cut_link(mip_sim *sim, unsigned int ms, int a, int b)
+{
+    struct sim_event *ev;
+
+    if (!in_range(a, 1, SIM_MAX_NODES + 1) || !in_range(b, 1, SIM_MAX_NODES + 1) ||
+        sim_find_if(&sim->nodes[a], b) == -1) return -1;
+
+    ev = sim_event_new(sim, (uint64_t) ms * 1000, SIM_EV_CUT, a);
+    if (ev == NULL) return -1;
+
+    ev->ifindex = b;
+    return sim_schedule(sim, ev);
+}
+
+static int sim_gen_line(mip_sim *sim, int n, uint32_t delay_us, int ring)
+{
+    int i;
+
+    if (!in_range(n, 2, SIM_MAX_NODES + 1)) return -1;
+
+    for (i = 1; i < n; i++)
+    {
+        if (sim_add_link(sim, i, i + 1, delay_us) == -1) return -1;
+    }
+
+    return ring && n > 2 ? sim_add_link(sim, n, 1, delay_us) : 0;
+}
+
+static int sim_gen_grid(mip_sim *sim, int w, int h, uint32_t delay_us)
+{
+    int x, y, a;
+
+    if (w < 1 || h < 1 || w * h < 2 || w * h > SIM_MAX_NODES) return -1;
+
+    for (y = 0; y < h; y++)
+    {
+        for (x = 0; x < w; x++)
+        {
+            a = y * w + x + 1;
+            if (x + 1 < w && sim_add_link(sim, a, a + 1, delay_us) == -1) return -1;
+            if (y + 1 < h && sim_add_link(sim, a, a + w, delay_us) == -1) return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* a random spanning tree, so the graph is connected, then random links up to the mean degree */
+static int sim_gen_random(mip_sim *sim, int n, int degree, unsigned int seed, uint32_t delay_us)
+{
+    int i, a, b, tries;
+
+    if (!in_range(n, 2, SIM_MAX_NODES + 1) || !in_range(degree, 1, MAX_IFS + 1)) return -1;
+
+    for (i = 2; i <= n; i++)
+    {
+        for (tries = 0; tries < 64; tries++)
+        {
+            b = 1 + rand_r(&seed) % (i - 1);
+            if (sim_can_link(sim, i, b)) break;
+        }
+        for (b = tries < 64 ? b : 1; b < i && !sim_can_link(sim, i, b); b++);
+        if (b == i || sim_add_link(sim, i, b, delay_us) == -1) return -1;
+    }
+
+    for (tries = 0; sim->link_count < n * degree / 2 && tries < 64 * n * degree; tries++)
+    {
+        a = 1 + rand_r(&seed) % n;
+        b = 1 + rand_r(&seed) % n;
+        if (sim_can_link(sim, a, b) && sim_add_link(sim, a, b, delay_us) == -1) return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Loads a topology file. Each line is one of
+ *  delay <us>                      delay of the links on the lines after
+ *  link <a> <b> [<us>]             a link between MIP addresses a and b
+ *  line <n>                        nodes 1 to n in a line
+ *  ring <n>                        nodes 1 to n in a ring
+ *  grid <w> <h>                    nodes 1 to w*h in a grid, row by row
+ *  random <n> <degree> [<seed>]    nodes 1 to n, connected at random
+ *  probe <a> <b>                   the link between a and b is probed fast
+ *  cut <ms> <a> <b>                the link between a and b goes down
+ * and # starts a comment.
+ * */
+static int sim_load(mip_sim *sim, const char *path)
+{
+    FILE *f;
+    char line[SIM_LINE_SIZE], word[16];
+    int a, b, k, rc = 0, lineno = 0;
+    unsigned int d, seed;
+    uint32_t delay_us = SIM_DEFAULT_DELAY_US;
+
+    f = fopen(path, "r");
+    if (f == NULL)
+    {
+        perror("fopen");
+        return -1;
+    }
+
+    while (rc == 0 && fgets(line, SIM_LINE_SIZE, f) != NULL)
+    {
+        lineno++;
+        if (sscanf(line, "%15s", word) != 1 || word[0] == '#') continue;
+
+        if (!strcmp(word, "delay") && sscanf(line, "%*s %u", &d) == 1)
+            delay_us = d;
+        else if (!strcmp(word, "link") && (k = sscanf(line, "%*s %d %d %u", &a, &b, &d)) >= 2)
+            rc = sim_add_link(sim, a, b, k == 3 ? d : delay_us);
+        else if (!strcmp(word, "line") && sscanf(line, "%*s %d", &a) == 1)
+            rc = sim_gen_line(sim, a, delay_us, 0);
+        else if (!strcmp(word, "ring") && sscanf(line, "%*s %d", &a) == 1)
+            rc = sim_gen_line(sim, a, delay_us, 1);
+        else if (!strcmp(word, "grid") && sscanf(line, "%*s %d %d", &a, &b) == 2)
+            rc = sim_gen_grid(sim, a, b, delay_us);
+        else if (!strcmp(word, "random") && (k = sscanf(line, "%*s %d %d %u", &a, &b, &seed)) >= 2)
+            rc = sim_gen_random(sim, a, b, k == 3 ? seed : sim->seed, delay_us);
+        else if (!strcmp(word, "probe") && sscanf(line, "%*s %d %d", &a, &b) == 2)
+            rc = sim_probe_link(sim, a, b);
+        else if (!strcmp(word, "cut") && sscanf(line, "%*s %u %d %d", &d, &a, &b) == 3)
+            rc = sim_cut_link(sim, d, a, b);
+        else
+            rc = -1;
+
+        if (rc == -1) fprintf(stderr, "<sim>: %s:%d: cannot use %s", path, lineno, line);
+    }
+
+    fclose(f);
+
+    if (rc == 0 && sim->node_count == 0)
+    {
+        fprintf(stderr, "<sim>: %s has no links\n", path);
+        return -1;
+    }
+
+    return rc;
+}
+
+/**
+ * Counts a neighbour that never answered ARP. The simulated daemon holds no
+ * packets back, so there is nothing to drop.
+ * */
+static int sim_arp_failure(void *arg, uint8_t mip_address)
+{
+    struct sim_node *node = (struct sim_node*) arg;
+    (void) mip_address;
+
+    node->sim->counters.arp_failed++;
+    return 0;
+}
+
+/**
+ * Sets up a node the way mip_daemon and mip_routing set up a host. The two
+ * are connected by a socket pair instead of the upper layer socket.
+ * */
+static int sim_node_init(mip_sim *sim, struct sim_node *node)
+{
+    int sv[2], i;
+
+    node->sim = sim;
+    node->fd = -1;
+    mip_fib_init(&node->fib);
+
+    node->ifs.link = link_new(&sim_ops, node, -1, -1);
+    if (node->ifs.link == NULL) return -1;
+
+    if (link_discover(node->ifs.link, &node->ifs) == -1) return -1;
+    node->ifs.raw_socket = -1;
+    node->ifs.src_mip_addr = node->mip_address;
+
+    node->timer_at = TIMER_NEVER;
+    if (timer_base_init(&node->timers, 0) == -1) return -1;
+
+    node->arp_table = arp_table_create(node->mip_address, &node->ifs, &node->timers);
+    if (node->arp_table == NULL) return -1;
+    node->arp_table->failure = sim_arp_failure;
+    node->arp_table->failure_arg = node;
+
+    for (i = 0; i < node->ifs.ifs_size; i++)
+    {
+        if (add_local_entry(node->arp_table, (uint8_t*) node->ifs.addr[i].sll_addr,
+            node->ifs.addr[i].sll_ifindex) == NULL) return -1;
+    }
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) == -1)
+    {
+        perror("socketpair");
+        return -1;
+    }
+    node->fd = sv[0];
+
+    node->r = allocate_memory(sizeof(struct routing_daemon));
+    if (node->r == NULL)
+    {
+        close(sv[1]);
+        return -1;
+    }
+    node->r->out.fd = sv[1];
+    node->r->loop.epoll_fd = -1;
+    node->r->link_state     = sim->link_state;
+    node->r->hello_interval = sim->hello_interval;
+    node->r->detect_mult    = sim->detect_mult;
+    for (i = 0; i < node->degree; i++)
+    {
+        if (node->probe[i]) node->r->probe[node->peers[i]] = PROBE_LOCAL;
+    }
+
+    return routing_init(node->r, node->mip_address, &node->timers);
+}
+
+static void sim_node_free(struct sim_node *node)
+{
+    if (node->r != NULL) free_routing_daemon(node->r);
+    if (node->fd != -1) close(node->fd);
+    if (node->arp_table != NULL) free_arp_table(node->arp_table);
+    timer_base_close(&node->timers);
+    free_link(node->ifs.link);
+}
+
+static int sim_broadcast(void *arg, const struct ctrl_msg *msg)
+{
+    struct sim_node *node = arg;
+
+    return mip_broadcast(&node->ifs, node->mip_address, MIP_ROUTING, node->buf, msg->len) == -1 ? -1 : 0;
+}
+
+static int sim_unicast(void *arg, const struct ctrl_msg *msg)
+{
+    struct sim_node *node = arg;
+    struct mip_pdu pdu = {0};
+    int wc;
+
+    pdu.dest        = msg->addr;
+    pdu.src         = node->mip_address;
+    pdu.ttl         = DEFAULT_TTL;
+    pdu.sdu_len     = msg->len;
+    pdu.sdu_type    = MIP_ROUTING;
+
+    /* like the daemon, an update is not held back while its ARP request is answered */
+    wc = mip_link_send(node->arp_table, &node->ifs, &pdu, node->buf, pdu.sdu_len, 0);
+    if (wc == -1) return -1;
+    if (wc == 1) node->sim->counters.update_noarp++;
+    return 0;
+}
+
+static int sim_fib(void *arg, const struct ctrl_msg *msg)
+{
+    struct sim_node *node = arg;
+    mip_sim *sim = node->sim;
+    int wc;
+
+    wc = mip_fib_apply_delta(&node->fib, msg->body + FIB_SIZE - CTRL_HDR_SIZE, msg->len - FIB_SIZE);
+    sim->counters.fib_msgs++;
+    if (wc > 0)
+    {
+        sim->counters.fib_changes += wc;
+        sim->last_change = sim->now;
+    }
+
+    return 0;
+}
+
+/* the messages of the routing daemon the simulated MIP daemon handles */
+static const ctrl_handler sim_handlers[CTRL_OPCODES] = {
+    [CTRL_HELLO]        = sim_broadcast,
+    [CTRL_UPDATE]       = sim_unicast,
+    [CTRL_LSA]          = sim_unicast,
+    [CTRL_PROBE]        = sim_unicast,
+    [CTRL_FIB]          = sim_fib,
+};
+
+/**
+ * Handles every message the routing daemon of a node has written, the way
+ * the MIP daemon does.
+ * */
+static int sim_daemon_input(struct sim_node *node)
+{
+    struct ctrl_msg msg;
+    int rc;
+
+    for (;;)
+    {
+        rc = mip_routing_recv(node->fd, node->buf, &msg);
+        if (rc == RECV_AGAIN) return 0;
+        if (rc == -1 || rc == -2) return -1;
+        if (rc == 1) continue;
+
+        if (ctrl_dispatch(sim_handlers, node, &msg) == -1) return -1;
+    }
+}
+
+/**
+ * Lets the routing daemon of a node handle every message the daemon has
+ * written to it, then send what it scheduled.
+ * */
+static int sim_routing_input(struct sim_node *node)
+{
+    routing_daemon *r = node->r;
+    struct ctrl_msg msg;
+    int rc;
+
+    for (;;)
+    {
+        rc = recv_from_daemon(r->out.fd, r->buf, &msg);
+        if (rc == RECV_AGAIN) break;
+        if (rc == -1) return -1;
+
+        if (rc == 0 && routing_handle_msg(r, &msg) == -1) return -1;
+    }
+
+    if (routing_send_scheduled(r) == -1) return -1;
+    return sim_daemon_input(node);
+}
+
+static int sim_forward(struct sim_node *node, struct mip_pdu *pdu, char *sdu)
+{
+    mip_sim *sim = node->sim;
+    uint8_t next_hop;
+    uint32_t hash;
+    int wc;
+
+    hash = mip_flow_hash(pdu->src, sdu[0], pdu->sdu_type, node->mip_address);
+    if (mip_fib_lookup(&node->fib, sdu[0], hash, &next_hop))
+    {
+        sim->counters.data_noroute++;
+        return 0;
+    }
+
+    pdu->dest = next_hop;
+    sdu[1] = pdu->ttl;
+
+    wc = mip_link_send(node->arp_table, &node->ifs, pdu, sdu, pdu->sdu_len + 2, 0);
+    if (wc == -1) return -1;
+    if (wc == 1) sim->counters.data_noarp++;
+
+    return 0;
+}
+
+/**
+ * Handles the frame that arrived at a node, the way the MIP daemon does.
+ * */
+static int sim_link_input(struct sim_node *node)
+{
+    mip_sim *sim = node->sim;
+    struct mip_pdu pdu;
+    uint64_t sent;
+    uint8_t arp_addr;
+    char *sdu;
+    int rc;
+
+    while ((rc = mip_link_recv(node->arp_table, &node->ifs, &pdu, &sdu, &arp_addr, 0)) != RECV_AGAIN)
+    {
+        if (rc == -1) return -1;
+
+        /* for us, the payload holds the time it was sent */
+        if (rc == 0)
+        {
+            memcpy(&sent, sdu + 2, sizeof(uint64_t));
+            sim->counters.data_delivered++;
+            sim->counters.latency_us += sim->now - sent;
+        }
+
+        else if (rc == 1)
+        {
+            if (--pdu.ttl == 0)
+            {
+                sim->counters.data_ttl++;
+                continue;
+            }
+            if (sim_forward(node, &pdu, sdu) == -1) return -1;
+        }
+
+        else if (rc == 2)
+        {
+            if (write(node->fd, sdu, pdu.sdu_len) == -1)
+            {
+                perror("write");
+                return -1;
+            }
+            if (sim_routing_input(node) == -1) return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int sim_inject(struct sim_node *node, uint8_t dest)
+{
+    mip_sim *sim = node->sim;
+    struct mip_pdu pdu = {0};
+    char *sdu = node->buf;
+
+    sdu[0] = dest;
+    sdu[1] = DEFAULT_TTL;
+    memcpy(sdu + 2, &sim->now, sizeof(uint64_t));
+
+    pdu.src         = node->mip_address;
+    pdu.ttl         = DEFAULT_TTL;
+    pdu.sdu_len     = sizeof(uint64_t);
+    pdu.sdu_type    = MIP_PING;
+
+    sim->counters.data_sent++;
+    return sim_forward(node, &pdu, sdu);
+}
+
+static int sim_handle_event(mip_sim *sim, struct sim_event *ev)
+{
+    struct sim_node *node = &sim->nodes[ev->node];
+    int rc = 0;
+
+    sim->counters.events++;
+
+    /* nothing crosses a cut link any more, in either direction */
+    if (ev->type == SIM_EV_CUT)
+    {
+        node->down[sim_find_if(node, ev->ifindex)] = 1;
+        sim->nodes[ev->ifindex].down[sim_find_if(&sim->nodes[ev->ifindex], ev->node)] = 1;
+        sim->last_cut = sim->now;
+        sim_event_free(sim, ev);
+        return 0;
+    }
+
+    /* a daemon that has exited neither receives nor sends anything */
+    if (node->crashed)
+    {
+        if (ev->type == SIM_EV_INJECT) sim->counters.data_sent++;
+        if (ev->type == SIM_EV_INJECT || (ev->type == SIM_EV_FRAME && ev->frame.pdu.sdu_type == MIP_PING))
+            sim->counters.data_down++;
+        sim_event_free(sim, ev);
+        return 0;
+    }
+
+    if (ev->type == SIM_EV_FRAME)
+    {
+        memcpy(&node->rx, &ev->frame, ev->len);
+        node->rx_len = ev->len;
+        node->rx_ready = 1;
+
+        memset(&node->rx_addr, 0, sizeof(struct sockaddr_ll));
+        node->rx_addr.sll_family    = AF_PACKET;
+        node->rx_addr.sll_protocol  = htons(ETH_P_MIP);
+        node->rx_addr.sll_ifindex   = ev->ifindex;
+        node->rx_addr.sll_halen     = MAC_ADDR_LEN;
+        node->rx_addr.sll_pkttype   = node->rx.hdr.dest[0] & 0x01 ? PACKET_BROADCAST : PACKET_HOST;
+        memcpy(node->rx_addr.sll_addr, node->rx.hdr.src, MAC_ADDR_LEN);
+
+        rc = sim_link_input(node);
+    }
+
+    else if (ev->type == SIM_EV_INJECT)
+    {
+        rc = sim_inject(node, ev->ifindex);
+    }
+
+    /* an event left behind when an earlier timer was added is ignored */
+    else if (ev->type == SIM_EV_TIMERS && ev->time == node->timer_at)
+    {
+        node->timer_at = TIMER_NEVER;
+        rc = timer_run(&node->timers, sim->now / 1000);
+
+        /* the ARP, HELLO and dead timers of both daemons share the node's timers */
+        if (rc != -1) rc = routing_send_scheduled(node->r);
+        if (rc != -1) rc = sim_daemon_input(node);
+    }
+
+    /* the routing daemon says HELLO right away, and starts its timers from now */
+    else if (ev->type == SIM_EV_BOOT)
+    {
+        rc = timer_add(&node->timers, &node->r->hello_timer, node->r->hello_interval);
+        if (rc != -1) rc = timer_add(&node->timers, &node->r->resync_timer, RESYNC_INTERVAL_MS);
+        if (rc != -1) rc = timer_add(&node->timers, &node->r->probe_timer, node->r->probe_interval);
+        if (rc != -1) rc = routing_send_scheduled(node->r);
+        if (rc != -1) rc = sim_daemon_input(node);
+    }
+
+    sim_event_free(sim, ev);
+    return rc;
+}
+
+/**
+ * Schedules a SIM_EV_TIMERS event for the earliest timer of a node, unless
+ * one is scheduled for that time or earlier.
+ * */
+static int sim_schedule_timers(mip_sim *sim, struct sim_node *node)
+{
+    struct sim_event *ev;
+    uint64_t next = timer_next(&node->timers);
+
+    if (next == TIMER_NEVER) return 0;
+
+    /* the timers count milliseconds, an expiry in this one is due now */
+    next = next * 1000 < sim->now ? sim->now : next * 1000;
+    if (next >= node->timer_at) return 0;
+
+    ev = sim_event_new(sim, next, SIM_EV_TIMERS, node->mip_address);
+    if (ev == NULL) return -1;
+
+    node->timer_at = next;
+    return sim_schedule(sim, ev);
+}
+
+/**
+ * Handles every event up to the given time.
+ * */
+static int sim_run(mip_sim *sim, uint64_t until)
+{
+    struct sim_event *ev;
+    struct sim_node *node;
+
+    while (sim->heap_len && sim->heap[0]->time <= until)
+    {
+        ev = sim_pop(sim);
+        sim->now = ev->time;
+        node = &sim->nodes[ev->node];
+        node->timers.now = sim->now / 1000;
+
+        /* where the daemon would exit on an error, only this node goes down */
+        if (sim_handle_event(sim, ev) == -1 || 
+            (!node->crashed && sim_schedule_timers(sim, node) == -1))
+        {
+            fprintf(stderr, "\n<sim>: node %d exited at %.3f s\n", node->mip_address, sim->now / 1e6);
+            node->crashed = 1;
+            sim->counters.crashed++;
+        }
+    }
+
+    sim->now = until;
+    return 0;
+}
+
+/**
+ * Breadth first search from a node, for the hop count to every other node.
+ * */
+static void sim_distances(mip_sim *sim, int src, uint8_t *dist)
+{
+    uint8_t queue[FIB_MAX_ENTRIES];
+    int head, tail, i, n;
+
+    memset(dist, INFINITY, FIB_MAX_ENTRIES);
+    dist[src] = 0;
+    queue[0] = src;
+    for (head = 0, tail = 1; head < tail; head++)
+    {
+        n = queue[head];
+        for (i = 0; i < sim->nodes[n].degree; i++)
+        {
+            if (sim->nodes[n].down[i] || dist[sim->nodes[n].peers[i]] != INFINITY) continue;
+            dist[sim->nodes[n].peers[i]] = dist[n] + 1;
+            queue[tail++] = sim->nodes[n].peers[i];
+        }
+    }
+}
+
+/**
+ * Counts the routes in every forwarding table that match the shortest path,
+ * found with a breadth first search from every node. A route is only right
+ * if each of its equal-cost next hops is one hop closer to the destination.
+ * Routes that are right and have more than one next hop are counted apart.
+ * */
+static int sim_check_routes(mip_sim *sim, int *correct, int *total, int *multipath)
+{
+    uint8_t (*dist)[FIB_MAX_ENTRIES];
+    struct mip_fib_entry *e;
+    int src, dst, i, ok;
+
+    *correct = *total = *multipath = 0;
+
+    dist = allocate_memory(sizeof(uint8_t) * FIB_MAX_ENTRIES * FIB_MAX_ENTRIES);
+    if (dist == NULL) return -1;
+
+    for (src = 1; src <= SIM_MAX_NODES; src++)
+    {
+        if (sim->nodes[src].present) sim_distances(sim, src, dist[src]);
+    }
+
+    for (src = 1; src <= SIM_MAX_NODES; src++)
+    {
+        if (!sim->nodes[src].present) continue;
+
+        for (dst = 1; dst <= SIM_MAX_NODES; dst++)
+        {
+            if (dst == src || dist[src][dst] == INFINITY) continue;
+
+            e = &sim->nodes[src].fib.entries[dst];
+            (*total)++;
+            ok = e->valid && e->hops == dist[src][dst];
+            for (i = 0; ok && i < e->paths; i++)
+                ok = dist[e->next_hop[i]][src] == 1 && dist[e->next_hop[i]][dst] + 1 == e->hops;
+
+            *correct += ok;
+            *multipath += ok && e->paths > 1;
+        }
+    }
+
+    free(dist);
+    return 0;
+}
+
+static void free_mip_sim(mip_sim *sim)
+{
+    struct sim_event *ev;
+    int i;
+
+    if (sim->nodes != NULL)
+    {
+        for (i = 1; i <= SIM_MAX_NODES; i++)
+        {
+            if (sim->nodes[i].present) sim_node_free(&sim->nodes[i]);
+        }
+    }
+
+    for (i = 0; i < (int) sim->heap_len; i++) free(sim->heap[i]);
+    while ((ev = sim->free_events) != NULL)
+    {
+        sim->free_events = ev->next;
+        free(ev);
+    }
+
+    free(sim->heap);
+    free(sim->nodes);
+    free(sim);
+}
+
+int main(int argc, char *argv[])
+{
+    int c, i, n = 0, correct, total, multipath;
+    long seconds = SIM_DEFAULT_SECONDS, packets = SIM_DEFAULT_PACKETS;
+    unsigned int seed = SIM_DEFAULT_SEED;
+    int link_state = 0;
+    long hello_interval = 0, detect_mult = 0;
+    uint8_t addrs[SIM_MAX_NODES];
+    uint64_t converge_until, start;
+    double t0, t1, t2;
+    struct sim_event *ev;
+    struct sim_counters *cnt;
+    mip_sim *sim;
+
+    while ((c = getopt(argc, argv, "hls:t:p:i:m:")) != -1)
+    {
+        switch (c)
+        {
+            case 's':
+                seed = strtoul(optarg, NULL, 10);
+                break;
+            case 't':
+                seconds = strtol(optarg, NULL, 10);
+                break;
+            case 'p':
+                packets = strtol(optarg, NULL, 10);
+                break;
+            case 'l':
+                link_state = 1;
+                break;
+            case 'i':
+                hello_interval = strtol(optarg, NULL, 10);
+                break;
+            case 'm':
+                detect_mult = strtol(optarg, NULL, 10);
+                break;
+            default:
+                printf("%s\n", "usage: ./mip_sim [-h] [-l] [-i <hello_ms>] [-m <mult>] [-s <seed>] [-t <seconds>] [-p <packets>] <topology>");
+                return EXIT_SUCCESS;
+        }
+    }
+
+    if (argc - optind != 1 || seconds <= 0 || packets < 0 ||
+        !in_range(hello_interval, 0, UINT16_MAX) || !in_range(detect_mult, 0, UINT8_MAX))
+    {
+        printf("%s\n", "usage: ./mip_sim [-h] [-l] [-i <hello_ms>] [-m <mult>] [-s <seed>] [-t <seconds>] [-p <packets>] <topology>");
+        return EXIT_SUCCESS;
+    }
+
+    sim = allocate_memory(sizeof(struct mip_sim));
+    if (sim == NULL) return EXIT_FAILURE;
+    sim->seed = seed;
+    sim->link_state = link_state;
+    sim->hello_interval = hello_interval;
+    sim->detect_mult = detect_mult;
+
+    /* indexed by MIP address */
+    sim->nodes = allocate_memory(sizeof(struct sim_node) * (SIM_MAX_NODES + 1));
+    if (sim->nodes == NULL || sim_load(sim, argv[optind]) == -1)
+    {
+        free_mip_sim(sim);
+        return EXIT_FAILURE;
+    }
+
+    /* every node boots at a random time within the first HELLO period */
+    for (i = 1; i <= SIM_MAX_NODES; i++)
+    {
+        if (!sim->nodes[i].present) continue;
+        addrs[n++] = i;
+
+        if (sim_node_init(sim, &sim->nodes[i]) == -1 ||
+            (ev = sim_event_new(sim, rand_r(&sim->seed) % (HELLO_INTERVAL_MS * 1000), SIM_EV_BOOT, i)) == NULL ||
+            sim_schedule(sim, ev) == -1)
+        {
+            free_mip_sim(sim);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("<sim>: %s, %d nodes, %d links, seed %u\n", argv[optind], sim->node_count, sim->link_count, seed);
+
+    /* let the routing protocol run on its own */
+    t0 = wall_clock();
+    converge_until = (uint64_t) seconds * 1000000;
+    if (sim_run(sim, converge_until) == -1)
+    {
+        free_mip_sim(sim);
+        return EXIT_FAILURE;
+    }
+    if (sim_check_routes(sim, &correct, &total, &multipath) == -1)
+    {
+        free_mip_sim(sim);
+        return EXIT_FAILURE;
+    }
+
+    /* then send packets between random pairs of nodes */
+    t1 = wall_clock();
+    start = sim->now;
+    for (i = 0; i < packets; i++)
+    {
+        ev = sim_event_new(sim, start + (uint64_t) i * SIM_PACKET_GAP_US, SIM_EV_INJECT, addrs[rand_r(&sim->seed) % n]);
+        if (ev == NULL)
+        {
+            free_mip_sim(sim);
+            return EXIT_FAILURE;
+        }
+
+        /* the destination is kept in ifindex */
+        do ev->ifindex = addrs[rand_r(&sim->seed) % n]; while (ev->ifindex == ev->node);
+        if (sim_schedule(sim, ev) == -1)
+        {
+            free_mip_sim(sim);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (sim_run(sim, start + (uint64_t) packets * SIM_PACKET_GAP_US + SIM_DRAIN_US) == -1)
+    {
+        free_mip_sim(sim);
+        return EXIT_FAILURE;
+    }
+    t2 = wall_clock();
+
+    cnt = &sim->counters;
+    printf("%-18s %s, %d/%d routes on a shortest path after %ld s, last change at %.3f s\n",
+        "convergence", correct == total ? "converged" : "not converged", correct, total,
+        seconds, sim->last_change / 1e6);
+    if (sim->last_cut && sim->last_change > sim->last_cut)
+    {
+        printf("%-18s link cut at %.3f s, forwarding tables settled %.1f ms later\n",
+            "", sim->last_cut / 1e6, (sim->last_change - sim->last_cut) / 1e3);
+    }
+    if (multipath)
+    {
+        printf("%-18s %d routes spread over equal-cost next hops\n", "", multipath);
+    }
+    if (cnt->crashed)
+    {
+        printf("%-18s %zu nodes exited on an error\n", "", cnt->crashed);
+    }
+    printf("%-18s %zu HELLO, %zu UPDATE, %zu LSA, %zu probes, %zu ARP, %zu bytes\n",
+        "control frames", cnt->hello, cnt->update, cnt->lsa, cnt->probe, cnt->arp,
+        cnt->control_bytes);
+    if (cnt->arp_failed)
+    {
+        printf("%-18s %zu neighbours did not answer ARP\n", "", cnt->arp_failed);
+    }
+    if (cnt->update_noarp)
+    {
+        printf("%-18s %zu UPDATE packets dropped by the daemon waiting on ARP\n",
+            "", cnt->update_noarp);
+    }
+    printf("%-18s %zu deltas, %zu entries changed\n", "forwarding tables", cnt->fib_msgs, cnt->fib_changes);
+    printf("%-18s %zu/%zu packets delivered, %.2f frames per packet and %.3f ms on average\n",
+        "forwarding", cnt->data_delivered, cnt->data_sent,
+        cnt->data_sent ? (double) cnt->data_frames / cnt->data_sent : 0.0,
+        cnt->data_delivered ? cnt->latency_us / 1e3 / cnt->data_delivered : 0.0);
+    printf("%-18s %zu with no route, %zu with no ARP entry, %zu when their ttl ran out, %zu at a node that exited\n",
+        "dropped", cnt->data_noroute, cnt->data_noarp, cnt->data_ttl, cnt->data_down);
+    printf("%-18s %zu frames forwarded in %.3f s, %.0f frames/s\n",
+        "throughput", cnt->data_frames, t2 - t1, t2 > t1 ? cnt->data_frames / (t2 - t1) : 0.0);
+    printf("%-18s %zu events in %.3f s, %.3f s simulated\n",
+        "simulator", cnt->events, t2 - t0, sim->now / 1e6);
+
+    free_mip_sim(sim);
+    return EXIT_SUCCESS;
+}
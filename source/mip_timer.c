@@ -0,0 +1,250 @@
+#include "../headers/mip_timer.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>         /* memset */
+#include <unistd.h>         /* read, close */
+#include <errno.h>
+#include <time.h>           /* clock_gettime */
+#include <sys/timerfd.h>
+
+uint64_t timer_clock_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int timer_base_init(timer_base *b, int with_fd)
+{
+    memset(b, 0, sizeof(struct timer_base));
+    b->fd = -1;
+    b->armed = TIMER_NEVER;
+
+    if (!with_fd) return 0;
+
+    b->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (b->fd == -1)
+    {
+        perror("timerfd_create");
+        return -1;
+    }
+
+    b->now = b->clk = timer_clock_ms();
+    return 0;
+}
+
+void timer_base_close(timer_base *b)
+{
+    if (b->fd != -1) close(b->fd);
+    b->fd = -1;
+}
+
+void timer_init(struct mip_timer *t, timer_fn fn, void *arg)
+{
+    t->expires = TIMER_NEVER;
+    t->next = NULL;
+    t->pprev = NULL;
+    t->fn = fn;
+    t->arg = arg;
+}
+
+int timer_pending(const struct mip_timer *t)
+{
+    return t->pprev != NULL;
+}
+
+/* rotates a slot bitmap so that bit 0 is the slot at index n */
+static uint64_t rotate(uint64_t bits, unsigned n)
+{
+    return n ? (bits >> n) | (bits << (TIMER_WHEEL_SIZE - n)) : bits;
+}
+
+uint64_t timer_next(const timer_base *b)
+{
+    uint64_t next = TIMER_NEVER, w, at;
+    unsigned shift;
+    int level;
+
+    if (b->count == 0) return TIMER_NEVER;
+
+    /* level 0 holds the next TIMER_WHEEL_SIZE milliseconds, slot by slot */
+    if (b->occupied[0])
+        next = b->clk + __builtin_ctzll(rotate(b->occupied[0], b->clk & TIMER_WHEEL_MASK));
+
+    /* a higher level is due when the clock enters its next slot with timers */
+    for (level = 1; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        if (!b->occupied[level]) continue;
+
+        shift = TIMER_WHEEL_BITS * level;
+        w = (b->clk + (1ULL << shift) - 1) >> shift;
+        at = (w + __builtin_ctzll(rotate(b->occupied[level], w & TIMER_WHEEL_MASK))) << shift;
+        if (at < next) next = at;
+    }
+
+    return next;
+}
+
+/* hashes a timer into the level its delay falls in */
+static void wheel_link(timer_base *b, struct mip_timer *t)
+{
+    uint64_t expires = t->expires < b->clk ? b->clk : t->expires;
+    uint64_t delta = expires - b->clk;
+    struct mip_timer **head;
+    int level = 0;
+    unsigned idx;
+
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >> (TIMER_WHEEL_BITS * (level + 1)))
+        level++;
+
+    /* further out than the wheel reaches, it is hashed again on the way down */
+    if (delta >> (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+        expires = b->clk + (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+
+    idx = (expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+    head = &b->wheel[level][idx];
+
+    t->next = *head;
+    if (t->next != NULL) t->next->pprev = &t->next;
+    t->pprev = head;
+    *head = t;
+
+    t->slot = level * TIMER_WHEEL_SIZE + idx;
+    b->occupied[level] |= 1ULL << idx;
+}
+
+static void wheel_unlink(timer_base *b, struct mip_timer *t)
+{
+    unsigned level = t->slot / TIMER_WHEEL_SIZE, idx = t->slot % TIMER_WHEEL_SIZE;
+
+    *t->pprev = t->next;
+    if (t->next != NULL) t->next->pprev = t->pprev;
+    t->pprev = NULL;
+
+    if (b->wheel[level][idx] == NULL) b->occupied[level] &= ~(1ULL << idx);
+}
+
+/* moves the timers of the slot the clock just entered down the wheel */
+static void wheel_cascade(timer_base *b, int level)
+{
+    unsigned idx = (b->clk >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+    struct mip_timer *t = b->wheel[level][idx], *next;
+
+    b->wheel[level][idx] = NULL;
+    b->occupied[level] &= ~(1ULL << idx);
+
+    for (; t != NULL; t = next)
+    {
+        next = t->next;
+        wheel_link(b, t);
+    }
+}
+
+/* arms the timerfd for the next expiry, only if that has changed */
+static int timer_rearm(timer_base *b)
+{
+    struct itimerspec its = {0};
+    uint64_t next = timer_next(b);
+
+    if (b->fd == -1 || next == b->armed) return 0;
+
+    /* an expiry already due is armed 1 ns ahead, a zero value would disarm */
+    if (next != TIMER_NEVER)
+    {
+        its.it_value.tv_sec = next / 1000;
+        its.it_value.tv_nsec = (next % 1000) * 1000000 + 1;
+    }
+
+    if (timerfd_settime(b->fd, TFD_TIMER_ABSTIME, &its, NULL) == -1)
+    {
+        perror("timerfd_settime");
+        return -1;
+    }
+
+    b->armed = next;
+    return 0;
+}
+
+int timer_add(timer_base *b, struct mip_timer *t, uint64_t delay_ms)
+{
+    if (b->fd != -1) b->now = timer_clock_ms();
+
+    if (timer_pending(t)) wheel_unlink(b, t);
+    else b->count++;
+
+    t->expires = b->now + delay_ms;
+    wheel_link(b, t);
+
+    return timer_rearm(b);
+}
+
+void timer_cancel(timer_base *b, struct mip_timer *t)
+{
+    if (!timer_pending(t)) return;
+    wheel_unlink(b, t);
+    b->count--;
+
+    /* the timerfd is left armed, an early expiry finds nothing to do */
+}
+
+int timer_run(timer_base *b, uint64_t now)
+{
+    struct mip_timer *t;
+    uint64_t expirations, bits, next;
+    unsigned idx;
+    int level;
+
+    if (b->fd != -1)
+    {
+        if (read(b->fd, &expirations, sizeof(uint64_t)) == -1 && errno != EAGAIN)
+        {
+            perror("read");
+            return -1;
+        }
+
+        /* the expiry the timerfd was armed for has passed */
+        b->armed = TIMER_NEVER;
+        now = timer_clock_ms();
+    }
+
+    b->now = now;
+
+    while (b->clk <= now)
+    {
+        idx = b->clk & TIMER_WHEEL_MASK;
+
+        /* entering a slot of each level above whose slot wrapped around */
+        for (level = 1; idx == 0 && level < TIMER_WHEEL_LEVELS; level++)
+        {
+            wheel_cascade(b, level);
+            if ((b->clk >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK) break;
+        }
+
+        /* timers added by a callback for this millisecond fire in the same pass */
+        while ((t = b->wheel[0][idx]) != NULL)
+        {
+            wheel_unlink(b, t);
+            b->count--;
+            if (t->fn(t, t->arg) == -1) return -1;
+        }
+
+        b->clk++;
+        if (b->count == 0)
+        {
+            b->clk = now + 1;
+            break;
+        }
+
+        /* empty slots up to the next one with timers, or the end of level 0, are skipped */
+        idx = b->clk & TIMER_WHEEL_MASK;
+        if (idx == 0) continue;
+
+        bits = b->occupied[0] >> idx;
+        next = bits ? b->clk + __builtin_ctzll(bits) : (b->clk | TIMER_WHEEL_MASK) + 1;
+        b->clk = next < now + 1 ? next : now + 1;
+    }
+
+    return timer_rearm(b);
+}
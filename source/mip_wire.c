@@ -0,0 +1,435 @@
+#include "../headers/mip_wire.h"
+#include "../headers/common.h"
+#include "../headers/utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/timerfd.h>
+#include <linux/if_packet.h>
+#include <arpa/inet.h>            /* htons */
+
+/**
+ * A frame held back by the shaper.
+ * @param due       When the frame arrives at the peer, in microseconds on the
+ *                  monotonic clock.
+ * @param peer      Index of the interface the frame is sent on.
+ * @param len       Length of the frame, 0 once it is sent.
+ * @param frame     The frame.
+ * */
+struct wire_slot {
+    uint64_t                due;
+    int                     peer;
+    size_t                  len;
+    struct link_frame       frame;
+};
+
+/**
+ * State of the virtual wire backend.
+ * @param mip_address   MIP address of this host.
+ * @param sock          The bound AF_UNIX datagram socket.
+ * @param timer_fd      Expires when the first held back frame is due.
+ * @param path          Path the socket is bound to.
+ * @param peer_count    Number of interfaces.
+ * @param peers         MIP address of the peer on each interface.
+ * @param peer_addr     Socket address of the peer on each interface.
+ * @param busy_until    When each interface is done sending the frames before.
+ * @param delay_us      Delay of every frame.
+ * @param loss          Percent of frames that are lost.
+ * @param kbit          Bandwidth of each interface in kbit/s, 0 if unlimited.
+ * @param seed          State of the loss generator.
+ * @param queue         Ring of WIRE_QUEUE frames held back by the shaper.
+ * @param tail          Oldest frame in the queue.
+ * @param count         Number of frames in the queue.
+ * @param scratch       Set if the reserved frame is the scratch frame, which
+ *                      is dropped on commit since the queue was full.
+ * @param rx            The received frame.
+ * @param rx_addr       Link layer address of the received frame.
+ * */
+struct wire_link {
+    uint8_t                 mip_address;
+    int                     sock;
+    int                     timer_fd;
+    struct sockaddr_un      path;
+    int                     peer_count;
+    uint8_t                 peers[MAX_IFS];
+    struct sockaddr_un      peer_addr[MAX_IFS];
+    uint64_t                busy_until[MAX_IFS];
+    unsigned int            delay_us;
+    unsigned int            loss;
+    unsigned int            kbit;
+    unsigned int            seed;
+    struct wire_slot        *queue;
+    unsigned int            tail;
+    unsigned int            count;
+    int                     scratch;
+    struct link_frame       rx;
+    struct sockaddr_ll      rx_addr;
+};
+
+static uint64_t wire_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void wire_mac(uint8_t *mac, uint8_t local, uint8_t peer)
+{
+    memset(mac, 0, MAC_ADDR_LEN);
+    mac[0] = WIRE_MAC_PREFIX;
+    mac[4] = local;
+    mac[5] = peer;
+}
+
+static int wire_path(struct sockaddr_un *addr, const char *dir, uint8_t mip_address)
+{
+    int len;
+
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    len = snprintf(addr->sun_path, sizeof(addr->sun_path), WIRE_PATH_FORMAT, dir, mip_address);
+    if (len < 0 || len >= (int) sizeof(addr->sun_path))
+    {
+        fprintf(stderr, "%s(): wire directory %s is too long\n", __FUNCTION__, dir);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int wire_parse(struct wire_link *w, const char *spec, char *dir, size_t dir_len)
+{
+    char buf[256], *save, *field, *peers, *peer, *end;
+    long v;
+    unsigned int *params[3] = { &w->delay_us, &w->loss, &w->kbit };
+    int i;
+
+    if (strlen(spec) >= sizeof(buf)) goto bad;
+    strcpy(buf, spec);
+
+    field = strtok_r(buf, ":", &save);
+    if (field == NULL || strlen(field) >= dir_len) goto bad;
+    strcpy(dir, field);
+
+    peers = strtok_r(NULL, ":", &save);
+    if (peers == NULL) goto bad;
+
+    for (i = 0; i < 3 && (field = strtok_r(NULL, ":", &save)) != NULL; i++)
+    {
+        v = strtol(field, &end, 10);
+        if (*end != '\0' || v < 0) goto bad;
+        *params[i] = v;
+    }
+    if (strtok_r(NULL, ":", &save) != NULL || (i != 0 && i != 3) || w->loss > 100) goto bad;
+
+    for (peer = strtok_r(peers, ",", &save); peer != NULL; peer = strtok_r(NULL, ",", &save))
+    {
+        v = strtol(peer, &end, 10);
+        if (*end != '\0' || !in_range(v, MIN_MIP_ADDR, MAX_MIP_ADDR) ||
+            v == w->mip_address || w->peer_count == MAX_IFS) goto bad;
+        w->peers[w->peer_count++] = v;
+    }
+
+    if (w->peer_count == 0) goto bad;
+    return 0;
+
+bad:
+    fprintf(stderr, "%s(): bad wire %s, expected <dir>:<peer>[,<peer>...][:<delay_us>:<loss>:<kbit>]\n",
+        __FUNCTION__, spec);
+    return -1;
+}
+
+static int wire_discover(mip_link *link, struct network_interfaces *ifs)
+{
+    struct wire_link *w = link->state;
+    int i;
+
+    memset(ifs->addr, 0, sizeof(ifs->addr));
+    for (i = 0; i < w->peer_count; i++)
+    {
+        ifs->addr[i].sll_family     = AF_PACKET;
+        ifs->addr[i].sll_protocol   = htons(ETH_P_MIP);
+        ifs->addr[i].sll_ifindex    = i + 1;
+        ifs->addr[i].sll_halen      = MAC_ADDR_LEN;
+        wire_mac(ifs->addr[i].sll_addr, w->mip_address, w->peers[i]);
+    }
+
+    ifs->ifs_size = w->peer_count;
+    return 0;
+}
+
+static int wire_next(mip_link *link, struct link_frame **frame, struct sockaddr_ll **addr)
+{
+    struct wire_link *w = link->state;
+    struct sockaddr_un from;
+    socklen_t from_len;
+    uint8_t broadcast[MAC_ADDR_LEN] = BROADCAST_ADDR;
+    int rc, i;
+
+    for (;;)
+    {
+        from_len = sizeof(struct sockaddr_un);
+        rc = recvfrom(w->sock, &w->rx, sizeof(struct link_frame), MSG_DONTWAIT,
+            (struct sockaddr*) &from, &from_len);
+        if (rc == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return RECV_AGAIN;
+            perror("recvfrom");
+            return -1;
+        }
+
+        link->stats.rx_batches++;
+        link->stats.rx_frames++;
+
+        /* only frames from the peers we are wired to arrive on an interface */
+        for (i = 0; i < w->peer_count; i++)
+        {
+            if (!strcmp(from.sun_path, w->peer_addr[i].sun_path)) break;
+        }
+        if (i < w->peer_count) break;
+    }
+
+    w->rx_addr.sll_family   = AF_PACKET;
+    w->rx_addr.sll_protocol = htons(ETH_P_MIP);
+    w->rx_addr.sll_ifindex  = i + 1;
+    w->rx_addr.sll_halen    = MAC_ADDR_LEN;
+    w->rx_addr.sll_pkttype  = memcmp(w->rx.hdr.dest, broadcast, MAC_ADDR_LEN) ?
+        PACKET_HOST : PACKET_BROADCAST;
+    memcpy(w->rx_addr.sll_addr, w->rx.hdr.src, MAC_ADDR_LEN);
+
+    *frame = &w->rx;
+    *addr = &w->rx_addr;
+    return rc;
+}
+
+static struct link_frame *wire_reserve(mip_link *link, const struct sockaddr_ll *to)
+{
+    struct wire_link *w = link->state;
+    struct wire_slot *slot;
+
+    if (w->count == WIRE_QUEUE && link_flush(link) == -1) return NULL;
+
+    /* a full queue is a full interface queue, the frame is dropped on commit */
+    w->scratch = w->count == WIRE_QUEUE;
+    if (w->scratch) return &w->queue[WIRE_QUEUE].frame;
+
+    slot = &w->queue[(w->tail + w->count) % WIRE_QUEUE];
+    slot->peer = to->sll_ifindex - 1;
+    return &slot->frame;
+}
+
+static void wire_commit(mip_link *link, size_t sdu_len)
+{
+    struct wire_link *w = link->state;
+    struct wire_slot *slot;
+    uint64_t now, start;
+
+    if (w->scratch)
+    {
+        link->stats.tx_dropped++;
+        return;
+    }
+
+    slot = &w->queue[(w->tail + w->count) % WIRE_QUEUE];
+    if (slot->peer < 0 || slot->peer >= w->peer_count)
+    {
+        link->stats.tx_dropped++;
+        return;
+    }
+
+    if (w->loss && (unsigned int) rand_r(&w->seed) % 100 < w->loss)
+    {
+        link->stats.tx_lost++;
+        return;
+    }
+
+    /* frames on an interface go out one after the other, then travel for delay_us */
+    now = wire_now();
+    start = w->busy_until[slot->peer] > now ? w->busy_until[slot->peer] : now;
+    slot->len = LINK_HEADER_SIZE + sdu_len;
+    if (w->kbit) start += (uint64_t) slot->len * 8 * 1000 / w->kbit;
+    w->busy_until[slot->peer] = start;
+    slot->due = start + w->delay_us;
+
+    w->count++;
+}
+
+static int wire_arm(struct wire_link *w, uint64_t due)
+{
+    struct itimerspec its = {0};
+
+    /* 0 disarms the timer */
+    its.it_value.tv_sec  = due / 1000000;
+    its.it_value.tv_nsec = due % 1000000 * 1000;
+
+    if (timerfd_settime(w->timer_fd, TFD_TIMER_ABSTIME, &its, NULL) == -1)
+    {
+        perror("timerfd_settime");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int wire_flush(mip_link *link)
+{
+    struct wire_link *w = link->state;
+    struct wire_slot *slot;
+    uint64_t now, next = 0;
+    unsigned int i;
+    int sent = 0, wc;
+
+    if (w->count == 0) return 0;
+
+    now = wire_now();
+    for (i = 0; i < w->count; i++)
+    {
+        slot = &w->queue[(w->tail + i) % WIRE_QUEUE];
+        if (slot->len == 0) continue;
+
+        if (slot->due > now)
+        {
+            if (next == 0 || slot->due < next) next = slot->due;
+            continue;
+        }
+
+        wc = sendto(w->sock, &slot->frame, slot->len, MSG_DONTWAIT,
+            (struct sockaddr*) &w->peer_addr[slot->peer], sizeof(struct sockaddr_un));
+        slot->len = 0;
+
+        /* a peer that is not running, or not keeping up, is a cable to nowhere */
+        if (wc == -1 && errno != ENOENT && errno != ECONNREFUSED &&
+            errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS)
+        {
+            perror("sendto");
+            link->stats.tx_dropped++;
+            return -1;
+        }
+
+        if (wc == -1) link->stats.tx_dropped++;
+        else sent++;
+    }
+
+    while (w->count && w->queue[w->tail].len == 0)
+    {
+        w->tail = (w->tail + 1) % WIRE_QUEUE;
+        w->count--;
+    }
+
+    if (sent)
+    {
+        link->stats.tx_batches++;
+        link->stats.tx_frames += sent;
+    }
+
+    if (wire_arm(w, next) == -1) return -1;
+    return sent;
+}
+
+static void wire_close(mip_link *link)
+{
+    struct wire_link *w = link->state;
+
+    if (w == NULL) return;
+    if (w->sock != -1)
+    {
+        close(w->sock);
+        unlink(w->path.sun_path);
+    }
+    if (w->timer_fd != -1) close(w->timer_fd);
+    free(w->queue);
+    free(w);
+}
+
+static const struct link_ops wire_ops = {
+    .name       = "wire",
+    .discover   = wire_discover,
+    .next       = wire_next,
+    .reserve    = wire_reserve,
+    .commit     = wire_commit,
+    .flush      = wire_flush,
+    .close      = wire_close,
+};
+
+mip_link *wire_create(const char *spec, uint8_t mip_address)
+{
+    char dir[sizeof(((struct sockaddr_un*) 0)->sun_path)];
+    struct wire_link *w;
+    mip_link *link;
+    int i;
+
+    w = allocate_memory(sizeof(struct wire_link));
+    if (w == NULL) return NULL;
+
+    w->sock = w->timer_fd = -1;
+    w->mip_address = mip_address;
+    w->seed = mip_address;
+
+    link = link_new(&wire_ops, w, -1, -1);
+    if (link == NULL)
+    {
+        free(w);
+        return NULL;
+    }
+
+    if (wire_parse(w, spec, dir, sizeof(dir)) == -1 || wire_path(&w->path, dir, mip_address) == -1)
+    {
+        free_link(link);
+        return NULL;
+    }
+
+    for (i = 0; i < w->peer_count; i++)
+    {
+        if (wire_path(&w->peer_addr[i], dir, w->peers[i]) == -1)
+        {
+            free_link(link);
+            return NULL;
+        }
+    }
+
+    /* one extra slot for the frame reserved while the queue is full */
+    w->queue = allocate_memory(sizeof(struct wire_slot) * (WIRE_QUEUE + 1));
+    if (w->queue == NULL)
+    {
+        free_link(link);
+        return NULL;
+    }
+
+    w->sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (w->sock == -1)
+    {
+        perror("socket");
+        free_link(link);
+        return NULL;
+    }
+
+    /* a socket left behind by a host that did not exit cleanly */
+    unlink(w->path.sun_path);
+    if (bind(w->sock, (struct sockaddr*) &w->path, sizeof(struct sockaddr_un)) == -1)
+    {
+        perror("bind");
+        close(w->sock);
+        w->sock = -1;
+        free_link(link);
+        return NULL;
+    }
+
+    w->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (w->timer_fd == -1)
+    {
+        perror("timerfd_create");
+        free_link(link);
+        return NULL;
+    }
+
+    link->fd = w->sock;
+    link->timer_fd = w->timer_fd;
+    return link;
+}
@@ -0,0 +1,189 @@
+#include "../headers/mip_routing.h"
+#include "../headers/mip.h"
+#include "../headers/common.h"
+#include "../headers/utils.h"
+#include "../headers/mip_event.h"
+
+#include <stdlib.h>         /* macros */
+#include <unistd.h>         /* daemon */
+#include <stdio.h>          /* prints */
+#include <string.h>         /* memcpy */
+#include <errno.h>          /* errno */
+
+int HELP = 0;
+
+/**
+ * Fires the HELLO and dead timers that are due.
+ * */
+static int handle_timers(int fd, void *arg)
+{
+    timer_base *timers = (timer_base*) arg;
+    (void) fd;
+
+    return timer_run(timers, 0);
+}
+
+/**
+ * Handles a single message from the daemon.
+ * */
+static int handle_daemon(int fd, void *arg)
+{
+    routing_daemon *r = (routing_daemon*) arg;
+    struct ctrl_msg msg;
+    int rc;
+
+    rc = recv_from_daemon(fd, r->buf, &msg);
+    if (rc == RECV_AGAIN) return 0;
+    if (rc == -1) return -1;
+
+    /* a malformed message is dropped */
+    if (rc == 0 && routing_handle_msg(r, &msg) == -1) return -1;
+
+    return 1;
+}
+
+int main(int argc, char* argv[])
+{
+    uint8_t                         mip_address;
+    int                             rc, c, link_state = 0;
+    long                            hello_interval = HELLO_INTERVAL_MS;
+    long                            detect_mult = DETECT_MULT;
+    long                            probe_interval = PROBE_INTERVAL_MS;
+    uint8_t                         probe[MAX_NEIGHBOURS] = {0};
+    struct timer_base               timers;
+    struct routing_daemon           *r;
+
+    if (argc < 3)
+    {
+        printf("usage: ./mip_routing <socket_lower> <mip_address>\n");
+        return EXIT_SUCCESS;
+    }
+
+    while ((c = getopt(argc, argv, "hdli:m:f:p:")) != -1)
+    {
+        switch (c)
+        {
+            case 'h':
+                HELP = 1;
+                break;
+            case 'd':
+                DEBUG = 1;
+                break;
+            case 'l':
+                link_state = 1;
+                break;
+            case 'i':
+                hello_interval = routing_parse_option(optarg, UINT16_MAX);
+                break;
+            case 'm':
+                detect_mult = routing_parse_option(optarg, UINT8_MAX);
+                break;
+            case 'p':
+                probe_interval = routing_parse_option(optarg, UINT16_MAX);
+                break;
+            case 'f':
+                if (routing_parse_probes(optarg, probe) == -1) HELP = 1;
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (HELP) {
+        printf("%s\n", "-h >> usage: ./mip_routing [-h] [-d] [-l] [-i <hello_ms>] [-m <mult>] [-f <mip>[,<mip>...]] [-p <probe_ms>] <socket_lower> <mip_address>");
+        return EXIT_SUCCESS;
+    }
+
+    if (argc - optind != 2 || hello_interval == -1 || detect_mult == -1 || probe_interval == -1)
+    {
+        printf("usage: ./mip_routing [-h] [-d] [-l] [-i <hello_ms>] [-m <mult>] [-f <mip>[,<mip>...]] [-p <probe_ms>] <socket_lower> <mip_address>\n");
+        return EXIT_SUCCESS;
+    }
+
+    mip_address = (uint8_t) atoi(argv[optind + 1]);
+
+    /* create daemon */
+    if (daemon(NO_CHANGE, NO_CHANGE) == -1)
+    {
+        perror("daemon");
+        return EXIT_FAILURE;
+    }
+
+    r = allocate_memory(sizeof(struct routing_daemon));
+    if (r == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+    r->out.fd = r->loop.epoll_fd = -1;
+
+    /* the routes are exported before the daemon is connected to, so it finds */
+    /* them when it accepts us. without them, it is pushed every route */
+    r->routes = route_shm_create(mip_address);
+    if (r->routes == NULL)
+    {
+        fprintf(stderr, "<routing>: no shared memory route table, using the socket only\n");
+    }
+
+    r->out.fd = mip_connect_unix_socket(argv[optind], MIP_ROUTING + '0');
+    if (r->out.fd == -1)
+    {
+        fprintf(stderr, " >>> <routing>: did you remember to start the daemon?\n");
+        free_routing_daemon(r);
+        return EXIT_FAILURE;
+    }
+
+    /* HELLOs and neighbour timeouts run on one monotonic timerfd */
+    if (timer_base_init(&timers, 1) == -1)
+    {
+        free_routing_daemon(r);
+        return EXIT_FAILURE;
+    }
+
+    if (event_loop_init(&r->loop, EVENT_BUDGET) == -1)
+    {
+        free_routing_daemon(r);
+        timer_base_close(&timers);
+        return EXIT_FAILURE;
+    }
+
+    /* every message is read with MSG_DONTWAIT until EAGAIN, so it can be edge-triggered */
+    rc = event_add(&r->loop, r->out.fd, EVENT_EDGE, handle_daemon, r);
+    if (rc == -1)
+    {
+        free_routing_daemon(r);
+        timer_base_close(&timers);
+        return EXIT_FAILURE;
+    }
+
+    rc = event_add(&r->loop, timers.fd, EVENT_LEVEL, handle_timers, &timers);
+    if (rc == -1)
+    {
+        free_routing_daemon(r);
+        timer_base_close(&timers);
+        return EXIT_FAILURE;
+    }
+
+    r->link_state       = link_state;
+    r->hello_interval   = hello_interval;
+    r->detect_mult      = detect_mult;
+    r->probe_interval   = probe_interval;
+    memcpy(r->probe, probe, MAX_NEIGHBOURS);
+    if (routing_init(r, mip_address, &timers) == -1 || routing_send_scheduled(r) == -1)
+    {
+        free_routing_daemon(r);
+        timer_base_close(&timers);
+        return EXIT_FAILURE;
+    }
+
+    /* handle every ready event, then send what they scheduled */
+    while (event_loop_run_once(&r->loop, -1) != -1)
+    {
+        if (routing_send_scheduled(r) == -1) break;
+    }
+
+    /* for valgrind debugging */
+    printf("<routing>: user interruption\n");
+    free_routing_daemon(r);
+    timer_base_close(&timers);
+    return EXIT_SUCCESS;
+}